@@ -16,6 +16,52 @@ def parse_board(line: str) -> str:
     return board_str[:64]
 
 
+def parse_board_seq(line: str) -> Optional[int]:
+    parts = line.split()
+    if len(parts) < 3:
+        return None
+    try:
+        return int(parts[2])
+    except ValueError:
+        return None
+
+
+def apply_delta(board_str: str, line: str) -> Optional[tuple]:
+    """Applies "DELTA <seq> <r> <c> <cell> ..." and returns (seq, board)."""
+    parts = line.split()
+    if len(parts) < 2 or (len(parts) - 2) % 3 != 0:
+        return None
+    try:
+        seq = int(parts[1])
+        cells = list(board_str)
+        for i in range(2, len(parts), 3):
+            r, c, ch = int(parts[i]), int(parts[i + 1]), parts[i + 2]
+            cells[r * BOARD_SIZE + c] = ch
+    except (ValueError, IndexError):
+        return None
+    return seq, "".join(cells)
+
+
+def parse_legal_moves(line: str) -> list:
+    """Parses "LEGAL_MOVES <n> r,c,r,c ..." into lists of (row, col) squares."""
+    moves = []
+    for path in line.split()[2:]:
+        try:
+            nums = [int(x) for x in path.split(",")]
+        except ValueError:
+            continue
+        if len(nums) >= 4 and len(nums) % 2 == 0:
+            moves.append(list(zip(nums[0::2], nums[1::2])))
+    return moves
+
+
+def flip(r: int, c: int, color: Optional[str]) -> tuple:
+    """Converts between server coordinates and the ones shown to BLACK."""
+    if color == "BLACK":
+        return BOARD_SIZE - 1 - r, BOARD_SIZE - 1 - c
+    return r, c
+
+
 def print_board(board_str: str, color: Optional[str]):
     if len(board_str) != 64:
         print("Invalid board length:", len(board_str))
@@ -61,22 +107,37 @@ def print_board(board_str: str, color: Optional[str]):
 
 
 def main():
-    if len(sys.argv) < 3:
-        print("Usage: python client.py <host> <port>")
+    if len(sys.argv) < 3 or (len(sys.argv) > 3 and (len(sys.argv) != 5 or sys.argv[3] not in ("watch", "bot", "resume"))):
+        print("Usage: python client.py <host> <port> [watch <game_id> | bot <level> | resume <token>]")
         print("Example: python client.py 127.0.0.1 1100")
+        print("Spectate: python client.py 127.0.0.1 1101 watch 1")
+        print("Play the server (levels 1-10): python client.py 127.0.0.1 1100 bot 3")
+        print("Get your seat back: python client.py 127.0.0.1 1100 resume <token from SESSION>")
         return
 
     host = sys.argv[1]
     port = int(sys.argv[2])
+    watch_id = sys.argv[4] if len(sys.argv) == 5 and sys.argv[3] == "watch" else None
+    bot_level = sys.argv[4] if len(sys.argv) == 5 and sys.argv[3] == "bot" else None
+    resume_token = sys.argv[4] if len(sys.argv) == 5 and sys.argv[3] == "resume" else None
 
     sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
     sock.connect((host, port))
     print(f"Connected to {host}:{port}")
 
+    if watch_id is not None:
+        sock.sendall(f"WATCH {watch_id}\n".encode("utf-8"))
+    elif bot_level is not None:
+        sock.sendall(f"PLAY_BOT {bot_level}\n".encode("utf-8"))
+    elif resume_token is not None:
+        sock.sendall(f"RESUME {resume_token}\n".encode("utf-8"))
+
     f = sock.makefile("r", encoding="utf-8", newline="\n")
 
     my_color = None
     last_board = None
+    last_seq = None
+    resyncing = False
     running = True
 
     while running:
@@ -95,43 +156,79 @@ def main():
                 my_color = parts[1]
                 print(f"Your color: {my_color}")
 
+        elif line.startswith("GAME"):
+            print(f"Game id: {line.split()[1]} (spectators can WATCH it)")
+
+        elif line.startswith("SESSION"):
+            print(f"Session token: {line.split()[1]} (use 'resume' with it to get back into this game)")
+
         elif line.startswith("BOARD"):
             last_board = parse_board(line)
+            last_seq = parse_board_seq(line)
+            resyncing = False
+            print_board(last_board, my_color)
+
+        elif line.startswith("DELTA"):
+            if resyncing:
+                continue
+            parts = line.split()
+            seq = int(parts[1]) if len(parts) > 1 and parts[1].isdigit() else None
+            if last_seq is not None and seq is not None and seq <= last_seq:
+                continue
+            applied = None
+            if last_board is not None and last_seq is not None and seq == last_seq + 1:
+                applied = apply_delta(last_board, line)
+            if applied is None:
+                # Missed a move (or never had a board): ask for the full one
+                # and ignore deltas until it arrives.
+                print("Board out of sync, requesting a full board...")
+                sock.sendall(b"BOARD\n")
+                resyncing = True
+                continue
+            last_seq, last_board = applied
             print_board(last_board, my_color)
 
         elif line in ("WAITING_FOR_OPPONENT",):
-            print("Waiting for second player...")
+            if bot_level is None and resume_token is None:
+                print("Waiting for second player...")
 
         elif line in ("YOUR_TURN", "YOUR_TURN_CONTINUE_CAPTURE"):
             print("Your move!")
+            # The prompt comes once the options are in.
+            sock.sendall(b"LEGAL_MOVES\n")
+
+        elif line.startswith("LEGAL_MOVES"):
+            options = parse_legal_moves(line)
+            for i, path in enumerate(options, 1):
+                shown = [flip(r, c, my_color) for r, c in path]
+                print(f"  {i}) " + " -> ".join(f"{r} {c}" for r, c in shown))
 
             while True:
-                user_inp = input("Enter move as 'r1 c1 r2 c2' or 'quit': ").strip()
+                user_inp = input("Enter move as 'r1 c1 r2 c2 [r3 c3 ...]', an option number or 'quit': ").strip()
                 if user_inp.lower() in ("q", "quit", "exit"):
                     sock.sendall(b"QUIT\n")
                     running = False
                     break
 
                 parts = user_inp.split()
-                if len(parts) != 4:
-                    print("Invalid format. Need 4 numbers.")
+                if len(parts) == 1 and parts[0].isdigit() and 1 <= int(parts[0]) <= len(options):
+                    # A whole capture chain goes out as one MOVE.
+                    path = options[int(parts[0]) - 1]
+                    sock.sendall(("MOVE " + " ".join(f"{r} {c}" for r, c in path) + "\n").encode("utf-8"))
+                    break
+
+                if len(parts) < 4 or len(parts) % 2 != 0:
+                    print("Invalid format. Need pairs of numbers (at least 4) or an option number.")
                     continue
 
                 try:
-                    r1, c1, r2, c2 = map(int, parts)
+                    nums = list(map(int, parts))
                 except ValueError:
                     print("All coordinates must be integers.")
                     continue
 
-                if my_color == "BLACK":
-                    sr1 = BOARD_SIZE - 1 - r1
-                    sc1 = BOARD_SIZE - 1 - c1
-                    sr2 = BOARD_SIZE - 1 - r2
-                    sc2 = BOARD_SIZE - 1 - c2
-                else:
-                    sr1, sc1, sr2, sc2 = r1, c1, r2, c2
-
-                msg = f"MOVE {sr1} {sc1} {sr2} {sc2}\n"
+                path = [flip(nums[i], nums[i + 1], my_color) for i in range(0, len(nums), 2)]
+                msg = "MOVE " + " ".join(f"{r} {c}" for r, c in path) + "\n"
                 sock.sendall(msg.encode("utf-8"))
 
                 break
@@ -164,8 +261,32 @@ def main():
             print("Opponent left the game.")
             running = False
 
+        elif line == "OPPONENT_AWAY":
+            print("Opponent lost their connection, waiting for them to come back...")
+
+        elif line == "OPPONENT_BACK":
+            print("Opponent is back.")
+
+        elif line == "IDLE_TIMEOUT":
+            print("Disconnected for being idle.")
+            running = False
+
+        elif line in ("WHITE_WINS", "BLACK_WINS"):
+            print(f"=== {line.split('_')[0]} WINS ===")
+            running = False
+
+        elif line == "PLAYER_LEFT":
+            print("A player left the game.")
+            running = False
+
         elif line.startswith("ERROR_"):
             print("Error from server:", line)
+            if line in ("ERROR_NO_SUCH_GAME", "ERROR_NO_SUCH_SESSION"):
+                running = False
+
+        elif line == "SERVER_NO_MORE_GAMES":
+            print("Server cannot start another game right now.")
+            running = False
 
     sock.close()
 
@@ -2,257 +2,192 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-static int is_dark_square(int r, int c)
+#define EVEN_ROWS 0x0F0F0F0Fu  // rows 0, 2, 4, 6: dark squares in columns 1, 3, 5, 7
+#define ODD_ROWS 0xF0F0F0F0u   // rows 1, 3, 5, 7: dark squares in columns 0, 2, 4, 6
+#define LEFT_EDGE 0x11111111u  // first dark square of every row
+#define RIGHT_EDGE 0x88888888u // last dark square of every row
+
+#define WHITE_KING_ROW 0x0000000Fu
+#define BLACK_KING_ROW 0xF0000000u
+
+#define ZOBRIST_SEED 0x636865636B657273ull
+#define KEY_BLACK_TO_MOVE (BOARD_SQUARES * 5)
+
+// One diagonal step for every set bit; pieces that would leave the board
+// are dropped. "North" is towards row 0, where white men move.
+static uint32_t step_nw(uint32_t b)
 {
-    return (r >= 0 && r < BOARD_SIZE &&
-            c >= 0 && c < BOARD_SIZE &&
-            ((r + c) % 2 == 1));
+    return ((b & EVEN_ROWS) >> 4) | ((b & ODD_ROWS & ~LEFT_EDGE) >> 5);
 }
 
-static PlayerColor piece_color(char p)
+static uint32_t step_ne(uint32_t b)
 {
-    if (p == CELL_WHITE || p == CELL_WHITE_KING)
-        return COLOR_WHITE;
-    if (p == CELL_BLACK || p == CELL_BLACK_KING)
-        return COLOR_BLACK;
-    return COLOR_WHITE;
+    return ((b & EVEN_ROWS & ~RIGHT_EDGE) >> 3) | ((b & ODD_ROWS) >> 4);
 }
 
-static int is_king(char p)
+static uint32_t step_sw(uint32_t b)
 {
-    return (p == CELL_WHITE_KING || p == CELL_BLACK_KING);
+    return ((b & EVEN_ROWS) << 4) | ((b & ODD_ROWS & ~LEFT_EDGE) << 3);
 }
 
-void game_init(Game *g)
+static uint32_t step_se(uint32_t b)
 {
-    for (int r = 0; r < BOARD_SIZE; ++r)
-    {
-        for (int c = 0; c < BOARD_SIZE; ++c)
-        {
-            g->board[r][c] = CELL_EMPTY;
-        }
-    }
-
-    for (int r = 0; r < 3; ++r)
-    {
-        for (int c = 0; c < BOARD_SIZE; ++c)
-        {
-            if (is_dark_square(r, c))
-            {
-                g->board[r][c] = CELL_BLACK;
-            }
-        }
-    }
-
-    for (int r = BOARD_SIZE - 3; r < BOARD_SIZE; ++r)
-    {
-        for (int c = 0; c < BOARD_SIZE; ++c)
-        {
-            if (is_dark_square(r, c))
-            {
-                g->board[r][c] = CELL_WHITE;
-            }
-        }
-    }
-
-    g->turn = COLOR_WHITE;
-    g->result = GAME_RUNNING;
+    return ((b & EVEN_ROWS & ~RIGHT_EDGE) << 5) | ((b & ODD_ROWS) << 4);
+}
 
-    g->must_continue_capture = 0;
-    g->cap_row = -1;
-    g->cap_col = -1;
+static int is_dark_square(int r, int c)
+{
+    return (r >= 0 && r < BOARD_SIZE &&
+            c >= 0 && c < BOARD_SIZE &&
+            ((r + c) % 2 == 1));
 }
 
+static uint32_t square_bit(int r, int c)
+{
+    return 1u << (r * 4 + c / 2);
+}
 
-static int can_capture_from(const Game *g, int r, int c)
+// Zobrist keys are the outputs of a splitmix64 stream, worked out when
+// needed so there is no table to set up: key 5 * square + kind for a
+// piece (white man, white king, black man, black king), 5 * square + 4
+// for the piece that must go on capturing.
+static uint64_t zobrist(int n)
 {
-    char piece = g->board[r][c];
-    if (piece == CELL_EMPTY)
-        return 0;
+    uint64_t z = ZOBRIST_SEED + (uint64_t)(n + 1) * 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
 
-    PlayerColor pc = piece_color(piece);
-    int king = is_king(piece);
+static uint64_t piece_key(const Game *g, int sq)
+{
+    uint32_t bit = 1u << sq;
+    int kind = ((g->black & bit) ? 2 : 0) + ((g->kings & bit) ? 1 : 0);
+    return zobrist(sq * 5 + kind);
+}
 
-    int dirs[4][2];
-    int dir_count = 0;
+static uint64_t chain_key(const Game *g)
+{
+    return g->must_continue_capture ? zobrist(game_square(g->cap_row, g->cap_col) * 5 + 4) : 0;
+}
 
-    if (king)
-    {
-        dirs[0][0] = -2;
-        dirs[0][1] = -2;
-        dirs[1][0] = -2;
-        dirs[1][1] = 2;
-        dirs[2][0] = 2;
-        dirs[2][1] = -2;
-        dirs[3][0] = 2;
-        dirs[3][1] = 2;
-        dir_count = 4;
-    }
-    else
-    {
-        if (pc == COLOR_WHITE)
-        {
-            dirs[0][0] = -2;
-            dirs[0][1] = -2;
-            dirs[1][0] = -2;
-            dirs[1][1] = 2;
-        }
-        else
-        {
-            dirs[0][0] = 2;
-            dirs[0][1] = -2;
-            dirs[1][0] = 2;
-            dirs[1][1] = 2;
-        }
-        dir_count = 2;
-    }
+static uint64_t full_hash(const Game *g)
+{
+    uint64_t hash = chain_key(g);
+    for (uint32_t occupied = g->white | g->black; occupied; occupied &= occupied - 1)
+        hash ^= piece_key(g, __builtin_ctz(occupied));
+    if (g->turn == COLOR_BLACK)
+        hash ^= zobrist(KEY_BLACK_TO_MOVE);
+    return hash;
+}
 
-    for (int i = 0; i < dir_count; ++i)
-    {
-        int dr = dirs[i][0];
-        int dc = dirs[i][1];
-        int to_r = r + dr;
-        int to_c = c + dc;
+static uint32_t *own_pieces(Game *g, PlayerColor color)
+{
+    return (color == COLOR_WHITE) ? &g->white : &g->black;
+}
 
-        if (!is_dark_square(to_r, to_c))
-            continue;
+static uint32_t *opponent_pieces(Game *g, PlayerColor color)
+{
+    return (color == COLOR_WHITE) ? &g->black : &g->white;
+}
 
-        if (g->board[to_r][to_c] != CELL_EMPTY)
-            continue;
+// Pieces of this colour that may step towards row 0 / towards row 7.
+static uint32_t north_movers(const Game *g, PlayerColor color)
+{
+    return (color == COLOR_WHITE) ? g->white : (g->black & g->kings);
+}
 
-        int mid_r = r + dr / 2;
-        int mid_c = c + dc / 2;
+static uint32_t south_movers(const Game *g, PlayerColor color)
+{
+    return (color == COLOR_WHITE) ? (g->white & g->kings) : g->black;
+}
 
-        if (!is_dark_square(mid_r, mid_c))
-            continue;
+// Squares of the given colour holding a piece that can capture. Works
+// backwards from the empty landing squares, one mask per direction.
+static uint32_t capturers(const Game *g, PlayerColor color)
+{
+    uint32_t empty = ~(g->white | g->black);
+    uint32_t opp = (color == COLOR_WHITE) ? g->black : g->white;
+    uint32_t north = north_movers(g, color);
+    uint32_t south = south_movers(g, color);
+
+    uint32_t res = 0;
+    res |= step_se(step_se(empty) & opp) & north;
+    res |= step_sw(step_sw(empty) & opp) & north;
+    res |= step_nw(step_nw(empty) & opp) & south;
+    res |= step_ne(step_ne(empty) & opp) & south;
+    return res;
+}
 
-        char mid_piece = g->board[mid_r][mid_c];
-        if (mid_piece == CELL_EMPTY)
-            continue;
+// Squares of the given colour holding a piece with a non-capturing move.
+static uint32_t quiet_movers(const Game *g, PlayerColor color)
+{
+    uint32_t empty = ~(g->white | g->black);
 
-        PlayerColor mid_color = piece_color(mid_piece);
-        if (mid_color == pc)
-            continue;
+    return ((step_se(empty) | step_sw(empty)) & north_movers(g, color)) |
+           ((step_nw(empty) | step_ne(empty)) & south_movers(g, color));
+}
 
-        return 1;
-    }
+static int can_capture_from(const Game *g, int r, int c)
+{
+    uint32_t bit = square_bit(r, c);
+    PlayerColor pc = (g->white & bit) ? COLOR_WHITE : COLOR_BLACK;
 
-    return 0;
+    return (capturers(g, pc) & bit) != 0;
 }
 
 static int player_has_capture(const Game *g, PlayerColor color)
 {
-    for (int r = 0; r < BOARD_SIZE; ++r)
-    {
-        for (int c = 0; c < BOARD_SIZE; ++c)
-        {
-            char piece = g->board[r][c];
-            if (piece == CELL_EMPTY)
-                continue;
-            if (piece_color(piece) != color)
-                continue;
-            if (can_capture_from(g, r, c))
-                return 1;
-        }
-    }
-    return 0;
+    return capturers(g, color) != 0;
 }
 
-static int can_simple_move_from(const Game *g, int r, int c)
+// Every square within two diagonal steps of a set bit: the only pieces
+// whose mobility can change when those squares change.
+static uint32_t neighbourhood(uint32_t b)
 {
-    char piece = g->board[r][c];
-    if (piece == CELL_EMPTY)
-        return 0;
-
-    PlayerColor pc = piece_color(piece);
-    int king = is_king(piece);
+    for (int i = 0; i < 2; ++i)
+        b |= step_nw(b) | step_ne(b) | step_sw(b) | step_se(b);
+    return b;
+}
 
-    int dirs[4][2];
-    int dir_count = 0;
+static void refresh_mobility(Game *g, uint32_t changed)
+{
+    uint32_t region = neighbourhood(changed);
 
-    if (king)
+    for (int color = COLOR_WHITE; color <= COLOR_BLACK; ++color)
     {
-        dirs[0][0] = -1;
-        dirs[0][1] = -1;
-        dirs[1][0] = -1;
-        dirs[1][1] = 1;
-        dirs[2][0] = 1;
-        dirs[2][1] = -1;
-        dirs[3][0] = 1;
-        dirs[3][1] = 1;
-        dir_count = 4;
-    }
-    else
-    {
-        if (pc == COLOR_WHITE)
-        {
-            dirs[0][0] = -1;
-            dirs[0][1] = -1;
-            dirs[1][0] = -1;
-            dirs[1][1] = 1;
-        }
-        else
-        {
-            dirs[0][0] = 1;
-            dirs[0][1] = -1;
-            dirs[1][0] = 1;
-            dirs[1][1] = 1;
-        }
-        dir_count = 2;
+        uint32_t mobile = capturers(g, color) | quiet_movers(g, color);
+        g->movable[color] = (g->movable[color] & ~region) | (mobile & region);
     }
+}
 
-    for (int i = 0; i < dir_count; ++i)
-    {
-        int nr = r + dirs[i][0];
-        int nc = c + dirs[i][1];
+void game_init(Game *g)
+{
+    g->black = 0x00000FFFu; // rows 0-2
+    g->white = 0xFFF00000u; // rows 5-7
+    g->kings = 0;
 
-        if (!is_dark_square(nr, nc))
-            continue;
-        if (g->board[nr][nc] != CELL_EMPTY)
-            continue;
+    g->turn = COLOR_WHITE;
+    g->result = GAME_RUNNING;
 
-        return 1;
-    }
-    return 0;
-}
+    g->must_continue_capture = 0;
+    g->cap_row = -1;
+    g->cap_col = -1;
 
-static int player_has_any_move(const Game *g, PlayerColor color)
-{
-    if (player_has_capture(g, color))
-        return 1;
+    g->piece_count[COLOR_WHITE] = 12;
+    g->piece_count[COLOR_BLACK] = 12;
+    g->movable[COLOR_WHITE] = 0;
+    g->movable[COLOR_BLACK] = 0;
+    refresh_mobility(g, ~0u);
 
-    for (int r = 0; r < BOARD_SIZE; ++r)
-    {
-        for (int c = 0; c < BOARD_SIZE; ++c)
-        {
-            char piece = g->board[r][c];
-            if (piece == CELL_EMPTY)
-                continue;
-            if (piece_color(piece) != color)
-                continue;
-            if (can_simple_move_from(g, r, c))
-                return 1;
-        }
-    }
-    return 0;
+    g->hash = full_hash(g);
+    g->quiet_plies = 0;
 }
 
 static void update_game_result(Game *g)
 {
-    int white_count = 0;
-    int black_count = 0;
-
-    for (int r = 0; r < BOARD_SIZE; ++r)
-    {
-        for (int c = 0; c < BOARD_SIZE; ++c)
-        {
-            char p = g->board[r][c];
-            if (p == CELL_WHITE || p == CELL_WHITE_KING)
-                white_count++;
-            else if (p == CELL_BLACK || p == CELL_BLACK_KING)
-                black_count++;
-        }
-    }
+    int white_count = g->piece_count[COLOR_WHITE];
+    int black_count = g->piece_count[COLOR_BLACK];
 
     if (white_count == 0 && black_count == 0)
     {
@@ -270,8 +205,8 @@ static void update_game_result(Game *g)
         return;
     }
 
-    int white_moves = player_has_any_move(g, COLOR_WHITE);
-    int black_moves = player_has_any_move(g, COLOR_BLACK);
+    int white_moves = (g->movable[COLOR_WHITE] != 0);
+    int black_moves = (g->movable[COLOR_BLACK] != 0);
 
     if (!white_moves && !black_moves)
     {
@@ -291,30 +226,47 @@ static void update_game_result(Game *g)
     }
 }
 
+void game_set_position(Game *g, uint32_t white, uint32_t black, uint32_t kings,
+                       PlayerColor turn, int cap_square)
+{
+    g->white = white;
+    g->black = black;
+    g->kings = kings & (white | black);
+    g->turn = turn;
+
+    g->must_continue_capture = (cap_square >= 0);
+    g->cap_row = -1;
+    g->cap_col = -1;
+    if (cap_square >= 0)
+        game_square_coords(cap_square, &g->cap_row, &g->cap_col);
+
+    g->piece_count[COLOR_WHITE] = __builtin_popcount(white);
+    g->piece_count[COLOR_BLACK] = __builtin_popcount(black);
+    g->movable[COLOR_WHITE] = 0;
+    g->movable[COLOR_BLACK] = 0;
+    refresh_mobility(g, ~0u);
+    update_game_result(g);
+
+    g->hash = full_hash(g);
+    g->quiet_plies = 0;
+}
+
 int game_is_move_legal(const Game *g, int from_row, int from_col,
                        int to_row, int to_col)
 {
-    if (from_row < 0 || from_row >= BOARD_SIZE ||
-        from_col < 0 || from_col >= BOARD_SIZE ||
-        to_row < 0 || to_row >= BOARD_SIZE ||
-        to_col < 0 || to_col >= BOARD_SIZE)
-        return 0;
-
     if (!is_dark_square(from_row, from_col) ||
         !is_dark_square(to_row, to_col))
         return 0;
 
-    char piece = g->board[from_row][from_col];
-    char dest = g->board[to_row][to_col];
-
-    if (piece == CELL_EMPTY)
-        return 0;
+    uint32_t from_bit = square_bit(from_row, from_col);
+    uint32_t to_bit = square_bit(to_row, to_col);
+    uint32_t own = (g->turn == COLOR_WHITE) ? g->white : g->black;
+    uint32_t opp = (g->turn == COLOR_WHITE) ? g->black : g->white;
 
-    if (dest != CELL_EMPTY)
+    if (!(own & from_bit))
         return 0;
 
-    PlayerColor pc = piece_color(piece);
-    if (pc != g->turn)
+    if ((g->white | g->black) & to_bit)
         return 0;
 
     int dr = to_row - from_row;
@@ -325,7 +277,8 @@ int game_is_move_legal(const Game *g, int from_row, int from_col,
     if (abs_dr != abs_dc)
         return 0;
 
-    int king = is_king(piece);
+    int king = (g->kings & from_bit) != 0;
+    int forward = (g->turn == COLOR_WHITE) ? -1 : 1;
 
     int is_capture_move = (abs_dr == 2);
     int is_simple_move = (abs_dr == 1);
@@ -338,44 +291,23 @@ int game_is_move_legal(const Game *g, int from_row, int from_col,
             return 0;
     }
 
-    if (is_simple_move && player_has_capture(g, g->turn))
-    {
-        return 0;
-    }
-
     if (is_simple_move)
     {
-        if (!king)
-        {
-            if (pc == COLOR_WHITE && dr != -1)
-                return 0;
-            if (pc == COLOR_BLACK && dr != 1)
-                return 0;
-        }
+        if (player_has_capture(g, g->turn))
+            return 0;
+        if (!king && dr != forward)
+            return 0;
         return 1;
     }
 
     if (is_capture_move)
     {
-        int mid_row = (from_row + to_row) / 2;
-        int mid_col = (from_col + to_col) / 2;
-        char mid_piece = g->board[mid_row][mid_col];
+        uint32_t mid_bit = square_bit((from_row + to_row) / 2, (from_col + to_col) / 2);
 
-        if (mid_piece == CELL_EMPTY)
+        if (!(opp & mid_bit))
             return 0;
-
-        PlayerColor mid_color = piece_color(mid_piece);
-        if (mid_color == pc)
+        if (!king && dr != 2 * forward)
             return 0;
-
-        if (!king)
-        {
-            if (pc == COLOR_WHITE && dr != -2)
-                return 0;
-            if (pc == COLOR_BLACK && dr != 2)
-                return 0;
-        }
-
         return 1;
     }
 
@@ -388,37 +320,43 @@ int game_apply_move(Game *g, int from_row, int from_col,
     if (!game_is_move_legal(g, from_row, from_col, to_row, to_col))
         return 0;
 
-    char piece = g->board[from_row][from_col];
+    uint32_t from_bit = square_bit(from_row, from_col);
+    uint32_t to_bit = square_bit(to_row, to_col);
+    uint32_t *own = own_pieces(g, g->turn);
     int dr = to_row - from_row;
     int abs_dr = (dr < 0) ? -dr : dr;
 
     int was_capture = 0;
+    int was_king = (g->kings & from_bit) != 0;
+    uint32_t changed = from_bit | to_bit;
+    uint64_t hash = g->hash ^ chain_key(g) ^ piece_key(g, __builtin_ctz(from_bit));
 
     if (abs_dr == 2)
     {
-        int mid_row = (from_row + to_row) / 2;
-        int mid_col = (from_col + to_col) / 2;
-        g->board[mid_row][mid_col] = CELL_EMPTY;
+        uint32_t mid_bit = square_bit((from_row + to_row) / 2, (from_col + to_col) / 2);
+        hash ^= piece_key(g, __builtin_ctz(mid_bit));
+        *opponent_pieces(g, g->turn) &= ~mid_bit;
+        g->kings &= ~mid_bit;
+        g->piece_count[g->turn == COLOR_WHITE ? COLOR_BLACK : COLOR_WHITE]--;
+        changed |= mid_bit;
         was_capture = 1;
     }
 
-    g->board[to_row][to_col] = piece;
-    g->board[from_row][from_col] = CELL_EMPTY;
+    *own ^= from_bit | to_bit;
+    if (g->kings & from_bit)
+        g->kings ^= from_bit | to_bit;
 
-    if (piece == CELL_WHITE && to_row == 0)
-    {
-        g->board[to_row][to_col] = CELL_WHITE_KING;
-    }
-    else if (piece == CELL_BLACK && to_row == BOARD_SIZE - 1)
-    {
-        g->board[to_row][to_col] = CELL_BLACK_KING;
-    }
+    uint32_t king_row = (g->turn == COLOR_WHITE) ? WHITE_KING_ROW : BLACK_KING_ROW;
+    g->kings |= to_bit & king_row;
+    hash ^= piece_key(g, __builtin_ctz(to_bit));
+    g->quiet_plies = (was_capture || !was_king) ? 0 : g->quiet_plies + 1;
 
     if (was_capture && can_capture_from(g, to_row, to_col))
     {
         g->must_continue_capture = 1;
         g->cap_row = to_row;
         g->cap_col = to_col;
+        hash ^= chain_key(g);
     }
     else
     {
@@ -427,8 +365,11 @@ int game_apply_move(Game *g, int from_row, int from_col,
         g->cap_col = -1;
 
         g->turn = (g->turn == COLOR_WHITE) ? COLOR_BLACK : COLOR_WHITE;
+        hash ^= zobrist(KEY_BLACK_TO_MOVE);
     }
+    g->hash = hash;
 
+    refresh_mobility(g, changed);
     update_game_result(g);
 
     return 1;
@@ -438,3 +379,183 @@ int game_is_finished(Game *g)
 {
     return (g->result != GAME_RUNNING);
 }
+
+char game_cell(const Game *g, int row, int col)
+{
+    if (!is_dark_square(row, col))
+        return CELL_EMPTY;
+
+    uint32_t bit = square_bit(row, col);
+    int king = (g->kings & bit) != 0;
+
+    if (g->white & bit)
+        return king ? CELL_WHITE_KING : CELL_WHITE;
+    if (g->black & bit)
+        return king ? CELL_BLACK_KING : CELL_BLACK;
+    return CELL_EMPTY;
+}
+
+int game_square(int row, int col)
+{
+    if (!is_dark_square(row, col))
+        return -1;
+    return row * 4 + col / 2;
+}
+
+void game_square_coords(int square, int *row, int *col)
+{
+    *row = square / 4;
+    *col = (square % 4) * 2 + ((*row % 2 == 0) ? 1 : 0);
+}
+
+uint32_t game_diff(const Game *a, const Game *b)
+{
+    return (a->white ^ b->white) | (a->black ^ b->black) | (a->kings ^ b->kings);
+}
+
+void game_history_init(GameHistory *h, const Game *g)
+{
+    h->hashes[0] = g->hash;
+    h->count = 1;
+}
+
+int game_check_draw(Game *g, GameHistory *h, int max_quiet_plies)
+{
+    if (g->result != GAME_RUNNING || g->must_continue_capture)
+        return 0;
+    if (g->quiet_plies == 0)
+        h->count = 0;
+
+    // The same side was to move every second turn back.
+    int seen = 1;
+    int back = (h->count < GAME_HISTORY) ? h->count : GAME_HISTORY;
+    for (int i = 2; i <= back; i += 2)
+        if (h->hashes[(h->count - i) % GAME_HISTORY] == g->hash)
+            seen++;
+
+    h->hashes[h->count % GAME_HISTORY] = g->hash;
+    h->count++;
+
+    if (seen >= 3 || (max_quiet_plies > 0 && g->quiet_plies >= max_quiet_plies))
+    {
+        g->result = GAME_DRAW;
+        return 1;
+    }
+    return 0;
+}
+
+// Directions 0 and 1 lead towards row 0, 2 and 3 towards row 7.
+static uint32_t step_dir(uint32_t b, int dir)
+{
+    switch (dir)
+    {
+    case 0:
+        return step_nw(b);
+    case 1:
+        return step_ne(b);
+    case 2:
+        return step_sw(b);
+    default:
+        return step_se(b);
+    }
+}
+
+static int dir_allowed(PlayerColor color, int king, int dir)
+{
+    return king || ((color == COLOR_WHITE) ? dir < 2 : dir >= 2);
+}
+
+typedef struct
+{
+    Move *out;
+    int max;
+    int count;
+    PlayerColor color;
+} MoveList;
+
+static void emit_move(MoveList *list, const Move *m)
+{
+    if (list->count < list->max)
+        list->out[list->count] = *m;
+    list->count++;
+}
+
+// Follows every continuation of a chain whose piece stands on at. Taken
+// pieces leave the board at once and a man crowned on the way goes on as
+// a king, as in game_apply_move.
+static void extend_chain(MoveList *list, Move *m, uint32_t at, int king, uint32_t opp, uint32_t empty)
+{
+    uint32_t king_row = (list->color == COLOR_WHITE) ? WHITE_KING_ROW : BLACK_KING_ROW;
+    int extended = 0;
+
+    for (int dir = 0; dir < 4; ++dir)
+    {
+        if (!dir_allowed(list->color, king, dir))
+            continue;
+
+        uint32_t mid = step_dir(at, dir) & opp;
+        uint32_t land = step_dir(mid, dir) & empty;
+        if (land == 0)
+            continue;
+
+        extended = 1;
+        m->hops++;
+        m->squares[m->hops] = (uint8_t)__builtin_ctz(land);
+        m->captured |= mid;
+
+        extend_chain(list, m, land, king || (land & king_row), opp & ~mid, (empty | at | mid) & ~land);
+
+        m->captured &= ~mid;
+        m->hops--;
+    }
+
+    // The first call is for the piece before it has captured anything.
+    if (!extended && m->hops > 0)
+        emit_move(list, m);
+}
+
+int game_generate_moves(const Game *g, Move *out, int max)
+{
+    MoveList list = {out, max, 0, g->turn};
+    uint32_t own = (g->turn == COLOR_WHITE) ? g->white : g->black;
+    uint32_t opp = (g->turn == COLOR_WHITE) ? g->black : g->white;
+    uint32_t empty = ~(g->white | g->black);
+    Move m;
+
+    uint32_t jumpers = capturers(g, g->turn);
+    if (g->must_continue_capture)
+        jumpers &= square_bit(g->cap_row, g->cap_col);
+
+    if (jumpers != 0 || g->must_continue_capture)
+    {
+        for (; jumpers; jumpers &= jumpers - 1)
+        {
+            uint32_t bit = jumpers & -jumpers;
+            m.squares[0] = (uint8_t)__builtin_ctz(bit);
+            m.hops = 0;
+            m.captured = 0;
+            extend_chain(&list, &m, bit, (g->kings & bit) != 0, opp, empty);
+        }
+        return list.count;
+    }
+
+    for (uint32_t pieces = own; pieces; pieces &= pieces - 1)
+    {
+        uint32_t bit = pieces & -pieces;
+        int king = (g->kings & bit) != 0;
+
+        for (int dir = 0; dir < 4; ++dir)
+        {
+            uint32_t land = step_dir(bit, dir) & empty;
+            if (!dir_allowed(g->turn, king, dir) || land == 0)
+                continue;
+
+            m.squares[0] = (uint8_t)__builtin_ctz(bit);
+            m.squares[1] = (uint8_t)__builtin_ctz(land);
+            m.hops = 1;
+            m.captured = 0;
+            emit_move(&list, &m);
+        }
+    }
+    return list.count;
+}
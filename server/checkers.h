@@ -1,7 +1,10 @@
 #ifndef CHECKERS_H
 #define CHECKERS_H
 
+#include <stdint.h>
+
 #define BOARD_SIZE 8
+#define BOARD_SQUARES 32 // playable dark squares
 
 typedef enum
 {
@@ -26,20 +29,80 @@ typedef enum
     GAME_DRAW
 } GameResult;
 
+// Bitboards hold one bit per dark square: square (row, col) is bit
+// row * 4 + col / 2, so bits 0-3 are row 0 and bits 28-31 are row 7.
 typedef struct
 {
-    char board[BOARD_SIZE][BOARD_SIZE];
+    uint32_t white; // squares holding a white man or king
+    uint32_t black; // squares holding a black man or king
+    uint32_t kings; // squares holding a king of either colour
     PlayerColor turn; // COLOR_WHITE or COLOR_BLACK
     GameResult result; // GAME_RUNNING, GAME_WHITE_WIN, GAME_BLACK_WIN, GAME_DRAW
 
     int must_continue_capture; // whether the current player must continue a capture sequence
     int cap_row; // row of the piece that must continue capturing
     int cap_col; // column of the piece that must continue capturing
+
+    // Kept up to date by game_apply_move so the end of the game is known
+    // without rescanning the board. Indexed by PlayerColor.
+    int piece_count[2]; // pieces left
+    uint32_t movable[2]; // pieces that have at least one step or jump
+
+    // Zobrist key of the pieces, the side to move and the square that must
+    // go on capturing, updated move by move.
+    uint64_t hash;
+    int quiet_plies; // turns since a capture or a man moved
 } Game;
 
 void game_init(Game *g);
+
+// Any position, e.g. one read back from disk. cap_square is the square
+// of the piece that must go on capturing, or -1.
+void game_set_position(Game *g, uint32_t white, uint32_t black, uint32_t kings,
+                       PlayerColor turn, int cap_square);
+
 int game_is_move_legal(const Game *g, int from_row, int from_col, int to_row, int to_col);
 int game_apply_move(Game *g, int from_row, int from_col, int to_row, int to_col);
 int game_is_finished(Game *g);
+char game_cell(const Game *g, int row, int col); // one of the Cell values
+int game_square(int row, int col); // bit index of a dark square, -1 otherwise
+void game_square_coords(int square, int *row, int *col);
+
+// Squares (as bits) whose contents differ between the two positions.
+uint32_t game_diff(const Game *a, const Game *b);
+
+#define GAME_HISTORY 64 // whole turns looked back over for a repetition
+
+// Keys of the positions since the last capture or man move, newest last:
+// nothing older can come round again. A repetition more than
+// GAME_HISTORY turns apart is left to the quiet move limit.
+typedef struct
+{
+    uint64_t hashes[GAME_HISTORY];
+    int count;
+} GameHistory;
+
+void game_history_init(GameHistory *h, const Game *g);
+
+// After a whole turn: records g and ends the game as a draw if its
+// position has now come up three times with the same side to move, or if
+// max_quiet_plies turns (0: no limit) went by without a capture or a man
+// moving. Returns whether it did.
+int game_check_draw(Game *g, GameHistory *h, int max_quiet_plies);
+
+#define MOVE_MAX_HOPS 12 // a chain can take every opposing piece at most once
+
+// One whole turn: a step, or a capture chain played to its end.
+typedef struct
+{
+    uint8_t squares[MOVE_MAX_HOPS + 1]; // start square, then each landing square
+    int hops;
+    uint32_t captured; // squares of the pieces taken
+} Move;
+
+// Every legal move of the side to move; during a capture chain only the
+// rest of the chain. Writes at most max of them to out and returns how
+// many there are, so a return above max means the list was cut short.
+int game_generate_moves(const Game *g, Move *out, int max);
 
 #endif
@@ -0,0 +1,313 @@
+#include "endgame.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MAN_SQUARES 28 // men never stand on their own crowning row
+#define MAX_SLICES 256
+#define COUNTS (ENDGAME_MAX_PIECES + 1)
+
+static const char magic[8] = "CKEGDB1";
+
+// On disk the header is followed by two bits per index, four indices to a
+// byte, lowest bits first.
+typedef struct
+{
+    char magic[8];
+    uint32_t max_pieces;
+    uint32_t reserved;
+    uint64_t positions;
+} EndgameHeader;
+
+typedef struct
+{
+    uint8_t wm, wk, bm, bk; // white men and kings, black men and kings
+} SliceCounts;
+
+// Slices are ordered by piece count first, so the layout for fewer pieces
+// is a prefix of the layout for more and one table serves every size.
+static SliceCounts slice_order[MAX_SLICES];
+static uint64_t slice_start[MAX_SLICES + 1];
+static uint64_t slice_base[COUNTS][COUNTS][COUNTS][COUNTS];
+static int slices_upto[ENDGAME_MAX_PIECES + 1]; // slices with at most n pieces
+static int slice_count;
+static uint64_t binom[BOARD_SQUARES + 1][COUNTS];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static const uint8_t *table; // the mapping, past the header
+static int table_pieces;
+
+static uint64_t slice_size(int wm, int wk, int bm, int bk)
+{
+    int men = wm + bm;
+    if (men + wk + bk > BOARD_SQUARES)
+        return 0;
+    return binom[MAN_SQUARES][wm] * binom[MAN_SQUARES][bm] * binom[BOARD_SQUARES - men][wk] *
+           binom[BOARD_SQUARES - men - wk][bk] * 2;
+}
+
+static void tables_init(void)
+{
+    for (int n = 0; n <= BOARD_SQUARES; ++n)
+    {
+        binom[n][0] = 1;
+        for (int k = 1; k < COUNTS; ++k)
+            binom[n][k] = (n == 0) ? 0 : binom[n - 1][k - 1] + binom[n - 1][k];
+    }
+
+    uint64_t next = 0;
+    for (int n = 2; n <= ENDGAME_MAX_PIECES; ++n)
+    {
+        // Promotion trades a man for a king, so fewer men goes first.
+        for (int men = 0; men <= n; ++men)
+            for (int wm = 0; wm <= men; ++wm)
+                for (int wk = 0; wk <= n - men; ++wk)
+                {
+                    int bm = men - wm;
+                    int bk = n - men - wk;
+                    if (wm + wk == 0 || bm + bk == 0)
+                        continue;
+
+                    slice_order[slice_count] = (SliceCounts){ wm, wk, bm, bk };
+                    slice_start[slice_count] = next;
+                    slice_base[wm][wk][bm][bk] = next;
+                    next += slice_size(wm, wk, bm, bk);
+                    slice_count++;
+                }
+        slices_upto[n] = slice_count;
+    }
+    slice_start[slice_count] = next;
+}
+
+// Combinatorial number system: a k-subset of 0..d-1 taken in increasing
+// order p1 < p2 < ... ranks as C(p1, 1) + C(p2, 2) + ..., densely in
+// 0..C(d, k)-1. Squares are numbered from shift.
+static uint64_t rank_squares(uint32_t squares, int shift)
+{
+    uint64_t r = 0;
+    int k = 0;
+    while (squares != 0)
+    {
+        int sq = __builtin_ctz(squares);
+        squares &= squares - 1;
+        r += binom[sq - shift][++k];
+    }
+    return r;
+}
+
+static uint32_t unrank_squares(uint64_t r, int k, int domain, int shift)
+{
+    uint32_t squares = 0;
+    int p = domain;
+    for (; k > 0; --k)
+    {
+        do
+            p--;
+        while (binom[p][k] > r);
+        r -= binom[p][k];
+        squares |= 1u << (p + shift);
+    }
+    return squares;
+}
+
+// Kings are ranked among the squares left free, numbered in order.
+static uint32_t compress(uint32_t squares, uint32_t free)
+{
+    uint32_t out = 0;
+    while (squares != 0)
+    {
+        uint32_t bit = squares & -squares;
+        squares &= squares - 1;
+        out |= 1u << __builtin_popcount(free & (bit - 1));
+    }
+    return out;
+}
+
+static uint32_t expand(uint32_t squares, uint32_t free)
+{
+    uint32_t out = 0;
+    for (int i = 0; free != 0; ++i)
+    {
+        uint32_t bit = free & -free;
+        free &= free - 1;
+        if (squares & (1u << i))
+            out |= bit;
+    }
+    return out;
+}
+
+uint64_t endgame_positions(int max_pieces)
+{
+    pthread_once(&tables_once, tables_init);
+    if (max_pieces < 2)
+        return 0;
+    if (max_pieces > ENDGAME_MAX_PIECES)
+        max_pieces = ENDGAME_MAX_PIECES;
+    return slice_start[slices_upto[max_pieces]];
+}
+
+int endgame_slices(int max_pieces, uint64_t *starts, int room)
+{
+    pthread_once(&tables_once, tables_init);
+    if (max_pieces < 2)
+        return 0;
+    if (max_pieces > ENDGAME_MAX_PIECES)
+        max_pieces = ENDGAME_MAX_PIECES;
+
+    int n = slices_upto[max_pieces];
+    for (int i = 0; i <= n && i < room; ++i)
+        starts[i] = slice_start[i];
+    return n;
+}
+
+int64_t endgame_index(const Game *g, int max_pieces)
+{
+    pthread_once(&tables_once, tables_init);
+    if (g->must_continue_capture || g->white == 0 || g->black == 0)
+        return -1;
+
+    uint32_t white_men = g->white & ~g->kings;
+    uint32_t black_men = g->black & ~g->kings;
+    uint32_t white_kings = g->white & g->kings;
+    uint32_t black_kings = g->black & g->kings;
+    int wm = __builtin_popcount(white_men);
+    int wk = __builtin_popcount(white_kings);
+    int bm = __builtin_popcount(black_men);
+    int bk = __builtin_popcount(black_kings);
+    int n = wm + wk + bm + bk;
+    if (n > max_pieces || n > ENDGAME_MAX_PIECES)
+        return -1;
+    if ((white_men & 0x0000000Fu) || (black_men & 0xF0000000u))
+        return -1;
+
+    uint32_t free = ~(white_men | black_men);
+    uint64_t idx = rank_squares(white_men, 4);
+    idx = idx * binom[MAN_SQUARES][bm] + rank_squares(black_men, 0);
+    idx = idx * binom[BOARD_SQUARES - wm - bm][wk] + rank_squares(compress(white_kings, free), 0);
+    free &= ~white_kings;
+    idx = idx * binom[BOARD_SQUARES - wm - bm - wk][bk] + rank_squares(compress(black_kings, free), 0);
+    idx = idx * 2 + (g->turn == COLOR_BLACK);
+
+    return (int64_t)(slice_base[wm][wk][bm][bk] + idx);
+}
+
+int endgame_position(uint64_t index, int max_pieces, Game *g)
+{
+    if (index >= endgame_positions(max_pieces))
+        return -1;
+
+    int lo = 0;
+    int hi = slice_count - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (slice_start[mid] <= index)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    SliceCounts s = slice_order[lo];
+    int men = s.wm + s.bm;
+    uint64_t idx = index - slice_start[lo];
+    PlayerColor turn = (idx & 1) ? COLOR_BLACK : COLOR_WHITE;
+    idx /= 2;
+
+    uint64_t bk_size = binom[BOARD_SQUARES - men - s.wk][s.bk];
+    uint64_t bk_rank = idx % bk_size;
+    idx /= bk_size;
+    uint64_t wk_size = binom[BOARD_SQUARES - men][s.wk];
+    uint64_t wk_rank = idx % wk_size;
+    idx /= wk_size;
+    uint64_t bm_size = binom[MAN_SQUARES][s.bm];
+    uint64_t bm_rank = idx % bm_size;
+    idx /= bm_size;
+
+    uint32_t white_men = unrank_squares(idx, s.wm, MAN_SQUARES, 4);
+    uint32_t black_men = unrank_squares(bm_rank, s.bm, MAN_SQUARES, 0);
+    if (white_men & black_men)
+        return -1;
+
+    uint32_t free = ~(white_men | black_men);
+    uint32_t white_kings = expand(unrank_squares(wk_rank, s.wk, BOARD_SQUARES - men, 0), free);
+    free &= ~white_kings;
+    uint32_t black_kings = expand(unrank_squares(bk_rank, s.bk, BOARD_SQUARES - men - s.wk, 0), free);
+
+    game_set_position(g, white_men | white_kings, black_men | black_kings, white_kings | black_kings, turn,
+                      -1);
+    return 0;
+}
+
+int endgame_write(const char *path, int max_pieces, const uint8_t *values)
+{
+    EndgameHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, magic, sizeof(h.magic));
+    h.max_pieces = (uint32_t)max_pieces;
+    h.positions = endgame_positions(max_pieces);
+
+    size_t bytes = (size_t)((h.positions + 3) / 4);
+    uint8_t *packed = calloc(bytes, 1);
+    if (packed == NULL)
+        return -1;
+    for (uint64_t i = 0; i < h.positions; ++i)
+        packed[i / 4] |= (uint8_t)((values[i] & 3) << ((i % 4) * 2));
+
+    FILE *f = fopen(path, "wb");
+    int ok = (f != NULL && fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(packed, 1, bytes, f) == bytes);
+    if (f != NULL && fclose(f) != 0)
+        ok = 0;
+    free(packed);
+    return ok ? 0 : -1;
+}
+
+int endgame_open(const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    EndgameHeader h;
+    if (fstat(fd, &st) < 0 || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        memcmp(h.magic, magic, sizeof(h.magic)) != 0 || h.max_pieces < 2 ||
+        h.max_pieces > ENDGAME_MAX_PIECES || h.positions != endgame_positions((int)h.max_pieces) ||
+        (uint64_t)st.st_size != sizeof(h) + (h.positions + 3) / 4)
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    table = (const uint8_t *)map + sizeof(h);
+    table_pieces = (int)h.max_pieces;
+    return 0;
+}
+
+int endgame_max_pieces(void)
+{
+    return table_pieces;
+}
+
+EndgameValue endgame_probe(const Game *g)
+{
+    if (table == NULL)
+        return ENDGAME_UNKNOWN;
+
+    int64_t idx = endgame_index(g, table_pieces);
+    if (idx < 0)
+        return ENDGAME_UNKNOWN;
+    return (EndgameValue)((table[idx / 4] >> ((idx % 4) * 2)) & 3);
+}
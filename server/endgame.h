@@ -0,0 +1,54 @@
+#ifndef ENDGAME_H
+#define ENDGAME_H
+
+#include <stdint.h>
+
+#include "checkers.h"
+
+#define ENDGAME_MAX_PIECES 6 // the most pieces an index can cover
+
+// What a position is worth to the side to move with perfect play by both.
+typedef enum
+{
+    ENDGAME_UNKNOWN, // not in the table
+    ENDGAME_WIN,
+    ENDGAME_LOSS,
+    ENDGAME_DRAW
+} EndgameValue;
+
+// Every position with 2 to max_pieces pieces, at least one of each
+// colour, has an index below endgame_positions(max_pieces). Positions are
+// grouped by how many men and kings each side has, fewer pieces first
+// and, among as many pieces, fewer men first, so a slice only ever moves
+// into itself or slices ahead of it.
+uint64_t endgame_positions(int max_pieces);
+
+// -1 if the position has too many pieces, lacks a colour or is halfway
+// through a capture chain.
+int64_t endgame_index(const Game *g, int max_pieces);
+
+// The inverse. Returns -1 for an index that names no position: men of
+// both colours are ranked independently, so some indices put two on one
+// square.
+int endgame_position(uint64_t index, int max_pieces, Game *g);
+
+// Where each slice starts, in file order, ending with the total. Returns
+// how many slices there are; starts needs room for that many plus one.
+int endgame_slices(int max_pieces, uint64_t *starts, int room);
+
+// Writes values, one byte per index, packed four to a byte.
+int endgame_write(const char *path, int max_pieces, const uint8_t *values);
+
+// Maps the table read-only for endgame_probe. Call before starting any
+// thread that probes. Returns -1 with errno set if the file is missing or
+// not a table.
+int endgame_open(const char *path);
+
+// The number of pieces the open table goes up to, 0 if none is open.
+int endgame_max_pieces(void);
+
+// Reads straight from the mapping: no locks and no copies, safe from any
+// thread.
+EndgameValue endgame_probe(const Game *g);
+
+#endif
@@ -0,0 +1,716 @@
+#include "engine.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_PLY 96
+#define MAX_MOVES 64 // hops from one position; 12 kings have at most 48
+#define WIN_SCORE 30000
+#define INF_SCORE 32000
+#define MATE_BOUND (WIN_SCORE - 1000)
+
+#define MAN_VALUE 100
+#define KING_VALUE 150
+
+#define TT_EXACT 0
+#define TT_LOWER 1
+#define TT_UPPER 2
+
+typedef struct
+{
+    uint64_t key;
+    int16_t score;
+    int8_t depth;
+    uint8_t flag;
+    uint8_t from; // best move as square indices
+    uint8_t to;
+} TTEntry;
+
+struct Engine
+{
+    TTEntry *tt;
+    uint64_t tt_mask;
+    uint32_t history[BOARD_SQUARES][BOARD_SQUARES];
+
+    long nodes;
+    int stop;
+    long long deadline_ns;
+};
+
+typedef struct
+{
+    uint8_t from;
+    uint8_t to;
+} Hop;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// Legal hops: the first hop of every whole move. *captures is set when
+// the side to move is forced to capture (all hops are captures then).
+// Chains that branch later share a first hop, which is kept once; the
+// search goes on from the landing square as the same side's turn.
+static int generate_hops(const Game *g, Hop *out, int *captures)
+{
+    Move whole[MAX_MOVES];
+    int count = game_generate_moves(g, whole, MAX_MOVES);
+    if (count > MAX_MOVES)
+        count = MAX_MOVES; // far more than any position has
+
+    int n = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        if (n > 0 && out[n - 1].from == whole[i].squares[0] && out[n - 1].to == whole[i].squares[1])
+            continue;
+        out[n].from = whole[i].squares[0];
+        out[n].to = whole[i].squares[1];
+        n++;
+    }
+
+    *captures = (count > 0 && whole[0].captured != 0);
+    return n;
+}
+
+static int play_hop(Game *g, Hop h)
+{
+    int fr, fc, tr, tc;
+    game_square_coords(h.from, &fr, &fc);
+    game_square_coords(h.to, &tr, &tc);
+    return game_apply_move(g, fr, fc, tr, tc);
+}
+
+// Material plus small bonuses for advanced men and kept back rows, from
+// the point of view of the side to move.
+static int evaluate(const Game *g)
+{
+    uint32_t wm = g->white & ~g->kings;
+    uint32_t bm = g->black & ~g->kings;
+    int score = 0;
+
+    score += MAN_VALUE * (__builtin_popcount(wm) - __builtin_popcount(bm));
+    score += KING_VALUE * (__builtin_popcount(g->white & g->kings) - __builtin_popcount(g->black & g->kings));
+
+    // Rows are 4 bits each; white men advance towards row 0.
+    for (int row = 0; row < BOARD_SIZE; ++row)
+    {
+        uint32_t mask = 0xFu << (row * 4);
+        score += 3 * (BOARD_SIZE - 1 - row) * __builtin_popcount(wm & mask);
+        score -= 3 * row * __builtin_popcount(bm & mask);
+    }
+
+    score += 8 * __builtin_popcount(wm & 0xF0000000u);
+    score -= 8 * __builtin_popcount(bm & 0x0000000Fu);
+
+    return (g->turn == COLOR_WHITE) ? score : -score;
+}
+
+// Score of a finished game for the given side; quicker wins score higher.
+static int result_score(const Game *g, PlayerColor side, int ply)
+{
+    if (g->result == GAME_DRAW)
+        return 0;
+
+    PlayerColor winner = (g->result == GAME_WHITE_WIN) ? COLOR_WHITE : COLOR_BLACK;
+    return (winner == side) ? WIN_SCORE - ply : -(WIN_SCORE - ply);
+}
+
+static int tt_score_in(int score, int ply)
+{
+    if (score > MATE_BOUND)
+        return score + ply;
+    if (score < -MATE_BOUND)
+        return score - ply;
+    return score;
+}
+
+static int tt_score_out(int score, int ply)
+{
+    if (score > MATE_BOUND)
+        return score - ply;
+    if (score < -MATE_BOUND)
+        return score + ply;
+    return score;
+}
+
+// Puts the most promising remaining hop at index i.
+static void pick_next(uint32_t (*history)[BOARD_SQUARES], Hop *moves, int n, int i, int tt_from, int tt_to)
+{
+    int best = i;
+    long best_score = -1;
+
+    for (int j = i; j < n; ++j)
+    {
+        long s = history[moves[j].from][moves[j].to];
+        if (moves[j].from == tt_from && moves[j].to == tt_to)
+            s = 1l << 40;
+        if (s > best_score)
+        {
+            best_score = s;
+            best = j;
+        }
+    }
+
+    Hop tmp = moves[i];
+    moves[i] = moves[best];
+    moves[best] = tmp;
+}
+
+static int search(Engine *e, const Game *g, int depth, int alpha, int beta, int ply, Hop *best_out)
+{
+    if ((++e->nodes & 1023) == 0 && now_ns() > e->deadline_ns)
+        e->stop = 1;
+    if (e->stop)
+        return 0;
+
+    if (ply >= MAX_PLY)
+        return evaluate(g);
+
+    Hop moves[MAX_MOVES];
+    int captures;
+    int n = generate_hops(g, moves, &captures);
+    if (n == 0)
+        return -(WIN_SCORE - ply);
+
+    // Quiescence: past the horizon only forced captures are followed.
+    if (depth <= 0 && !captures)
+        return evaluate(g);
+
+    uint64_t key = g->hash;
+    TTEntry *slot = &e->tt[key & e->tt_mask];
+    int tt_from = -1;
+    int tt_to = -1;
+
+    if (slot->key == key)
+    {
+        tt_from = slot->from;
+        tt_to = slot->to;
+
+        if (slot->depth >= depth && best_out == NULL)
+        {
+            int s = tt_score_out(slot->score, ply);
+            if (slot->flag == TT_EXACT ||
+                (slot->flag == TT_LOWER && s >= beta) ||
+                (slot->flag == TT_UPPER && s <= alpha))
+                return s;
+        }
+    }
+
+    int orig_alpha = alpha;
+    int best = -INF_SCORE;
+    Hop best_move = moves[0];
+
+    for (int i = 0; i < n; ++i)
+    {
+        pick_next(e->history, moves, n, i, tt_from, tt_to);
+
+        Game child = *g;
+        play_hop(&child, moves[i]);
+
+        int s;
+        if (child.result != GAME_RUNNING)
+            s = result_score(&child, g->turn, ply + 1);
+        else if (child.turn == g->turn)
+            s = search(e, &child, depth, alpha, beta, ply + 1, NULL); // same side keeps capturing
+        else
+            s = -search(e, &child, depth - 1, -beta, -alpha, ply + 1, NULL);
+
+        if (e->stop)
+            return 0;
+
+        if (s > best)
+        {
+            best = s;
+            best_move = moves[i];
+        }
+        if (s > alpha)
+            alpha = s;
+        if (alpha >= beta)
+        {
+            if (!captures)
+                e->history[moves[i].from][moves[i].to] += (uint32_t)(depth * depth);
+            break;
+        }
+    }
+
+    slot->key = key;
+    slot->score = (int16_t)tt_score_in(best, ply);
+    slot->depth = (int8_t)(depth < 0 ? 0 : depth);
+    slot->flag = (best <= orig_alpha) ? TT_UPPER : (best >= beta) ? TT_LOWER
+                                                                  : TT_EXACT;
+    slot->from = best_move.from;
+    slot->to = best_move.to;
+
+    if (best_out != NULL)
+        *best_out = best_move;
+    return best;
+}
+
+Engine *engine_new(unsigned tt_bits)
+{
+    Engine *e = calloc(1, sizeof(Engine));
+    if (e == NULL)
+        return NULL;
+
+    e->tt = calloc((size_t)1 << tt_bits, sizeof(TTEntry));
+    if (e->tt == NULL)
+    {
+        free(e);
+        return NULL;
+    }
+    e->tt_mask = ((uint64_t)1 << tt_bits) - 1;
+    return e;
+}
+
+void engine_free(Engine *e)
+{
+    if (e == NULL)
+        return;
+    free(e->tt);
+    free(e);
+}
+
+void engine_level_limits(int level, int *max_depth, int *time_ms)
+{
+    if (level < BOT_MIN_LEVEL)
+        level = BOT_MIN_LEVEL;
+    if (level > BOT_MAX_LEVEL)
+        level = BOT_MAX_LEVEL;
+
+    *max_depth = 1 + 3 * level;
+    *time_ms = 100 * level;
+}
+
+int engine_best_move(Engine *e, const Game *g, int max_depth, int time_ms,
+                     EngineMove *best, EngineStats *stats)
+{
+    Hop moves[MAX_MOVES];
+    int captures;
+    int n = generate_hops(g, moves, &captures);
+    if (n == 0)
+        return 0;
+
+    long long start = now_ns();
+    Hop choice = moves[0];
+
+    e->nodes = 0;
+    e->stop = 0;
+    e->deadline_ns = start + (long long)time_ms * 1000000ll;
+    memset(e->history, 0, sizeof(e->history));
+
+    if (stats != NULL)
+    {
+        stats->depth = 0;
+        stats->score = 0;
+    }
+
+    // A forced hop needs no search.
+    for (int depth = 1; n > 1 && depth <= max_depth; ++depth)
+    {
+        Hop h;
+        int score = search(e, g, depth, -INF_SCORE, INF_SCORE, 0, &h);
+        if (e->stop)
+            break;
+
+        choice = h;
+        if (stats != NULL)
+        {
+            stats->depth = depth;
+            stats->score = score;
+        }
+
+        // The next iteration would not finish in what is left.
+        if ((now_ns() - start) * 2 > (long long)time_ms * 1000000ll)
+            break;
+        if (score > MATE_BOUND || score < -MATE_BOUND)
+            break;
+    }
+
+    game_square_coords(choice.from, &best->from_row, &best->from_col);
+    game_square_coords(choice.to, &best->to_row, &best->to_col);
+    if (stats != NULL)
+        stats->nodes = e->nodes;
+    return 1;
+}
+
+// The parallel search behind analyzer_run: Young Brothers Wait. A node
+// searches its first move alone; once that has neither cut off nor run
+// out of depth, the younger brothers become tasks any pool thread may
+// take, all sharing one transposition table.
+
+#define SPLIT_MIN_DEPTH 3 // shallower nodes are not worth a split
+
+// Lock-free: the key is stored xored with the data, so an entry torn by
+// two threads writing it at once fails the key check instead of being
+// believed.
+typedef struct
+{
+    _Atomic uint64_t check;
+    _Atomic uint64_t data;
+} SharedEntry;
+
+// What one pool thread keeps to itself.
+typedef struct
+{
+    _Alignas(64) uint32_t history[BOARD_SQUARES][BOARD_SQUARES];
+    long nodes;
+} Helper;
+
+struct Analyzer
+{
+    TaskPool *pool;
+    SharedEntry *tt;
+    uint64_t tt_mask;
+    Helper *helpers; // one per pool thread
+    _Atomic int stop;
+    long long deadline_ns;
+};
+
+// A node whose younger brothers are being searched as tasks. It lives on
+// the stack of the thread that split, which waits for all of them.
+typedef struct Split
+{
+    struct Split *parent; // the split this node was reached under, if any
+    const Game *g;
+    int depth;
+    int ply;
+    int beta;
+
+    pthread_mutex_t lock; // over best, best_move and alpha's updates
+    _Atomic int alpha;
+    int best;
+    Hop best_move;
+    _Atomic int cutoff; // a brother failed high, the rest are wasted
+    _Atomic int pending; // brothers not finished
+} Split;
+
+typedef struct
+{
+    Task task;
+    Analyzer *a;
+    Split *split;
+    Hop hop;
+    int quiet;
+} BrotherTask;
+
+typedef struct
+{
+    Task task;
+    Analyzer *a;
+    const Game *g;
+    int depth;
+    int score;
+    Hop best;
+} RootTask;
+
+static uint64_t tt_pack(int score, int depth, int flag, Hop move)
+{
+    return (uint64_t)(uint16_t)score | (uint64_t)(uint8_t)depth << 16 | (uint64_t)flag << 24 |
+           (uint64_t)move.from << 32 | (uint64_t)move.to << 40;
+}
+
+static int shared_probe(Analyzer *a, uint64_t key, TTEntry *out)
+{
+    SharedEntry *e = &a->tt[key & a->tt_mask];
+    uint64_t data = atomic_load_explicit(&e->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&e->check, memory_order_relaxed);
+    if ((check ^ data) != key)
+        return 0;
+
+    out->key = key;
+    out->score = (int16_t)(uint16_t)data;
+    out->depth = (int8_t)(uint8_t)(data >> 16);
+    out->flag = (uint8_t)(data >> 24);
+    out->from = (uint8_t)(data >> 32);
+    out->to = (uint8_t)(data >> 40);
+    return 1;
+}
+
+static void shared_store(Analyzer *a, uint64_t key, int score, int depth, int flag, Hop move)
+{
+    SharedEntry *e = &a->tt[key & a->tt_mask];
+    uint64_t data = tt_pack(score, depth, flag, move);
+    atomic_store_explicit(&e->data, data, memory_order_relaxed);
+    atomic_store_explicit(&e->check, key ^ data, memory_order_relaxed);
+}
+
+// Whether the search under sp is wasted: time is up, or some split above
+// has already cut off.
+static int aborted(Analyzer *a, const Split *sp)
+{
+    if (atomic_load_explicit(&a->stop, memory_order_relaxed))
+        return 1;
+    for (; sp != NULL; sp = sp->parent)
+        if (atomic_load_explicit(&sp->cutoff, memory_order_relaxed))
+            return 1;
+    return 0;
+}
+
+static int psearch(Analyzer *a, int worker, const Game *g, int depth, int alpha, int beta, int ply,
+                   Split *sp, Hop *best_out);
+
+// Plays hop from g and scores it for g's side to move.
+static int search_child(Analyzer *a, int worker, const Game *g, Hop hop, int depth, int alpha, int beta,
+                        int ply, Split *sp)
+{
+    Game child = *g;
+    play_hop(&child, hop);
+
+    if (child.result != GAME_RUNNING)
+        return result_score(&child, g->turn, ply + 1);
+    if (child.turn == g->turn)
+        return psearch(a, worker, &child, depth, alpha, beta, ply + 1, sp, NULL); // same side keeps capturing
+    return -psearch(a, worker, &child, depth - 1, -beta, -alpha, ply + 1, sp, NULL);
+}
+
+static void run_brother(Task *task, int worker)
+{
+    BrotherTask *bt = (BrotherTask *)task;
+    Analyzer *a = bt->a;
+    Split *sp = bt->split;
+
+    if (!aborted(a, sp))
+    {
+        int alpha = atomic_load_explicit(&sp->alpha, memory_order_relaxed);
+        int s = search_child(a, worker, sp->g, bt->hop, sp->depth, alpha, sp->beta, sp->ply, sp);
+
+        if (!aborted(a, sp))
+        {
+            pthread_mutex_lock(&sp->lock);
+            if (s > sp->best)
+            {
+                sp->best = s;
+                sp->best_move = bt->hop;
+            }
+            if (s > atomic_load_explicit(&sp->alpha, memory_order_relaxed))
+                atomic_store_explicit(&sp->alpha, s, memory_order_relaxed);
+            if (s >= sp->beta)
+            {
+                atomic_store_explicit(&sp->cutoff, 1, memory_order_relaxed);
+                if (bt->quiet)
+                    a->helpers[worker].history[bt->hop.from][bt->hop.to] += (uint32_t)(sp->depth * sp->depth);
+            }
+            pthread_mutex_unlock(&sp->lock);
+        }
+    }
+
+    // The splitting thread may return as soon as this lands.
+    atomic_fetch_sub_explicit(&sp->pending, 1, memory_order_release);
+}
+
+static int psearch(Analyzer *a, int worker, const Game *g, int depth, int alpha, int beta, int ply,
+                   Split *sp, Hop *best_out)
+{
+    Helper *h = &a->helpers[worker];
+    if ((++h->nodes & 1023) == 0 && now_ns() > a->deadline_ns)
+        atomic_store_explicit(&a->stop, 1, memory_order_relaxed);
+    if (aborted(a, sp))
+        return 0;
+
+    if (ply >= MAX_PLY)
+        return evaluate(g);
+
+    Hop moves[MAX_MOVES];
+    int captures;
+    int n = generate_hops(g, moves, &captures);
+    if (n == 0)
+        return -(WIN_SCORE - ply);
+
+    if (depth <= 0 && !captures)
+        return evaluate(g);
+
+    uint64_t key = g->hash;
+    TTEntry entry;
+    int tt_from = -1;
+    int tt_to = -1;
+
+    if (shared_probe(a, key, &entry))
+    {
+        tt_from = entry.from;
+        tt_to = entry.to;
+
+        if (entry.depth >= depth && best_out == NULL)
+        {
+            int s = tt_score_out(entry.score, ply);
+            if (entry.flag == TT_EXACT ||
+                (entry.flag == TT_LOWER && s >= beta) ||
+                (entry.flag == TT_UPPER && s <= alpha))
+                return s;
+        }
+    }
+
+    int orig_alpha = alpha;
+    int best = -INF_SCORE;
+    Hop best_move = moves[0];
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (i == 1 && depth >= SPLIT_MIN_DEPTH)
+        {
+            // Order the brothers now, they all start at once.
+            for (int j = 1; j < n; ++j)
+                pick_next(h->history, moves, n, j, tt_from, tt_to);
+
+            Split split = {.parent = sp, .g = g, .depth = depth, .ply = ply, .beta = beta,
+                           .best = best, .best_move = best_move};
+            pthread_mutex_init(&split.lock, NULL);
+            atomic_init(&split.alpha, alpha);
+            atomic_init(&split.cutoff, 0);
+            atomic_init(&split.pending, n - 1);
+
+            // Pushed worst first, so this thread pops the best ones and
+            // thieves take the least promising.
+            BrotherTask tasks[MAX_MOVES];
+            for (int j = n - 1; j >= 1; --j)
+            {
+                tasks[j] = (BrotherTask){.task.run = run_brother, .a = a, .split = &split,
+                                         .hop = moves[j], .quiet = !captures};
+                taskpool_spawn(a->pool, worker, &tasks[j].task);
+            }
+            taskpool_wait(a->pool, worker, &split.pending);
+            pthread_mutex_destroy(&split.lock);
+
+            if (aborted(a, sp))
+                return 0;
+            best = split.best;
+            best_move = split.best_move;
+            break;
+        }
+
+        pick_next(h->history, moves, n, i, tt_from, tt_to);
+        int s = search_child(a, worker, g, moves[i], depth, alpha, beta, ply, sp);
+        if (aborted(a, sp))
+            return 0;
+
+        if (s > best)
+        {
+            best = s;
+            best_move = moves[i];
+        }
+        if (s > alpha)
+            alpha = s;
+        if (alpha >= beta)
+        {
+            if (!captures)
+                h->history[moves[i].from][moves[i].to] += (uint32_t)(depth * depth);
+            break;
+        }
+    }
+
+    int flag = (best <= orig_alpha) ? TT_UPPER : (best >= beta) ? TT_LOWER
+                                                                : TT_EXACT;
+    shared_store(a, key, tt_score_in(best, ply), depth < 0 ? 0 : depth, flag, best_move);
+
+    if (best_out != NULL)
+        *best_out = best_move;
+    return best;
+}
+
+static void run_root(Task *task, int worker)
+{
+    RootTask *rt = (RootTask *)task;
+    rt->score = psearch(rt->a, worker, rt->g, rt->depth, -INF_SCORE, INF_SCORE, 0, NULL, &rt->best);
+}
+
+Analyzer *analyzer_new(int threads, unsigned tt_bits)
+{
+    Analyzer *a = calloc(1, sizeof(Analyzer));
+    if (a == NULL)
+        return NULL;
+
+    a->tt = calloc((size_t)1 << tt_bits, sizeof(SharedEntry));
+    a->helpers = aligned_alloc(64, sizeof(Helper) * (size_t)threads);
+    a->pool = (a->tt != NULL && a->helpers != NULL) ? taskpool_new(threads) : NULL;
+    if (a->pool == NULL)
+    {
+        free(a->tt);
+        free(a->helpers);
+        free(a);
+        return NULL;
+    }
+    a->tt_mask = ((uint64_t)1 << tt_bits) - 1;
+    return a;
+}
+
+int analyzer_threads(const Analyzer *a)
+{
+    return taskpool_threads(a->pool);
+}
+
+int analyzer_run(Analyzer *a, const Game *g, int max_depth, int time_ms, Move *best, EngineStats *stats)
+{
+    Hop moves[MAX_MOVES];
+    int captures;
+    int n = generate_hops(g, moves, &captures);
+
+    stats->nodes = 0;
+    stats->depth = 0;
+    stats->score = 0;
+    if (g->result != GAME_RUNNING)
+    {
+        stats->score = result_score(g, g->turn, 0);
+        return 0;
+    }
+    if (n == 0)
+    {
+        stats->score = -WIN_SCORE;
+        return 0;
+    }
+
+    long long start = now_ns();
+    Hop choice = moves[0];
+    int threads = taskpool_threads(a->pool);
+
+    memset(a->helpers, 0, sizeof(Helper) * (size_t)threads);
+    atomic_store(&a->stop, 0);
+    a->deadline_ns = start + (long long)time_ms * 1000000ll;
+
+    for (int depth = 1; depth <= max_depth; ++depth)
+    {
+        RootTask rt = {.task.run = run_root, .a = a, .g = g, .depth = depth};
+        taskpool_run(a->pool, &rt.task);
+        if (atomic_load(&a->stop))
+            break;
+
+        choice = rt.best;
+        stats->depth = depth;
+        stats->score = rt.score;
+        if (rt.score > MATE_BOUND || rt.score < -MATE_BOUND)
+            break;
+    }
+
+    for (int i = 0; i < threads; ++i)
+        stats->nodes += a->helpers[i].nodes;
+
+    // The rest of a capture chain, from the table where it has an entry.
+    Game pos = *g;
+    best->squares[0] = choice.from;
+    best->squares[1] = choice.to;
+    best->hops = 1;
+    best->captured = 0;
+    PlayerColor side = g->turn;
+    while (1)
+    {
+        uint32_t before = (side == COLOR_WHITE) ? pos.black : pos.white;
+        play_hop(&pos, choice);
+        best->captured |= before & ~((side == COLOR_WHITE) ? pos.black : pos.white);
+        if (pos.result != GAME_RUNNING || pos.turn != side || best->hops == MOVE_MAX_HOPS)
+            break;
+
+        n = generate_hops(&pos, moves, &captures);
+        choice = moves[0];
+        TTEntry entry;
+        if (shared_probe(a, pos.hash, &entry))
+            for (int i = 0; i < n; ++i)
+                if (moves[i].from == entry.from && moves[i].to == entry.to)
+                    choice = moves[i];
+        best->squares[++best->hops] = choice.to;
+    }
+    return 1;
+}
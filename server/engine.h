@@ -0,0 +1,58 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include <stdint.h>
+
+#include "checkers.h"
+#include "taskpool.h"
+
+#define BOT_MIN_LEVEL 1
+#define BOT_MAX_LEVEL 10
+
+// Search state of one thread: transposition table and move ordering
+// history. Engines are not shared, every worker owns one.
+typedef struct Engine Engine;
+
+typedef struct
+{
+    int from_row;
+    int from_col;
+    int to_row;
+    int to_col;
+} EngineMove;
+
+typedef struct
+{
+    long nodes;
+    int depth; // last iteration that finished
+    int score; // for the side to move, in hundredths of a man
+} EngineStats;
+
+Engine *engine_new(unsigned tt_bits); // table of 2^tt_bits entries
+void engine_free(Engine *e);
+
+// Depth and time budget of a bot level.
+void engine_level_limits(int level, int *max_depth, int *time_ms);
+
+// Iterative deepening alpha-beta for the side to move, stopped after
+// max_depth plies or time_ms milliseconds, whichever comes first. One hop
+// of a capture chain is one move. Returns 0 when there is no legal move.
+int engine_best_move(Engine *e, const Game *g, int max_depth, int time_ms,
+                     EngineMove *best, EngineStats *stats);
+
+// A search that every thread of a TaskPool of its own takes part in,
+// sharing one lock-free transposition table of 2^tt_bits entries, for
+// analysing positions on request. Returns NULL when out of memory or
+// threads.
+typedef struct Analyzer Analyzer;
+
+Analyzer *analyzer_new(int threads, unsigned tt_bits);
+int analyzer_threads(const Analyzer *a);
+
+// Like engine_best_move, but best is the whole move, a capture chain to
+// its end, and stats->nodes counts every thread's nodes. Calls must not
+// overlap. Returns 0 when the game is already over or there is no legal
+// move; stats->score is then the result.
+int analyzer_run(Analyzer *a, const Game *g, int max_depth, int time_ms, Move *best, EngineStats *stats);
+
+#endif
@@ -0,0 +1,325 @@
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC 0x324A4B43u // "CKJ2", records with turn clocks
+#define JOURNAL_BUF_MAX (8u << 20) // appends wait once this much is unwritten
+#define REPLAY_CHUNK 1024 // records read at a time
+
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void)
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k)
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t record_crc(const JournalRecord *r)
+{
+    const unsigned char *p = (const unsigned char *)r + sizeof(r->crc);
+    uint32_t c = 0xFFFFFFFFu;
+
+    pthread_once(&crc_once, crc_init);
+    for (size_t i = 0; i < sizeof(*r) - sizeof(r->crc); ++i)
+        c = crc_table[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int write_all(int fd, const void *data, size_t len)
+{
+    const char *p = data;
+    while (len > 0)
+    {
+        ssize_t n = write(fd, p, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Makes a rename in the directory of path survive a crash.
+static void sync_dir(const char *path)
+{
+    char *copy = strdup(path);
+    if (copy == NULL)
+        return;
+
+    int fd = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+    free(copy);
+}
+
+long journal_replay(const char *path, ReplayFn fn, void *arg, JournalDamage *damage)
+{
+    memset(damage, 0, sizeof(*damage));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return (errno == ENOENT) ? 0 : -1;
+
+    uint32_t magic;
+    if (read(fd, &magic, sizeof(magic)) != sizeof(magic) || magic != JOURNAL_MAGIC)
+    {
+        close(fd);
+        return -1;
+    }
+
+    JournalRecord chunk[REPLAY_CHUNK];
+    long count = 0;
+    size_t have = 0; // bytes in chunk
+
+    while (1)
+    {
+        ssize_t n = read(fd, (char *)chunk + have, sizeof(chunk) - have);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        have += (size_t)n;
+
+        // Past the first damaged record the rest is only checked.
+        size_t whole = have / sizeof(JournalRecord);
+        for (size_t i = 0; i < whole; ++i)
+        {
+            if (record_crc(&chunk[i]) != chunk[i].crc)
+                damage->damaged++;
+            else if (damage->damaged > 0)
+                damage->skipped++;
+            else
+            {
+                fn(&chunk[i], arg);
+                count++;
+            }
+        }
+
+        // A partial record at the end of a read is finished by the next one.
+        have -= whole * sizeof(JournalRecord);
+        memmove(chunk, (char *)chunk + whole * sizeof(JournalRecord), have);
+    }
+
+    damage->torn_bytes = have;
+    close(fd);
+    return count;
+}
+
+int journal_open(Journal *j, const char *path)
+{
+    size_t len = strlen(path) + 5;
+    char *fresh = malloc(len);
+    j->path = strdup(path);
+    if (fresh == NULL || j->path == NULL)
+    {
+        free(fresh);
+        free(j->path);
+        return -1;
+    }
+    snprintf(fresh, len, "%s.new", path);
+
+    j->fd = open(fresh, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    free(fresh);
+    if (j->fd < 0)
+        return -1;
+
+    uint32_t magic = JOURNAL_MAGIC;
+    if (write_all(j->fd, &magic, sizeof(magic)) < 0)
+        return -1;
+
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->work, NULL);
+    pthread_cond_init(&j->synced_cond, NULL);
+    j->buf = NULL;
+    j->len = 0;
+    j->cap = 0;
+    j->spare = NULL;
+    j->spare_cap = 0;
+    j->appended = 0;
+    j->synced = 0;
+    j->restored = 0;
+    j->running = 0;
+    j->error = 0;
+    j->batches = 0;
+    j->longest_batch = 0;
+    j->sync_ms_total = 0;
+    return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+    Journal *j = arg;
+
+    pthread_mutex_lock(&j->lock);
+    while (1)
+    {
+        while (j->len == 0)
+            pthread_cond_wait(&j->work, &j->lock);
+
+        // Appends carry on into the other buffer while this one is written.
+        char *batch = j->buf;
+        size_t len = j->len;
+        size_t cap = j->cap;
+        uint64_t upto = j->appended;
+        j->buf = j->spare;
+        j->cap = j->spare_cap;
+        j->len = 0;
+        pthread_mutex_unlock(&j->lock);
+
+        double t0 = now_ms();
+        int failed = (write_all(j->fd, batch, len) < 0 || fdatasync(j->fd) < 0);
+        int error = errno;
+        double ms = now_ms() - t0;
+
+        pthread_mutex_lock(&j->lock);
+        j->spare = batch;
+        j->spare_cap = cap;
+        if (failed)
+        {
+            // After a failed sync the kernel may have dropped the pages,
+            // so a retry could report success for data it lost. Nothing
+            // past synced is ever promised again.
+            perror("journal");
+            j->error = error;
+            j->len = 0;
+            pthread_cond_broadcast(&j->synced_cond);
+            break;
+        }
+        j->synced = upto;
+        j->batches++;
+        if (len / sizeof(JournalRecord) > j->longest_batch)
+            j->longest_batch = len / sizeof(JournalRecord);
+        j->sync_ms_total += ms;
+        pthread_cond_broadcast(&j->synced_cond);
+    }
+
+    pthread_mutex_unlock(&j->lock);
+    return NULL;
+}
+
+int journal_start(Journal *j)
+{
+    // The restored state goes to disk before it replaces the old log.
+    if (write_all(j->fd, j->buf, j->len) < 0 || fsync(j->fd) < 0)
+        return -1;
+    j->len = 0;
+    j->synced = j->appended;
+    j->restored = j->appended;
+
+    size_t len = strlen(j->path) + 5;
+    char *fresh = malloc(len);
+    if (fresh == NULL)
+        return -1;
+    snprintf(fresh, len, "%s.new", j->path);
+    int rc = rename(fresh, j->path);
+    free(fresh);
+    if (rc < 0)
+        return -1;
+    sync_dir(j->path);
+
+    j->running = 1;
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, writer_thread, j) != 0)
+        return -1;
+    pthread_detach(thread_id);
+    return 0;
+}
+
+uint64_t journal_append(Journal *j, const JournalRecord *r)
+{
+    JournalRecord rec = *r;
+    rec.crc = record_crc(&rec);
+
+    pthread_mutex_lock(&j->lock);
+
+    while (j->running && j->error == 0 && j->len >= JOURNAL_BUF_MAX)
+        pthread_cond_wait(&j->synced_cond, &j->lock);
+    if (j->error != 0)
+    {
+        pthread_mutex_unlock(&j->lock);
+        return 0;
+    }
+
+    if (j->len + sizeof(rec) > j->cap)
+    {
+        size_t cap = j->cap ? j->cap * 2 : 64 * sizeof(rec);
+        char *nb = realloc(j->buf, cap);
+        if (nb == NULL)
+        {
+            pthread_mutex_unlock(&j->lock);
+            perror("journal");
+            return 0;
+        }
+        j->buf = nb;
+        j->cap = cap;
+    }
+
+    memcpy(j->buf + j->len, &rec, sizeof(rec));
+    j->len += sizeof(rec);
+    uint64_t lsn = ++j->appended;
+
+    // The writer only sleeps on an empty buffer.
+    if (j->len == sizeof(rec))
+        pthread_cond_signal(&j->work);
+
+    pthread_mutex_unlock(&j->lock);
+    return lsn;
+}
+
+int journal_wait(Journal *j, uint64_t lsn)
+{
+    pthread_mutex_lock(&j->lock);
+    while (j->synced < lsn && j->error == 0)
+        pthread_cond_wait(&j->synced_cond, &j->lock);
+    int error = (j->synced < lsn) ? j->error : 0;
+    pthread_mutex_unlock(&j->lock);
+
+    if (error != 0)
+    {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
+
+void journal_report(Journal *j, FILE *out)
+{
+    pthread_mutex_lock(&j->lock);
+    unsigned long long appended = j->appended;
+    unsigned long long synced = j->synced - j->restored;
+    unsigned long batches = j->batches;
+    unsigned long longest = j->longest_batch;
+    double sync_ms = j->sync_ms_total;
+    int error = j->error;
+    pthread_mutex_unlock(&j->lock);
+
+    fprintf(out, "journal: records=%llu synced=%llu syncs=%lu records_per_sync=%.1f longest_batch=%lu avg_sync=%.2fms%s%s\n",
+            appended, synced, batches, batches ? (double)synced / (double)batches : 0.0, longest,
+            batches ? sync_ms / (double)batches : 0.0, error ? " failed: " : "", error ? strerror(error) : "");
+}
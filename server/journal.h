@@ -0,0 +1,100 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum
+{
+    JOURNAL_CREATE = 1, // a game started; carries the bot level and session secrets
+    JOURNAL_MOVE, // the position after a move
+    JOURNAL_FINISH // the game is over, nothing of it needs restoring
+} JournalType;
+
+// One fixed-size record, written as is. The checksum covers everything
+// after it, so a record torn by a crash is recognised on replay.
+typedef struct
+{
+    uint32_t crc;
+    uint8_t type;
+    uint8_t turn; // PlayerColor to move
+    int8_t cap_square; // piece that must go on capturing, or -1
+    uint8_t level; // bot level, 0 for two players
+    uint32_t game_id;
+    uint32_t seq;
+    uint32_t white;
+    uint32_t black;
+    uint32_t kings;
+    uint32_t quiet_plies; // Game.quiet_plies, for the move limit
+    uint64_t secrets[2]; // JOURNAL_CREATE, indexed by PlayerColor
+    int64_t clock_ms[2]; // time each side had left, -1 when games are untimed
+} JournalRecord;
+
+_Static_assert(sizeof(JournalRecord) == 64, "journal records are 64 bytes on disk");
+
+// Append-only log with group commit. Appending only copies the record into
+// a buffer; one writer thread writes out everything appended while the
+// previous fdatasync was running and syncs it with a single call, so the
+// cost of a sync is shared by every record in the batch.
+typedef struct
+{
+    int fd;
+    char *path; // where the log lives once journal_start renamed it there
+
+    pthread_mutex_t lock;
+    pthread_cond_t work; // the writer has something to write
+    pthread_cond_t synced_cond; // synced went up
+    char *buf; // records not handed to the writer yet
+    size_t len;
+    size_t cap;
+    char *spare; // the writer's buffer between batches
+    size_t spare_cap;
+    uint64_t appended; // records appended so far
+    uint64_t synced; // records known to be on disk
+    uint64_t restored; // records written by journal_start itself
+    int running; // the writer thread is up
+    int error; // errno of the write or sync that failed, after which nothing more is written
+
+    // Stats, under lock.
+    unsigned long batches;
+    unsigned long longest_batch;
+    double sync_ms_total;
+} Journal;
+
+typedef void (*ReplayFn)(const JournalRecord *r, void *arg);
+
+// What journal_replay found past the last record it replayed. A crash
+// only ever damages the end of the log, so intact records after a
+// damaged one mean the log itself is corrupt.
+typedef struct
+{
+    long damaged; // records failing their checksum, from the first one on
+    long skipped; // intact records after the first damaged one
+    size_t torn_bytes; // an incomplete record at the very end
+} JournalDamage;
+
+// Calls fn for every intact record of the log at path, oldest first, and
+// stops at the first damaged one; what lies beyond it is counted in
+// *damage. Returns the number of records replayed, 0 when there is no
+// log and -1 when it cannot be read.
+long journal_replay(const char *path, ReplayFn fn, void *arg, JournalDamage *damage);
+
+// Starts a new log next to path. Records appended before journal_start
+// (the state restored from the old log) only replace the old log once
+// they are on disk. Returns -1 on error.
+int journal_open(Journal *j, const char *path);
+int journal_start(Journal *j);
+
+// Thread-safe and never waits for the disk, unless the writer has fallen
+// a long way behind. Returns the record's sequence number, or 0 when it
+// cannot be recorded: out of memory, or the journal has failed.
+uint64_t journal_append(Journal *j, const JournalRecord *r);
+
+// Blocks until record lsn is on disk. Returns -1, with errno set, if the
+// journal failed before it got there.
+int journal_wait(Journal *j, uint64_t lsn);
+
+void journal_report(Journal *j, FILE *out);
+
+#endif
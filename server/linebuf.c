@@ -0,0 +1,88 @@
+#include "linebuf.h"
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define LINEBUF_MASK (LINEBUF_SIZE - 1)
+
+void linebuf_init(LineBuf *lb)
+{
+    lb->head = 0;
+    lb->tail = 0;
+    lb->scan = 0;
+}
+
+ssize_t linebuf_fill(LineBuf *lb, int fd)
+{
+    unsigned int used = lb->tail - lb->head;
+    unsigned int space = LINEBUF_SIZE - used;
+    unsigned int start = lb->tail & LINEBUF_MASK;
+    unsigned int first = LINEBUF_SIZE - start;
+
+    if (first > space)
+        first = space;
+
+    struct iovec iov[2];
+    iov[0].iov_base = lb->data + start;
+    iov[0].iov_len = first;
+    iov[1].iov_base = lb->data;
+    iov[1].iov_len = space - first;
+
+    struct msghdr msg = {0};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = (space > first) ? 2 : 1;
+
+    ssize_t n = recvmsg(fd, &msg, 0);
+    if (n > 0)
+        lb->tail += (unsigned int)n;
+    return n;
+}
+
+int linebuf_next_line(LineBuf *lb, char *out, size_t size)
+{
+    unsigned int end = lb->scan;
+
+    while (end != lb->tail && lb->data[end & LINEBUF_MASK] != '\n')
+        ++end;
+
+    unsigned int len = end - lb->head;
+    int found = (end != lb->tail);
+
+    if (!found && len < LINE_MAX_LEN)
+    {
+        lb->scan = end;
+        return -1;
+    }
+    if (len > LINE_MAX_LEN)
+        len = LINE_MAX_LEN;
+    if (len > size - 1)
+        len = (unsigned int)(size - 1);
+
+    for (unsigned int i = 0; i < len; ++i)
+        out[i] = lb->data[(lb->head + i) & LINEBUF_MASK];
+    out[len] = '\0';
+
+    lb->head += len;
+    if (found && lb->head == end)
+        lb->head++; // skip the newline
+    lb->scan = lb->head;
+
+    return (int)len;
+}
+
+size_t linebuf_peek(const LineBuf *lb, unsigned char *out, size_t size)
+{
+    size_t used = lb->tail - lb->head;
+    if (size > used)
+        size = used;
+
+    for (size_t i = 0; i < size; ++i)
+        out[i] = (unsigned char)lb->data[(lb->head + i) & LINEBUF_MASK];
+    return size;
+}
+
+void linebuf_consume(LineBuf *lb, size_t n)
+{
+    lb->head += (unsigned int)n;
+    lb->scan = lb->head;
+}
@@ -0,0 +1,35 @@
+#ifndef LINEBUF_H
+#define LINEBUF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define LINEBUF_SIZE 512 // must be a power of two
+#define LINE_MAX_LEN 255 // longer lines are cut, the rest becomes the next line
+
+// Per-connection ring buffer. Bytes are read from the socket in bulk and
+// complete lines are pulled out one by one, partial lines stay buffered
+// until the rest arrives.
+typedef struct
+{
+    char data[LINEBUF_SIZE];
+    unsigned int head; // next byte to hand out
+    unsigned int tail; // next byte to fill
+    unsigned int scan; // bytes before this position hold no newline
+} LineBuf;
+
+void linebuf_init(LineBuf *lb);
+
+// One recv() into all free space. Returns what recv returned.
+ssize_t linebuf_fill(LineBuf *lb, int fd);
+
+// Copies the next complete line (without the newline) into out and
+// returns its length, or -1 when no complete line is buffered.
+int linebuf_next_line(LineBuf *lb, char *out, size_t size);
+
+// Raw access for binary framing: copies up to size buffered bytes without
+// consuming them, returns how many were copied.
+size_t linebuf_peek(const LineBuf *lb, unsigned char *out, size_t size);
+void linebuf_consume(LineBuf *lb, size_t n);
+
+#endif
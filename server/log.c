@@ -0,0 +1,630 @@
+#include "log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RING_BYTES (64 * 1024) // per thread, a power of two
+#define RECORD_MAX 512 // one line's header, arguments and strings
+#define STRING_MAX 200 // bytes kept of each %s argument
+#define LINE_OUT_MAX 1024 // a formatted line
+#define DRAIN_INTERVAL_MS 10
+#define MAX_RINGS 256 // threads the writer drains
+#define WRAP 0xFFFFFFFFu // Record.size: the rest of the ring is unused
+#define LAYOUT_CACHE 64 // formats remembered per thread, a power of two
+#define LAYOUT_MAX 16 // arguments carried per line
+
+// A line as the caller left it: its format and raw arguments, one 8-byte
+// word per number and a length word plus the bytes for each string. The
+// writer does the formatting.
+typedef struct
+{
+    uint32_t size; // header included, a multiple of 8
+    uint32_t level;
+    long long ns; // CLOCK_REALTIME_COARSE
+    const char *fmt;
+} Record;
+
+// The C type an argument was passed as.
+enum
+{
+    TYPE_INT,
+    TYPE_LONG,
+    TYPE_LLONG,
+    TYPE_SIZE,
+    TYPE_INTMAX,
+    TYPE_PTRDIFF,
+    TYPE_DOUBLE,
+    TYPE_POINTER,
+    TYPE_STRING
+};
+
+typedef struct
+{
+    const char *fmt;
+    int count;
+    unsigned char types[LAYOUT_MAX];
+} Layout;
+
+// Single producer (its thread), single consumer (the writer). head and
+// tail are byte offsets that only grow; records never straddle the end
+// of buf.
+typedef struct Ring
+{
+    _Atomic uint64_t head;
+    char pad0[64 - sizeof(uint64_t)];
+    _Atomic uint64_t tail;
+    char pad1[64 - sizeof(uint64_t)];
+
+    // The producer's rate limit: the earliest time, in ns, at which the
+    // thread's output would be back within its rate.
+    long long due_ns;
+    _Atomic unsigned long dropped_rate;
+    _Atomic unsigned long dropped_full;
+    unsigned long reported_rate; // writer only
+    unsigned long reported_full;
+
+    Layout layouts[LAYOUT_CACHE]; // producer only
+    struct Ring *next;
+    _Alignas(8) unsigned char buf[RING_BYTES];
+} Ring;
+
+// One printf conversion, as both sides walk the format.
+typedef enum
+{
+    ARG_SIGNED,
+    ARG_UNSIGNED,
+    ARG_DOUBLE,
+    ARG_POINTER,
+    ARG_STRING,
+    ARG_NONE // "%%"
+} ArgKind;
+
+typedef struct
+{
+    const char *start; // the '%'
+    const char *end; // just past the conversion character
+    int stars; // '*' width and precision, taken as int arguments first
+    char mod; // 'H' for hh, 'h', 'l', 'L' for ll, 'z', 'j', 't', or 0
+    ArgKind kind;
+} Spec;
+
+int log_threshold = LOG_WARN;
+
+static const char *const level_names[] = {"ERROR", "WARN", "INFO", "DEBUG"};
+
+static _Atomic(Ring *) rings = NULL;
+static __thread Ring *my_ring = NULL;
+static long long line_interval_ns = 0; // 0: no limit
+static long long burst_ns = 0;
+
+// The coarse clock reads in a few ns where the precise one takes tens;
+// it ticks every few milliseconds, which lines are stamped to anyway.
+static long long realtime_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (long long)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// Finds the next conversion from p on. Returns 0 at the end of the
+// format or at a conversion this logger does not carry.
+static int next_spec(const char *p, Spec *s)
+{
+    p = strchr(p, '%');
+    if (p == NULL)
+        return 0;
+
+    s->start = p++;
+    s->stars = 0;
+    s->mod = 0;
+
+    while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+        p++;
+    if (*p == '*')
+    {
+        s->stars++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*')
+        {
+            s->stars++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+
+    if (*p == 'h' || *p == 'l')
+    {
+        s->mod = *p++;
+        if (*p == s->mod)
+        {
+            s->mod = (s->mod == 'h') ? 'H' : 'L';
+            p++;
+        }
+    }
+    else if (*p == 'z' || *p == 'j' || *p == 't')
+        s->mod = *p++;
+
+    switch (*p)
+    {
+    case 'd':
+    case 'i':
+        s->kind = ARG_SIGNED;
+        break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'c':
+        s->kind = ARG_UNSIGNED;
+        break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        s->kind = ARG_DOUBLE;
+        break;
+    case 'p':
+        s->kind = ARG_POINTER;
+        break;
+    case 's':
+        s->kind = ARG_STRING;
+        break;
+    case '%':
+        s->kind = ARG_NONE;
+        break;
+    default:
+        return 0;
+    }
+    s->end = p + 1;
+    return 1;
+}
+
+// How the caller passed each argument, which is all encoding needs.
+static unsigned char arg_type(const Spec *s)
+{
+    switch (s->kind)
+    {
+    case ARG_DOUBLE:
+        return TYPE_DOUBLE;
+    case ARG_POINTER:
+        return TYPE_POINTER;
+    case ARG_STRING:
+        return TYPE_STRING;
+    default:
+        break;
+    }
+    switch (s->mod)
+    {
+    case 'l':
+        return TYPE_LONG;
+    case 'L':
+        return TYPE_LLONG;
+    case 'z':
+        return TYPE_SIZE;
+    case 'j':
+        return TYPE_INTMAX;
+    case 't':
+        return TYPE_PTRDIFF;
+    default:
+        return TYPE_INT;
+    }
+}
+
+// The argument types fmt takes, parsed on the thread's first use of fmt
+// and kept; formats are string literals, so their address names them.
+static const Layout *layout_of(Ring *r, const char *fmt)
+{
+    Layout *l = &r->layouts[((uintptr_t)fmt >> 3) & (LAYOUT_CACHE - 1)];
+    if (l->fmt == fmt)
+        return l;
+
+    l->count = 0;
+    Spec s;
+    for (const char *p = fmt; next_spec(p, &s); p = s.end)
+    {
+        if (l->count + s.stars + 1 > LAYOUT_MAX)
+            break;
+        for (int i = 0; i < s.stars; ++i)
+            l->types[l->count++] = TYPE_INT;
+        if (s.kind != ARG_NONE)
+            l->types[l->count++] = arg_type(&s);
+    }
+    l->fmt = fmt;
+    return l;
+}
+
+// Copies the arguments into out, one word each, a string as its length
+// and its bytes. Returns the bytes used, which is where the encoding
+// stopped if out ran short.
+static size_t encode_args(unsigned char *out, size_t room, const Layout *l, va_list ap)
+{
+    size_t len = 0;
+
+    for (int i = 0; i < l->count; ++i)
+    {
+        uint64_t word;
+        switch (l->types[i])
+        {
+        case TYPE_INT:
+            word = (uint64_t)(long long)va_arg(ap, int);
+            break;
+        case TYPE_LONG:
+            word = (uint64_t)va_arg(ap, long);
+            break;
+        case TYPE_LLONG:
+            word = (uint64_t)va_arg(ap, long long);
+            break;
+        case TYPE_SIZE:
+            word = va_arg(ap, size_t);
+            break;
+        case TYPE_INTMAX:
+            word = (uint64_t)va_arg(ap, intmax_t);
+            break;
+        case TYPE_PTRDIFF:
+            word = (uint64_t)va_arg(ap, ptrdiff_t);
+            break;
+        case TYPE_DOUBLE:
+        {
+            double d = va_arg(ap, double);
+            memcpy(&word, &d, 8);
+            break;
+        }
+        case TYPE_POINTER:
+            word = (uint64_t)(uintptr_t)va_arg(ap, void *);
+            break;
+        default:
+        {
+            const char *str = va_arg(ap, const char *);
+            if (str == NULL)
+                str = "(null)";
+            size_t n = strnlen(str, STRING_MAX);
+            size_t padded = (n + 7) & ~(size_t)7;
+            if (len + 8 + padded > room)
+                return len;
+            word = n;
+            memcpy(out + len, &word, 8);
+            memcpy(out + len + 8, str, n);
+            len += 8 + padded;
+            continue;
+        }
+        }
+
+        if (len + 8 > room)
+            return len;
+        memcpy(out + len, &word, 8);
+        len += 8;
+    }
+
+    return len;
+}
+
+static Ring *ring(void)
+{
+    if (my_ring != NULL)
+        return my_ring;
+
+    Ring *r = calloc(1, sizeof(Ring));
+    if (r == NULL)
+        return NULL;
+
+    r->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &r->next, r))
+        ;
+    my_ring = r;
+    return r;
+}
+
+void log_write(LogLevel level, const char *fmt, ...)
+{
+    Ring *r = ring();
+    if (r == NULL)
+        return;
+
+    long long now = realtime_ns();
+
+    // Every line moves due_ns one interval on; a thread that gets more
+    // than a burst ahead of the clock loses lines until it falls back.
+    if (line_interval_ns > 0)
+    {
+        long long due = (r->due_ns > now) ? r->due_ns : now;
+        if (due - now > burst_ns)
+        {
+            atomic_fetch_add_explicit(&r->dropped_rate, 1, memory_order_relaxed);
+            return;
+        }
+        r->due_ns = due + line_interval_ns;
+    }
+
+    _Alignas(8) unsigned char args[RECORD_MAX - sizeof(Record)];
+    va_list ap;
+    va_start(ap, fmt);
+    size_t args_len = encode_args(args, sizeof(args), layout_of(r, fmt), ap);
+    va_end(ap);
+
+    // A record that would run past the end of buf starts over at its
+    // beginning, and the bytes skipped count as used.
+    uint32_t size = (uint32_t)(sizeof(Record) + args_len);
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    size_t at = head & (RING_BYTES - 1);
+    size_t skip = (at + size > RING_BYTES) ? RING_BYTES - at : 0;
+    if (head + skip + size - tail > RING_BYTES)
+    {
+        atomic_fetch_add_explicit(&r->dropped_full, 1, memory_order_relaxed);
+        return;
+    }
+    if (skip > 0)
+    {
+        uint32_t wrap = WRAP;
+        memcpy(r->buf + at, &wrap, sizeof(wrap));
+        at = 0;
+    }
+
+    Record rec = {.size = size, .level = level, .ns = now, .fmt = fmt};
+    memcpy(r->buf + at, &rec, sizeof(rec));
+    memcpy(r->buf + at + sizeof(rec), args, args_len);
+
+    atomic_store_explicit(&r->head, head + skip + size, memory_order_release);
+}
+
+static uint64_t take_word(const unsigned char **args, const unsigned char *end)
+{
+    uint64_t word = 0;
+    if (*args + 8 <= end)
+    {
+        memcpy(&word, *args, 8);
+        *args += 8;
+    }
+    return word;
+}
+
+// Formats one number or pointer the way its conversion asks for.
+static int format_value(char *out, size_t room, const Spec *s, const char *spec, int a0, int a1, uint64_t word)
+{
+#define FORMAT(value)                                                   \
+    ((s->stars == 0)   ? snprintf(out, room, spec, value)               \
+     : (s->stars == 1) ? snprintf(out, room, spec, a0, value)           \
+                       : snprintf(out, room, spec, a0, a1, value))
+
+    switch (s->kind)
+    {
+    case ARG_SIGNED:
+        if (s->mod == 'l')
+            return FORMAT((long)word);
+        if (s->mod == 'L')
+            return FORMAT((long long)word);
+        if (s->mod == 'z')
+            return FORMAT((size_t)word);
+        if (s->mod == 'j')
+            return FORMAT((intmax_t)word);
+        if (s->mod == 't')
+            return FORMAT((ptrdiff_t)word);
+        return FORMAT((int)word);
+    case ARG_UNSIGNED:
+        if (s->mod == 'l')
+            return FORMAT((unsigned long)word);
+        if (s->mod == 'L')
+            return FORMAT((unsigned long long)word);
+        if (s->mod == 'z')
+            return FORMAT((size_t)word);
+        if (s->mod == 'j')
+            return FORMAT((uintmax_t)word);
+        if (s->mod == 't')
+            return FORMAT((ptrdiff_t)word);
+        return FORMAT((unsigned int)word);
+    case ARG_DOUBLE:
+    {
+        double d;
+        memcpy(&d, &word, 8);
+        return FORMAT(d);
+    }
+    case ARG_POINTER:
+        return FORMAT((void *)(uintptr_t)word);
+    default:
+        return 0;
+    }
+#undef FORMAT
+}
+
+// Redoes what the caller's printf would have done, from the record.
+static size_t format_record(const Record *rec, char *out, size_t room)
+{
+    const unsigned char *args = (const unsigned char *)(rec + 1);
+    const unsigned char *end = (const unsigned char *)rec + rec->size;
+    const char *p = rec->fmt;
+    size_t len = 0;
+    Spec s;
+
+    while (len + 1 < room)
+    {
+        int more = next_spec(p, &s);
+        size_t literal = more ? (size_t)(s.start - p) : strlen(p);
+        if (literal > room - 1 - len)
+            literal = room - 1 - len;
+        memcpy(out + len, p, literal);
+        len += literal;
+        if (!more)
+            break;
+
+        char spec[32];
+        size_t spec_len = (size_t)(s.end - s.start);
+        if (spec_len >= sizeof(spec))
+            break;
+        memcpy(spec, s.start, spec_len);
+        spec[spec_len] = '\0';
+
+        int a0 = (s.stars > 0) ? (int)take_word(&args, end) : 0;
+        int a1 = (s.stars > 1) ? (int)take_word(&args, end) : 0;
+
+        int n;
+        if (s.kind == ARG_NONE)
+            n = snprintf(out + len, room - len, "%%");
+        else if (s.kind == ARG_STRING)
+        {
+            uint64_t str_len = take_word(&args, end);
+            size_t padded = (str_len + 7) & ~(uint64_t)7;
+            if (str_len > STRING_MAX || args + padded > end)
+                break;
+            char str[STRING_MAX + 1];
+            memcpy(str, args, str_len);
+            str[str_len] = '\0';
+            args += padded;
+            n = (s.stars == 0)   ? snprintf(out + len, room - len, spec, str)
+                : (s.stars == 1) ? snprintf(out + len, room - len, spec, a0, str)
+                                 : snprintf(out + len, room - len, spec, a0, a1, str);
+        }
+        else
+            n = format_value(out + len, room - len, &s, spec, a0, a1, take_word(&args, end));
+
+        if (n > 0)
+            len += ((size_t)n < room - len) ? (size_t)n : room - len - 1;
+        p = s.end;
+    }
+
+    out[len] = '\0';
+    return len;
+}
+
+static void print_line(FILE *out, long long ns, int level, const char *text)
+{
+    time_t secs = (time_t)(ns / 1000000000ll);
+    struct tm tm;
+    localtime_r(&secs, &tm);
+
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    fprintf(out, "%s.%03lld %-5s %s\n", stamp, (ns % 1000000000ll) / 1000000, level_names[level], text);
+}
+
+// The record at *at, stepping over a wrap marker; NULL once upto is reached.
+static const Record *peek(Ring *r, uint64_t *at, uint64_t upto)
+{
+    if (*at >= upto)
+        return NULL;
+
+    size_t off = *at & (RING_BYTES - 1);
+    uint32_t size;
+    memcpy(&size, r->buf + off, sizeof(size));
+    if (size == WRAP)
+    {
+        *at += RING_BYTES - off;
+        if (*at >= upto)
+            return NULL;
+        off = 0;
+    }
+    return (const Record *)(r->buf + off);
+}
+
+// Writes what every ring holds right now, merged by time.
+static void drain(FILE *out)
+{
+    Ring *list[MAX_RINGS];
+    uint64_t upto[MAX_RINGS];
+    uint64_t at[MAX_RINGS];
+    const Record *next[MAX_RINGS];
+    int count = 0;
+    char text[LINE_OUT_MAX];
+
+    for (Ring *r = atomic_load(&rings); r != NULL && count < MAX_RINGS; r = r->next)
+    {
+        list[count] = r;
+        at[count] = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        upto[count] = atomic_load_explicit(&r->head, memory_order_acquire);
+        next[count] = peek(r, &at[count], upto[count]);
+        count++;
+    }
+
+    while (1)
+    {
+        int best = -1;
+        for (int i = 0; i < count; ++i)
+            if (next[i] != NULL && (best < 0 || next[i]->ns < next[best]->ns))
+                best = i;
+        if (best < 0)
+            break;
+
+        const Record *rec = next[best];
+        format_record(rec, text, sizeof(text));
+        print_line(out, rec->ns, (int)rec->level, text);
+
+        at[best] += rec->size;
+        atomic_store_explicit(&list[best]->tail, at[best], memory_order_release);
+        next[best] = peek(list[best], &at[best], upto[best]);
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        Ring *r = list[i];
+        // Wrap markers at the end of what was drained are passed too.
+        atomic_store_explicit(&r->tail, at[i], memory_order_release);
+
+        unsigned long rate = atomic_load_explicit(&r->dropped_rate, memory_order_relaxed);
+        unsigned long full = atomic_load_explicit(&r->dropped_full, memory_order_relaxed);
+        if (rate != r->reported_rate || full != r->reported_full)
+        {
+            snprintf(text, sizeof(text), "log: a thread dropped %lu lines over its rate, %lu with its ring full",
+                     rate - r->reported_rate, full - r->reported_full);
+            print_line(out, realtime_ns(), LOG_WARN, text);
+            r->reported_rate = rate;
+            r->reported_full = full;
+        }
+    }
+
+    fflush(out);
+}
+
+static void *writer_thread(void *arg)
+{
+    FILE *out = arg;
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = DRAIN_INTERVAL_MS * 1000000l};
+
+    // Polling keeps wakeups off the loggers' side entirely.
+    while (1)
+    {
+        drain(out);
+        nanosleep(&pause, NULL);
+    }
+
+    return NULL;
+}
+
+unsigned long log_dropped(void)
+{
+    unsigned long total = 0;
+    for (Ring *r = atomic_load(&rings); r != NULL; r = r->next)
+        total += atomic_load_explicit(&r->dropped_rate, memory_order_relaxed) +
+                 atomic_load_explicit(&r->dropped_full, memory_order_relaxed);
+    return total;
+}
+
+int log_start(FILE *out, int per_second)
+{
+    if (per_second > 0)
+    {
+        line_interval_ns = 1000000000ll / per_second;
+        burst_ns = 1000000000ll;
+    }
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, writer_thread, out) != 0)
+        return -1;
+    pthread_detach(thread_id);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+
+typedef enum
+{
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO, // connections and games
+    LOG_DEBUG // every command
+} LogLevel;
+
+// Messages above this level are dropped before their arguments are even
+// formatted. Set once at startup.
+extern int log_threshold;
+
+#define log_at(level, ...)                     \
+    do                                         \
+    {                                          \
+        if ((int)(level) <= log_threshold)     \
+            log_write((level), __VA_ARGS__);   \
+    } while (0)
+
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_WARN, __VA_ARGS__)
+#define log_info(...) log_at(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+
+// Copies fmt's address and the raw arguments into the calling thread's
+// own ring and returns: no formatting, no lock, no system call. The
+// writer thread formats the line later, so fmt must be a string literal;
+// %s arguments are copied, up to 200 bytes. A line is dropped, and
+// counted, when the ring is full or the thread logs faster than its
+// rate allows.
+void log_write(LogLevel level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Starts the thread that drains every ring to out, in time order. Each
+// thread may log per_second lines a second, in bursts of up to as many.
+int log_start(FILE *out, int per_second);
+
+// Lines dropped so far, by every thread, for either reason.
+unsigned long log_dropped(void);
+
+#endif
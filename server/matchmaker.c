@@ -0,0 +1,387 @@
+#include "matchmaker.h"
+
+#include <pthread.h>
+#include <poll.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define MM_TICK_MS 100 // wake-up for widening while nobody joins
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+// Intrusive MPSC queue (Vyukov): producers only exchange the head and
+// then link the previous node to theirs, so a push never waits.
+static void queue_push(Matchmaker *mm, MatchNode *node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    MatchNode *prev = atomic_exchange_explicit(&mm->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+// Returns NULL when the queue is empty or a producer is between its two
+// steps; the node shows up on a later call.
+static MatchNode *queue_pop(Matchmaker *mm)
+{
+    MatchNode *tail = mm->tail;
+    MatchNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &mm->stub)
+    {
+        if (next == NULL)
+            return NULL;
+        mm->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+
+    if (next != NULL)
+    {
+        mm->tail = next;
+        return tail;
+    }
+
+    if (tail != atomic_load_explicit(&mm->head, memory_order_acquire))
+        return NULL;
+
+    queue_push(mm, &mm->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL)
+    {
+        mm->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+static int queue_empty(Matchmaker *mm)
+{
+    return mm->tail == &mm->stub &&
+           atomic_load_explicit(&mm->stub.next, memory_order_acquire) == NULL &&
+           atomic_load_explicit(&mm->head, memory_order_acquire) == &mm->stub;
+}
+
+void mm_requeue(Matchmaker *mm, MatchNode *node)
+{
+    atomic_store(&node->state, MM_QUEUED);
+    queue_push(mm, node);
+
+    // Only a pairing thread that announced it is going to sleep costs a
+    // syscall to wake.
+    if (atomic_exchange(&mm->sleeping, 0))
+        eventfd_write(mm->wake_fd, 1);
+}
+
+void mm_join(Matchmaker *mm, MatchNode *node, int bucket)
+{
+    if (bucket < 0)
+        bucket = 0;
+    if (bucket >= MM_BUCKETS)
+        bucket = MM_BUCKETS - 1;
+
+    node->bucket = bucket;
+    node->joined_ns = now_ns();
+    atomic_fetch_add_explicit(&mm->stats[bucket].joins, 1, memory_order_relaxed);
+    mm_requeue(mm, node);
+}
+
+int mm_cancel(Matchmaker *mm, MatchNode *node)
+{
+    int expected = MM_QUEUED;
+    while (!atomic_compare_exchange_strong(&node->state, &expected, MM_CANCELLED))
+    {
+        if (expected != MM_CLAIMING)
+            return expected != MM_MATCHED;
+
+        // The pairing thread is between the two halves of a claim_pair.
+        sched_yield();
+        expected = MM_QUEUED;
+    }
+    atomic_fetch_add_explicit(&mm->stats[node->bucket].cancels, 1, memory_order_relaxed);
+    return 1;
+}
+
+static void wait_append(Matchmaker *mm, MatchNode *node)
+{
+    int b = node->bucket;
+    node->wait_next = NULL;
+    if (mm->wait_tail[b] != NULL)
+        mm->wait_tail[b]->wait_next = node;
+    else
+        mm->wait_head[b] = node;
+    mm->wait_tail[b] = node;
+    atomic_fetch_add_explicit(&mm->stats[b].waiting, 1, memory_order_relaxed);
+}
+
+// Takes the oldest node of a bucket that is still queued, dropping the
+// cancelled ones in front of it.
+static MatchNode *wait_take(Matchmaker *mm, int b)
+{
+    while (mm->wait_head[b] != NULL)
+    {
+        MatchNode *node = mm->wait_head[b];
+        mm->wait_head[b] = node->wait_next;
+        if (mm->wait_head[b] == NULL)
+            mm->wait_tail[b] = NULL;
+        atomic_fetch_sub_explicit(&mm->stats[b].waiting, 1, memory_order_relaxed);
+
+        if (atomic_load(&node->state) == MM_QUEUED)
+            return node;
+        mm->on_drop(node, mm->arg);
+    }
+    return NULL;
+}
+
+static void wait_push_front(Matchmaker *mm, MatchNode *node)
+{
+    int b = node->bucket;
+    node->wait_next = mm->wait_head[b];
+    mm->wait_head[b] = node;
+    if (mm->wait_tail[b] == NULL)
+        mm->wait_tail[b] = node;
+    atomic_fetch_add_explicit(&mm->stats[b].waiting, 1, memory_order_relaxed);
+}
+
+static void record_pair(Matchmaker *mm, MatchPair *p, long long now)
+{
+    MatchStats *st = &mm->stats[p->a->bucket];
+    unsigned long long waits[2] = {(unsigned long long)(now - p->a->joined_ns),
+                                   (unsigned long long)(now - p->b->joined_ns)};
+
+    atomic_fetch_add_explicit(&st->pairs, 1, memory_order_relaxed);
+    if (p->a->bucket != p->b->bucket)
+        atomic_fetch_add_explicit(&st->widened, 1, memory_order_relaxed);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        atomic_fetch_add_explicit(&st->wait_ns_total, waits[i], memory_order_relaxed);
+        if (waits[i] > atomic_load_explicit(&st->wait_ns_max, memory_order_relaxed))
+            atomic_store_explicit(&st->wait_ns_max, waits[i], memory_order_relaxed);
+    }
+}
+
+// Claims both nodes. A node cancelled in the meantime is dropped, and
+// its partner goes back to the front of its bucket. a is only
+// MM_CLAIMING until b is settled, so mm_cancel never sees it matched and
+// then queued again.
+static int claim_pair(Matchmaker *mm, MatchNode *a, MatchNode *b)
+{
+    int expected = MM_QUEUED;
+    if (!atomic_compare_exchange_strong(&a->state, &expected, MM_CLAIMING))
+    {
+        mm->on_drop(a, mm->arg);
+        wait_push_front(mm, b);
+        return 0;
+    }
+
+    expected = MM_QUEUED;
+    if (!atomic_compare_exchange_strong(&b->state, &expected, MM_MATCHED))
+    {
+        atomic_store(&a->state, MM_QUEUED);
+        mm->on_drop(b, mm->arg);
+        wait_push_front(mm, a);
+        return 0;
+    }
+    atomic_store(&a->state, MM_MATCHED);
+    return 1;
+}
+
+static void hand_over(Matchmaker *mm, MatchPair *pairs, int count)
+{
+    if (count == 0)
+        return;
+
+    mm->on_match(pairs, count, mm->arg);
+
+    // Nodes the MatchFn did not requeue are done with matchmaking.
+    for (int i = 0; i < count; ++i)
+    {
+        int expected = MM_MATCHED;
+        atomic_compare_exchange_strong(&pairs[i].a->state, &expected, MM_IDLE);
+        expected = MM_MATCHED;
+        atomic_compare_exchange_strong(&pairs[i].b->state, &expected, MM_IDLE);
+    }
+}
+
+static void pair_waiting(Matchmaker *mm)
+{
+    MatchPair pairs[MM_BATCH_MAX];
+    int count = 0;
+    long long now = now_ns();
+
+    // Within a bucket, first come first served.
+    for (int b = 0; b < MM_BUCKETS; ++b)
+    {
+        while (1)
+        {
+            MatchNode *first = wait_take(mm, b);
+            if (first == NULL)
+                break;
+            MatchNode *second = wait_take(mm, b);
+            if (second == NULL)
+            {
+                wait_push_front(mm, first);
+                break;
+            }
+            if (!claim_pair(mm, first, second))
+                continue;
+
+            pairs[count].a = first;
+            pairs[count].b = second;
+            record_pair(mm, &pairs[count], now);
+            if (++count == MM_BATCH_MAX)
+            {
+                hand_over(mm, pairs, count);
+                count = 0;
+            }
+        }
+    }
+
+    // Every bucket now holds at most one player. Those that waited long
+    // enough are paired with the nearest bucket's.
+    MatchNode *left = NULL;
+    for (int b = 0; b < MM_BUCKETS; ++b)
+    {
+        MatchNode *node = mm->wait_head[b];
+        if (node == NULL || now - node->joined_ns < mm->widen_ns)
+            continue;
+        if (left == NULL)
+        {
+            left = node;
+            continue;
+        }
+
+        MatchNode *a = wait_take(mm, left->bucket);
+        MatchNode *c = wait_take(mm, b);
+        left = NULL;
+        if (a == NULL || c == NULL)
+        {
+            if (a != NULL)
+                wait_push_front(mm, a);
+            if (c != NULL)
+                wait_push_front(mm, c);
+            continue;
+        }
+        if (!claim_pair(mm, a, c))
+            continue;
+
+        pairs[count].a = a;
+        pairs[count].b = c;
+        record_pair(mm, &pairs[count], now);
+        if (++count == MM_BATCH_MAX)
+        {
+            hand_over(mm, pairs, count);
+            count = 0;
+        }
+    }
+
+    hand_over(mm, pairs, count);
+}
+
+static int anyone_waiting(Matchmaker *mm)
+{
+    for (int b = 0; b < MM_BUCKETS; ++b)
+        if (mm->wait_head[b] != NULL)
+            return 1;
+    return 0;
+}
+
+static void *pairing_thread(void *arg)
+{
+    Matchmaker *mm = arg;
+
+    while (1)
+    {
+        MatchNode *node;
+        while ((node = queue_pop(mm)) != NULL)
+        {
+            if (atomic_load(&node->state) == MM_QUEUED)
+                wait_append(mm, node);
+            else
+                mm->on_drop(node, mm->arg);
+        }
+
+        pair_waiting(mm);
+
+        // Announce the nap before the last look at the queue, so a join
+        // either is seen here or wakes us up.
+        atomic_store(&mm->sleeping, 1);
+        if (!queue_empty(mm))
+        {
+            atomic_store(&mm->sleeping, 0);
+            continue;
+        }
+
+        struct pollfd pfd = {mm->wake_fd, POLLIN, 0};
+        poll(&pfd, 1, anyone_waiting(mm) ? MM_TICK_MS : -1);
+        atomic_store(&mm->sleeping, 0);
+        if (pfd.revents & POLLIN)
+        {
+            eventfd_t count;
+            eventfd_read(mm->wake_fd, &count);
+        }
+    }
+
+    return NULL;
+}
+
+int mm_start(Matchmaker *mm, int widen_ms, MatchFn on_match, DropFn on_drop, void *arg)
+{
+    atomic_store(&mm->stub.next, NULL);
+    atomic_store(&mm->head, &mm->stub);
+    mm->tail = &mm->stub;
+    atomic_store(&mm->sleeping, 0);
+
+    for (int b = 0; b < MM_BUCKETS; ++b)
+    {
+        mm->wait_head[b] = NULL;
+        mm->wait_tail[b] = NULL;
+    }
+    mm->widen_ns = (long long)widen_ms * 1000000ll;
+    mm->on_match = on_match;
+    mm->on_drop = on_drop;
+    mm->arg = arg;
+    mm->reported_ns = now_ns();
+
+    mm->wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (mm->wake_fd < 0)
+        return -1;
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, pairing_thread, mm) != 0)
+        return -1;
+    pthread_detach(thread_id);
+    return 0;
+}
+
+void mm_report(Matchmaker *mm, FILE *out)
+{
+    long long now = now_ns();
+    double secs = (double)(now - mm->reported_ns) / 1e9;
+    mm->reported_ns = now;
+
+    for (int b = 0; b < MM_BUCKETS; ++b)
+    {
+        MatchStats *st = &mm->stats[b];
+        unsigned long joins = atomic_load(&st->joins);
+        if (joins == 0)
+            continue;
+
+        unsigned long pairs = atomic_load(&st->pairs);
+        unsigned long long total = atomic_load(&st->wait_ns_total);
+        double avg_ms = pairs ? (double)total / (double)(2 * pairs) / 1e6 : 0.0;
+
+        fprintf(out, "matchmaking bucket %d: waiting=%ld joins=%lu cancels=%lu pairs=%lu (%lu across buckets) "
+                     "pairs_per_sec=%.1f avg_wait=%.2fms max_wait=%.2fms\n",
+                b, atomic_load(&st->waiting), joins, atomic_load(&st->cancels), pairs,
+                atomic_load(&st->widened), secs > 0 ? (double)(pairs - st->reported_pairs) / secs : 0.0,
+                avg_ms, (double)atomic_load(&st->wait_ns_max) / 1e6);
+        st->reported_pairs = pairs;
+    }
+}
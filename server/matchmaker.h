@@ -0,0 +1,95 @@
+#ifndef MATCHMAKER_H
+#define MATCHMAKER_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+#define MM_BUCKETS 4
+#define MM_BATCH_MAX 16 // pairs handed to the MatchFn at a time
+
+typedef enum
+{
+    MM_IDLE,
+    MM_QUEUED,
+    MM_CLAIMING, // first of a pair, held while the pairing thread tries the second
+    MM_MATCHED, // claimed by the pairing thread, MatchFn not done yet
+    MM_CANCELLED
+} MatchState;
+
+// Embedded in whatever is being matched. A node is in the queue at most
+// once; the owner keeps it alive until MatchFn or DropFn gets it back.
+typedef struct MatchNode
+{
+    struct MatchNode *_Atomic next; // join queue
+    struct MatchNode *wait_next; // bucket wait list, pairing thread only
+    atomic_int state;
+    int bucket;
+    long long joined_ns;
+} MatchNode;
+
+typedef struct
+{
+    MatchNode *a; // joined first
+    MatchNode *b;
+} MatchPair;
+
+// Both run on the pairing thread. MatchFn gets pairs whose nodes are
+// MM_MATCHED; it may mm_requeue a node it could not use. DropFn gets
+// nodes that were cancelled while queued.
+typedef void (*MatchFn)(MatchPair *pairs, int count, void *arg);
+typedef void (*DropFn)(MatchNode *node, void *arg);
+
+typedef struct
+{
+    atomic_ulong joins;
+    atomic_ulong cancels;
+    atomic_ulong pairs;
+    atomic_ulong widened; // pairs made across buckets
+    atomic_ullong wait_ns_total; // summed over both players of every pair
+    atomic_ullong wait_ns_max;
+    atomic_long waiting;
+    unsigned long reported_pairs; // reporter only
+} MatchStats;
+
+// Joins go through a lock-free multi-producer queue; one pairing thread
+// drains it into per-bucket FIFO lists and pairs everything it has in
+// one go, so a burst of joins is matched in batches. A player waits for
+// its own bucket first and is paired with a neighbouring one after
+// widen_ms.
+typedef struct
+{
+    MatchNode *_Atomic head; // newest node, producers swap in here
+    MatchNode *tail; // oldest node, pairing thread only
+    MatchNode stub;
+    int wake_fd;
+    atomic_int sleeping; // the pairing thread is about to block
+
+    MatchNode *wait_head[MM_BUCKETS];
+    MatchNode *wait_tail[MM_BUCKETS];
+    long long widen_ns;
+
+    MatchFn on_match;
+    DropFn on_drop;
+    void *arg;
+
+    MatchStats stats[MM_BUCKETS];
+    long long reported_ns;
+} Matchmaker;
+
+// Returns -1 if the pairing thread could not be started.
+int mm_start(Matchmaker *mm, int widen_ms, MatchFn on_match, DropFn on_drop, void *arg);
+
+// Lock-free, any thread.
+void mm_join(Matchmaker *mm, MatchNode *node, int bucket);
+void mm_requeue(Matchmaker *mm, MatchNode *node); // keeps its place in time
+
+// Returns 1 when the node will not be matched (any more), 0 when the
+// pairing thread has already claimed it. A claim still in progress is
+// waited out, so the answer holds.
+int mm_cancel(Matchmaker *mm, MatchNode *node);
+
+// One line per bucket with waiting players, pairs per second since the
+// previous report and wait times. Call from one thread only.
+void mm_report(Matchmaker *mm, FILE *out);
+
+#endif
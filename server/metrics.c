@@ -0,0 +1,357 @@
+#include "metrics.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define SUB_BITS 4
+#define SUB_COUNT (1 << SUB_BITS)
+#define BUCKETS ((64 - SUB_BITS + 1) * SUB_COUNT)
+#define REQUEST_MAX 4096
+
+typedef struct
+{
+    _Atomic uint64_t buckets[BUCKETS];
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} Hist;
+
+// Written by its own thread only: each update is a relaxed load and
+// store, which readers may see a moment late but never torn.
+typedef struct Shard
+{
+    _Atomic uint64_t counters[COUNTER_COUNT];
+    Hist hists[HIST_COUNT];
+    struct Shard *next;
+} Shard;
+
+static const struct
+{
+    const char *name;
+    const char *help;
+} counter_info[COUNTER_COUNT] = {
+    [COUNTER_ACCEPTS] = {"checkers_accepts_total", "Connections accepted."},
+    [COUNTER_RECV_CALLS] = {"checkers_recv_calls_total", "recv system calls."},
+    [COUNTER_SEND_CALLS] = {"checkers_send_calls_total", "send and sendmsg system calls."},
+    [COUNTER_BYTES_IN] = {"checkers_received_bytes_total", "Bytes read from clients."},
+    [COUNTER_BYTES_OUT] = {"checkers_sent_bytes_total", "Bytes written to clients."},
+    [COUNTER_COMMANDS] = {"checkers_commands_total", "Commands handled."},
+    [COUNTER_MOVES] = {"checkers_moves_total", "Moves played, the bot's included."},
+    [COUNTER_INVALID_MOVES] = {"checkers_invalid_moves_total", "Moves refused as illegal."},
+    [COUNTER_GAMES_STARTED] = {"checkers_games_started_total", "Games started."},
+    [COUNTER_GAMES_FINISHED] = {"checkers_games_finished_total", "Games ended, by result or by a player leaving."},
+    [COUNTER_GAMES_ADJUDICATED] = {"checkers_games_adjudicated_total", "Games ended early from the endgame table."},
+    [COUNTER_GAMES_STALLED] = {"checkers_games_stalled_total", "Games drawn by repetition or the move limit."},
+    [COUNTER_GAMES_ON_TIME] = {"checkers_games_lost_on_time_total", "Games lost by running out of time."},
+    [COUNTER_IDLE_TIMEOUTS] = {"checkers_idle_timeouts_total", "Connections closed for sending nothing for too long."},
+    [COUNTER_PLAYERS_MOVED] = {"checkers_players_moved_total", "Players handed to the reactor that runs their game."},
+};
+
+static const char *const hist_ops[HIST_COUNT] = {
+    [HIST_ACCEPT] = "accept",
+    [HIST_RECV] = "recv",
+    [HIST_PARSE] = "parse",
+    [HIST_APPLY] = "apply",
+    [HIST_SEND] = "send",
+    [HIST_MOVE] = "move",
+};
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static _Atomic(Shard *) shards = NULL;
+static __thread Shard *my_shard = NULL;
+
+static Shard *shard(void)
+{
+    if (my_shard != NULL)
+        return my_shard;
+
+    Shard *s = calloc(1, sizeof(Shard));
+    if (s == NULL)
+    {
+        perror("metrics");
+        exit(EXIT_FAILURE);
+    }
+
+    s->next = atomic_load(&shards);
+    while (!atomic_compare_exchange_weak(&shards, &s->next, s))
+        ;
+    my_shard = s;
+    return s;
+}
+
+static void bump(_Atomic uint64_t *v, uint64_t n)
+{
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// Values below SUB_COUNT get a bucket each; above that, every power of
+// two is split into SUB_COUNT equal buckets.
+static int bucket_of(uint64_t v)
+{
+    if (v < SUB_COUNT)
+        return (int)v;
+
+    int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+    return ((shift + 1) << SUB_BITS) + (int)((v >> shift) & (SUB_COUNT - 1));
+}
+
+// The middle of bucket i.
+static double bucket_value(int i)
+{
+    if (i < SUB_COUNT)
+        return (double)i;
+
+    int shift = (i >> SUB_BITS) - 1;
+    uint64_t low = (uint64_t)(SUB_COUNT + (i & (SUB_COUNT - 1))) << shift;
+    return (double)low + (double)((uint64_t)1 << shift) / 2;
+}
+
+void metrics_count(Counter c, uint64_t n)
+{
+    bump(&shard()->counters[c], n);
+}
+
+void metrics_record(Histogram h, uint64_t ns)
+{
+    Hist *hist = &shard()->hists[h];
+
+    bump(&hist->buckets[bucket_of(ns)], 1);
+    bump(&hist->sum, ns);
+    if (ns > atomic_load_explicit(&hist->max, memory_order_relaxed))
+        atomic_store_explicit(&hist->max, ns, memory_order_relaxed);
+}
+
+uint64_t metrics_total(Counter c)
+{
+    uint64_t total = 0;
+    for (Shard *s = atomic_load(&shards); s != NULL; s = s->next)
+        total += atomic_load_explicit(&s->counters[c], memory_order_relaxed);
+    return total;
+}
+
+static void write_hist(FILE *out, Histogram h, uint64_t *merged)
+{
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    memset(merged, 0, BUCKETS * sizeof(*merged));
+    for (Shard *s = atomic_load(&shards); s != NULL; s = s->next)
+    {
+        const Hist *hist = &s->hists[h];
+        for (int i = 0; i < BUCKETS; ++i)
+            merged[i] += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+        sum += atomic_load_explicit(&hist->sum, memory_order_relaxed);
+    }
+    // Counted from the buckets, so the quantiles agree with the count.
+    for (int i = 0; i < BUCKETS; ++i)
+        count += merged[i];
+
+    const char *op = hist_ops[h];
+    size_t q = 0;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS && q < sizeof(quantiles) / sizeof(quantiles[0]) && count > 0; ++i)
+    {
+        seen += merged[i];
+        while (q < sizeof(quantiles) / sizeof(quantiles[0]) && (double)seen >= quantiles[q] * (double)count)
+        {
+            fprintf(out, "checkers_latency_seconds{op=\"%s\",quantile=\"%g\"} %.9f\n", op, quantiles[q],
+                    bucket_value(i) / 1e9);
+            q++;
+        }
+    }
+    fprintf(out, "checkers_latency_seconds_sum{op=\"%s\"} %.9f\n", op, (double)sum / 1e9);
+    fprintf(out, "checkers_latency_seconds_count{op=\"%s\"} %llu\n", op, (unsigned long long)count);
+}
+
+static uint64_t hist_max(Histogram h)
+{
+    uint64_t max = 0;
+    for (Shard *s = atomic_load(&shards); s != NULL; s = s->next)
+    {
+        uint64_t m = atomic_load_explicit(&s->hists[h].max, memory_order_relaxed);
+        if (m > max)
+            max = m;
+    }
+    return max;
+}
+
+void metrics_write(FILE *out)
+{
+    for (int c = 0; c < COUNTER_COUNT; ++c)
+    {
+        fprintf(out, "# HELP %s %s\n", counter_info[c].name, counter_info[c].help);
+        fprintf(out, "# TYPE %s counter\n", counter_info[c].name);
+        fprintf(out, "%s %llu\n", counter_info[c].name, (unsigned long long)metrics_total((Counter)c));
+    }
+
+    uint64_t *merged = malloc(BUCKETS * sizeof(*merged));
+    if (merged == NULL)
+        return;
+
+    fprintf(out, "# HELP checkers_latency_seconds Time taken by each step of serving a client.\n");
+    fprintf(out, "# TYPE checkers_latency_seconds summary\n");
+    for (int h = 0; h < HIST_COUNT; ++h)
+        write_hist(out, (Histogram)h, merged);
+    free(merged);
+
+    fprintf(out, "# HELP checkers_latency_max_seconds Longest time taken by each step.\n");
+    fprintf(out, "# TYPE checkers_latency_max_seconds gauge\n");
+    for (int h = 0; h < HIST_COUNT; ++h)
+        fprintf(out, "checkers_latency_max_seconds{op=\"%s\"} %.9f\n", hist_ops[h], (double)hist_max((Histogram)h) / 1e9);
+}
+
+typedef struct
+{
+    int fd;
+    MetricsExtraFn extra;
+    AdminCommandFn command;
+} Admin;
+
+// One request per connection, answered in full before the next one is
+// accepted; only a scraper is expected here. Returns 1 when the client
+// was handed to the command hook.
+static int serve_request(int client, const Admin *admin)
+{
+    char req[REQUEST_MAX + 1];
+    size_t len = 0;
+    while (len < REQUEST_MAX)
+    {
+        ssize_t n = recv(client, req + len, REQUEST_MAX - len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += (size_t)n;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+            break;
+        // A command is a single line.
+        if (strncmp(req, "GET ", len < 4 ? len : 4) != 0 && strchr(req, '\n') != NULL)
+            break;
+    }
+    req[len] = '\0';
+
+    if (strncmp(req, "GET ", 4) != 0 && admin->command != NULL)
+    {
+        req[strcspn(req, "\r\n")] = '\0';
+        admin->command(client, req);
+        return 1;
+    }
+
+    char *body = NULL;
+    size_t body_len = 0;
+    FILE *out = open_memstream(&body, &body_len);
+    if (out == NULL)
+        return 0;
+
+    const char *status = "200 OK";
+    if (strncmp(req, "GET /metrics", 12) == 0 || strncmp(req, "GET / ", 6) == 0)
+    {
+        metrics_write(out);
+        if (admin->extra != NULL)
+            admin->extra(out);
+    }
+    else
+    {
+        status = "404 Not Found";
+        fprintf(out, "metrics are at /metrics\n");
+    }
+    fclose(out);
+
+    char head[256];
+    int head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                            status, body_len);
+    if (send(client, head, (size_t)head_len, MSG_NOSIGNAL) == head_len)
+    {
+        size_t off = 0;
+        while (off < body_len)
+        {
+            ssize_t n = send(client, body + off, body_len - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            off += (size_t)n;
+        }
+    }
+    free(body);
+    return 0;
+}
+
+static void *admin_thread(void *arg)
+{
+    Admin *admin = arg;
+
+    while (1)
+    {
+        int client = accept(admin->fd, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno != EINTR)
+                perror("admin accept");
+            continue;
+        }
+
+        // A scraper that stops talking must not hold up the next one.
+        struct timeval tv = {.tv_sec = 2, .tv_usec = 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        if (!serve_request(client, admin))
+            close(client);
+    }
+
+    return NULL;
+}
+
+int metrics_serve(int port, MetricsExtraFn extra, AdminCommandFn command)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    Admin *admin = malloc(sizeof(Admin));
+    if (admin == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+    admin->fd = fd;
+    admin->extra = extra;
+    admin->command = command;
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, admin_thread, admin) != 0)
+    {
+        free(admin);
+        close(fd);
+        return -1;
+    }
+    pthread_detach(thread_id);
+    return 0;
+}
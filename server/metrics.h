@@ -0,0 +1,63 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef enum
+{
+    COUNTER_ACCEPTS,
+    COUNTER_RECV_CALLS,
+    COUNTER_SEND_CALLS,
+    COUNTER_BYTES_IN,
+    COUNTER_BYTES_OUT,
+    COUNTER_COMMANDS,
+    COUNTER_MOVES, // legal moves by players and the bot
+    COUNTER_INVALID_MOVES,
+    COUNTER_GAMES_STARTED,
+    COUNTER_GAMES_FINISHED,
+    COUNTER_GAMES_ADJUDICATED, // decided early from the endgame table
+    COUNTER_GAMES_STALLED, // drawn by repetition or the move limit
+    COUNTER_GAMES_ON_TIME, // lost by running out of time
+    COUNTER_IDLE_TIMEOUTS,
+    COUNTER_PLAYERS_MOVED, // handed to the reactor of their game
+    COUNTER_COUNT
+} Counter;
+
+// Latencies, in nanoseconds.
+typedef enum
+{
+    HIST_ACCEPT, // accept() and setting the connection up
+    HIST_RECV, // one recv call
+    HIST_PARSE, // one line or frame into a Command
+    HIST_APPLY, // game_apply_move for every hop of a MOVE
+    HIST_SEND, // one send or sendmsg call
+    HIST_MOVE, // a MOVE from parsing to the replies being written
+    HIST_COUNT
+} Histogram;
+
+// Every thread counts into its own shard, so recording never contends
+// and costs a few plain stores; a reader sums the shards. Shards are
+// made on a thread's first use and kept for the life of the process.
+void metrics_count(Counter c, uint64_t n);
+
+// Histograms keep 16 sub-buckets per power of two, so any quantile read
+// back is within about 6% of the true value.
+void metrics_record(Histogram h, uint64_t ns);
+
+uint64_t metrics_total(Counter c);
+
+// Every counter and histogram in the Prometheus text format, the
+// histograms as summaries with a few quantiles.
+void metrics_write(FILE *out);
+
+// Serves metrics_write, followed by whatever extra adds, over HTTP on
+// 127.0.0.1:port from a thread of its own. A connection that sends a
+// line other than a GET is handed to command with that line, and
+// command then owns the socket. Returns -1 when the port cannot be
+// opened.
+typedef void (*MetricsExtraFn)(FILE *out);
+typedef void (*AdminCommandFn)(int client, const char *line);
+int metrics_serve(int port, MetricsExtraFn extra, AdminCommandFn command);
+
+#endif
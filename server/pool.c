@@ -0,0 +1,89 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+
+typedef struct PoolNode
+{
+    struct PoolNode *next;
+} PoolNode;
+
+// Keeps the payload behind the header aligned for any type.
+#define POOL_HEADER (((sizeof(PoolNode) + _Alignof(max_align_t) - 1) / _Alignof(max_align_t)) * _Alignof(max_align_t))
+
+static PoolNode *node_of(void *item)
+{
+    return (PoolNode *)((char *)item - POOL_HEADER);
+}
+
+static void *item_of(PoolNode *node)
+{
+    return (char *)node + POOL_HEADER;
+}
+
+void pool_init(Pool *p, size_t item_size, size_t per_chunk, size_t max_items, PoolInitFn init)
+{
+    size_t align = _Alignof(max_align_t);
+
+    p->stride = POOL_HEADER + ((item_size + align - 1) / align) * align;
+    p->per_chunk = per_chunk ? per_chunk : 1;
+    p->max_items = max_items;
+    p->live = 0;
+    p->capacity = 0;
+    p->chunks = NULL;
+    p->chunk_count = 0;
+    p->free_head = NULL;
+    p->init = init;
+}
+
+static int pool_grow(Pool *p)
+{
+    size_t count = p->per_chunk;
+    if (p->capacity + count > p->max_items)
+        count = p->max_items - p->capacity;
+    if (count == 0)
+        return -1;
+
+    char **chunks = realloc(p->chunks, (p->chunk_count + 1) * sizeof(char *));
+    if (chunks == NULL)
+        return -1;
+    p->chunks = chunks;
+
+    char *chunk = calloc(count, p->stride);
+    if (chunk == NULL)
+        return -1;
+    p->chunks[p->chunk_count++] = chunk;
+
+    // Pushed in reverse so items are handed out in address order.
+    for (size_t i = count; i-- > 0;)
+    {
+        PoolNode *node = (PoolNode *)(chunk + i * p->stride);
+        if (p->init != NULL)
+            p->init(item_of(node));
+        node->next = p->free_head;
+        p->free_head = node;
+    }
+
+    p->capacity += count;
+    return 0;
+}
+
+void *pool_alloc(Pool *p)
+{
+    if (p->free_head == NULL && pool_grow(p) < 0)
+        return NULL;
+
+    PoolNode *node = p->free_head;
+    p->free_head = node->next;
+    node->next = NULL;
+    p->live++;
+    return item_of(node);
+}
+
+void pool_free(Pool *p, void *item)
+{
+    PoolNode *node = node_of(item);
+    node->next = p->free_head;
+    p->free_head = node;
+    p->live--;
+}
@@ -0,0 +1,31 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+typedef void (*PoolInitFn)(void *item);
+
+// Growable slab of fixed-size items. Items are carved from chunks that
+// are never moved or freed, so pointers to them stay valid for the life
+// of the process, even after an item goes back on the free list. Not
+// thread-safe: callers serialize access with their own lock.
+typedef struct
+{
+    size_t stride; // bytes per item including the free-list header
+    size_t per_chunk; // items carved per chunk
+    size_t max_items; // pool_alloc fails beyond this many live items
+    size_t live; // items currently handed out
+    size_t capacity; // items carved so far
+    char **chunks;
+    size_t chunk_count;
+    void *free_head;
+    PoolInitFn init; // run once per item when its chunk is carved
+} Pool;
+
+void pool_init(Pool *p, size_t item_size, size_t per_chunk, size_t max_items, PoolInitFn init);
+
+// Returns NULL once max_items are live or memory runs out.
+void *pool_alloc(Pool *p);
+void pool_free(Pool *p, void *item);
+
+#endif
@@ -0,0 +1,512 @@
+#include "protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const text_messages[MSG_COUNT] = {
+    [MSG_WAITING_FOR_OPPONENT] = "WAITING_FOR_OPPONENT\n",
+    [MSG_WELCOME_WHITE] = "WELCOME WHITE\n",
+    [MSG_WELCOME_BLACK] = "WELCOME BLACK\n",
+    [MSG_BOARD] = NULL, // carries the position, see proto_board_text
+    [MSG_YOUR_TURN] = "YOUR_TURN\n",
+    [MSG_OPP_TURN] = "OPP_TURN\n",
+    [MSG_YOUR_TURN_CONTINUE_CAPTURE] = "YOUR_TURN_CONTINUE_CAPTURE\n",
+    [MSG_OPP_TURN_CAPTURE_CHAIN] = "OPP_TURN_CAPTURE_CHAIN\n",
+    [MSG_MOVE_OK] = "MOVE_OK\n",
+    [MSG_MOVE_INVALID] = "MOVE_INVALID\n",
+    [MSG_OPPONENT_MOVED] = "OPPONENT_MOVED\n",
+    [MSG_YOU_WIN] = "YOU_WIN\n",
+    [MSG_YOU_LOSE] = "YOU_LOSE\n",
+    [MSG_DRAW] = "DRAW\n",
+    [MSG_OPPONENT_LEFT] = "OPPONENT_LEFT\n",
+    [MSG_ERROR_BAD_FORMAT] = "ERROR_BAD_FORMAT\n",
+    [MSG_ERROR_NOT_IN_GAME] = "ERROR_NOT_IN_GAME\n",
+    [MSG_ERROR_NOT_YOUR_TURN] = "ERROR_NOT_YOUR_TURN\n",
+    [MSG_ERROR_UNKNOWN_COMMAND] = "ERROR_UNKNOWN_COMMAND\n",
+    [MSG_BINARY_OK] = "BINARY_OK\n",
+    [MSG_DELTA] = NULL, // carries the changed squares, see proto_delta_text
+    [MSG_GAME_ID] = NULL, // carries the id, see proto_game_id_text
+    [MSG_WHITE_WINS] = "WHITE_WINS\n",
+    [MSG_BLACK_WINS] = "BLACK_WINS\n",
+    [MSG_PLAYER_LEFT] = "PLAYER_LEFT\n",
+    [MSG_ERROR_NO_SUCH_GAME] = "ERROR_NO_SUCH_GAME\n",
+    [MSG_ERROR_ALREADY_IN_GAME] = "ERROR_ALREADY_IN_GAME\n",
+    [MSG_SERVER_NO_MORE_GAMES] = "SERVER_NO_MORE_GAMES\n",
+    [MSG_LEGAL_MOVES] = NULL, // carries the moves, see proto_moves_text
+    [MSG_SESSION] = NULL, // carries the token, see proto_session_text
+    [MSG_ERROR_NO_SUCH_SESSION] = "ERROR_NO_SUCH_SESSION\n",
+    [MSG_OPPONENT_AWAY] = "OPPONENT_AWAY\n",
+    [MSG_OPPONENT_BACK] = "OPPONENT_BACK\n",
+    [MSG_IDLE_TIMEOUT] = "IDLE_TIMEOUT\n",
+};
+
+// Binary codes are the message number plus one, so a zero byte is never
+// a valid message.
+static const unsigned char binary_codes[MSG_COUNT] = {
+    1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+    11, 12, 13, 14, 15, 16, 17, 18, 19, 20,
+    21, 22, 23, 24, 25, 26, 27, 28, 29, 30,
+    31, 32, 33, 34};
+
+_Static_assert(MSG_COUNT == 34, "add a binary code for the new message");
+
+static void put_u32(unsigned char *out, uint32_t v)
+{
+    out[0] = (unsigned char)v;
+    out[1] = (unsigned char)(v >> 8);
+    out[2] = (unsigned char)(v >> 16);
+    out[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t get_u32(const unsigned char *in)
+{
+    return (uint32_t)in[0] | ((uint32_t)in[1] << 8) |
+           ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static void put_u64(unsigned char *out, uint64_t v)
+{
+    put_u32(out, (uint32_t)v);
+    put_u32(out + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t get_u64(const unsigned char *in)
+{
+    return (uint64_t)get_u32(in) | ((uint64_t)get_u32(in + 4) << 32);
+}
+
+// Exactly 8 + 16 hex digits and nothing after them.
+static int parse_session(const char *p, SessionToken *t)
+{
+    while (*p == ' ')
+        p++;
+
+    uint64_t v[2] = {0, 0};
+    for (int i = 0; i < 24; ++i)
+    {
+        char ch = p[i];
+        int d;
+        if (ch >= '0' && ch <= '9')
+            d = ch - '0';
+        else if (ch >= 'a' && ch <= 'f')
+            d = ch - 'a' + 10;
+        else if (ch >= 'A' && ch <= 'F')
+            d = ch - 'A' + 10;
+        else
+            return -1;
+        v[i >= 8] = (v[i >= 8] << 4) | (uint64_t)d;
+    }
+    if (p[24] != '\0')
+        return -1;
+
+    t->game_id = (uint32_t)v[0];
+    t->secret = v[1];
+    return 0;
+}
+
+// Row and column pairs up to the end of the line.
+static void parse_path(const char *p, Command *cmd)
+{
+    int values = 0;
+    cmd->type = CMD_BAD_FORMAT;
+
+    while (1)
+    {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        if (values == 2 * MOVE_PATH_MAX)
+            return;
+        cmd->path[values / 2][values % 2] = (int)v;
+        values++;
+        p = end;
+    }
+
+    while (*p == ' ')
+        p++;
+    if (*p != '\0' || values < 4 || values % 2 != 0)
+        return;
+
+    cmd->type = CMD_MOVE;
+    cmd->path_len = values / 2;
+}
+
+void proto_parse_text(const char *line, Command *cmd)
+{
+    if (strcmp(line, "QUIT") == 0)
+    {
+        cmd->type = CMD_QUIT;
+        return;
+    }
+
+    if (strcmp(line, "BINARY") == 0)
+    {
+        cmd->type = CMD_BINARY;
+        return;
+    }
+
+    if (strcmp(line, "BOARD") == 0)
+    {
+        cmd->type = CMD_BOARD;
+        return;
+    }
+
+    if (strcmp(line, "LEGAL_MOVES") == 0)
+    {
+        cmd->type = CMD_LEGAL_MOVES;
+        return;
+    }
+
+    if (strncmp(line, "PLAY_BOT", 8) == 0)
+    {
+        if (sscanf(line, "PLAY_BOT %d", &cmd->level) == 1)
+            cmd->type = CMD_PLAY_BOT;
+        else
+            cmd->type = CMD_BAD_FORMAT;
+        return;
+    }
+
+    if (strncmp(line, "WATCH", 5) == 0)
+    {
+        if (sscanf(line, "WATCH %u", &cmd->game_id) == 1)
+            cmd->type = CMD_WATCH;
+        else
+            cmd->type = CMD_BAD_FORMAT;
+        return;
+    }
+
+    if (strncmp(line, "MOVE", 4) == 0)
+    {
+        parse_path(line + 4, cmd);
+        return;
+    }
+
+    if (strncmp(line, "RESUME", 6) == 0)
+    {
+        if (parse_session(line + 6, &cmd->session) == 0)
+            cmd->type = CMD_RESUME;
+        else
+            cmd->type = CMD_BAD_FORMAT;
+        return;
+    }
+
+    cmd->type = CMD_UNKNOWN;
+}
+
+size_t proto_parse_binary(const unsigned char *data, size_t len, Command *cmd)
+{
+    if (len == 0)
+        return 0;
+
+    switch (data[0])
+    {
+    case BIN_OP_MOVE:
+        if (len < BIN_MOVE_LEN)
+            return 0;
+        if (data[1] >= BOARD_SQUARES || data[2] >= BOARD_SQUARES)
+        {
+            cmd->type = CMD_BAD_FORMAT;
+            return BIN_MOVE_LEN;
+        }
+        cmd->type = CMD_MOVE;
+        cmd->path_len = 2;
+        game_square_coords(data[1], &cmd->path[0][0], &cmd->path[0][1]);
+        game_square_coords(data[2], &cmd->path[1][0], &cmd->path[1][1]);
+        return BIN_MOVE_LEN;
+    case BIN_OP_MOVE_PATH:
+    {
+        if (len < 2)
+            return 0;
+        size_t n = data[1];
+        if (n < 2 || n > MOVE_PATH_MAX)
+        {
+            // The squares that follow would be read as frames.
+            cmd->type = CMD_PROTOCOL_ERROR;
+            return 2;
+        }
+        if (len < 2 + n)
+            return 0;
+        cmd->type = CMD_MOVE;
+        cmd->path_len = (int)n;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (data[2 + i] >= BOARD_SQUARES)
+                cmd->type = CMD_BAD_FORMAT;
+            else
+                game_square_coords(data[2 + i], &cmd->path[i][0], &cmd->path[i][1]);
+        }
+        return 2 + n;
+    }
+    case BIN_OP_QUIT:
+        cmd->type = CMD_QUIT;
+        return 1;
+    case BIN_OP_BOARD:
+        cmd->type = CMD_BOARD;
+        return 1;
+    case BIN_OP_WATCH:
+        if (len < BIN_WATCH_LEN)
+            return 0;
+        cmd->type = CMD_WATCH;
+        cmd->game_id = get_u32(data + 1);
+        return BIN_WATCH_LEN;
+    case BIN_OP_LEGAL_MOVES:
+        cmd->type = CMD_LEGAL_MOVES;
+        return 1;
+    case BIN_OP_PLAY_BOT:
+        if (len < BIN_PLAY_BOT_LEN)
+            return 0;
+        cmd->type = CMD_PLAY_BOT;
+        cmd->level = data[1];
+        return BIN_PLAY_BOT_LEN;
+    case BIN_OP_RESUME:
+        if (len < BIN_RESUME_LEN)
+            return 0;
+        cmd->type = CMD_RESUME;
+        cmd->session.game_id = get_u32(data + 1);
+        cmd->session.secret = get_u64(data + 5);
+        return BIN_RESUME_LEN;
+    default:
+        cmd->type = CMD_UNKNOWN;
+        return 1;
+    }
+}
+
+const char *proto_text(MsgType type)
+{
+    return text_messages[type];
+}
+
+const unsigned char *proto_binary(MsgType type)
+{
+    return &binary_codes[type];
+}
+
+size_t proto_board_text(const Game *g, uint32_t seq, char *out, size_t size)
+{
+    char cells[BOARD_SIZE * BOARD_SIZE + 1];
+    int idx = 0;
+    for (int r = 0; r < BOARD_SIZE; ++r)
+    {
+        for (int c = 0; c < BOARD_SIZE; ++c)
+        {
+            cells[idx++] = game_cell(g, r, c);
+        }
+    }
+    cells[idx] = '\0';
+
+    int n = snprintf(out, size, "BOARD %s %u\n", cells, seq);
+    return (n < 0) ? 0 : (size_t)n;
+}
+
+int proto_parse_board(const char *cells, PlayerColor turn, Game *g)
+{
+    uint32_t white = 0;
+    uint32_t black = 0;
+    uint32_t kings = 0;
+
+    for (int i = 0; i < BOARD_SIZE * BOARD_SIZE; ++i)
+    {
+        char cell = cells[i];
+        int sq = game_square(i / BOARD_SIZE, i % BOARD_SIZE);
+        if (cell == CELL_EMPTY)
+            continue;
+        if (sq < 0)
+            return -1; // a piece on a light square, or the string ended
+        if (cell == CELL_WHITE || cell == CELL_WHITE_KING)
+            white |= 1u << sq;
+        else if (cell == CELL_BLACK || cell == CELL_BLACK_KING)
+            black |= 1u << sq;
+        else
+            return -1;
+        if (cell == CELL_WHITE_KING || cell == CELL_BLACK_KING)
+            kings |= 1u << sq;
+    }
+    if (cells[BOARD_SIZE * BOARD_SIZE] != '\0')
+        return -1;
+
+    game_set_position(g, white, black, kings, turn, -1);
+    return 0;
+}
+
+size_t proto_board_binary(const Game *g, uint32_t seq, unsigned char *out)
+{
+    out[0] = *proto_binary(MSG_BOARD);
+    put_u32(out + 1, g->white);
+    put_u32(out + 5, g->black);
+    put_u32(out + 9, g->kings);
+    put_u32(out + 13, seq);
+    return BIN_BOARD_LEN;
+}
+
+static unsigned char cell_code(char cell)
+{
+    switch (cell)
+    {
+    case CELL_WHITE:
+        return 1;
+    case CELL_WHITE_KING:
+        return 2;
+    case CELL_BLACK:
+        return 3;
+    case CELL_BLACK_KING:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+size_t proto_delta_text(const Game *g, uint32_t squares, uint32_t seq, char *out, size_t size)
+{
+    int n = snprintf(out, size, "DELTA %u", seq);
+    if (n < 0 || (size_t)n >= size)
+        return 0;
+    size_t len = (size_t)n;
+
+    for (int sq = 0; sq < BOARD_SQUARES; ++sq)
+    {
+        if (!(squares & (1u << sq)))
+            continue;
+
+        int row, col;
+        game_square_coords(sq, &row, &col);
+        n = snprintf(out + len, size - len, " %d %d %c", row, col, game_cell(g, row, col));
+        if (n < 0 || (size_t)n >= size - len)
+            return 0;
+        len += (size_t)n;
+    }
+
+    if (len + 1 >= size)
+        return 0;
+    out[len++] = '\n';
+    out[len] = '\0';
+    return len;
+}
+
+size_t proto_delta_binary(const Game *g, uint32_t squares, uint32_t seq, unsigned char *out)
+{
+    size_t len = 6;
+
+    out[0] = *proto_binary(MSG_DELTA);
+    put_u32(out + 1, seq);
+
+    for (int sq = 0; sq < BOARD_SQUARES; ++sq)
+    {
+        if (!(squares & (1u << sq)))
+            continue;
+
+        int row, col;
+        game_square_coords(sq, &row, &col);
+        out[len++] = (unsigned char)(sq | (cell_code(game_cell(g, row, col)) << 5));
+    }
+
+    out[5] = (unsigned char)(len - 6);
+    return len;
+}
+
+size_t proto_moves_text(const Move *moves, int count, char *out, size_t size)
+{
+    if (count > MOVE_LIST_MAX)
+        count = MOVE_LIST_MAX;
+
+    int n = snprintf(out, size, "LEGAL_MOVES %d", count);
+    if (n < 0 || (size_t)n >= size)
+        return 0;
+    size_t len = (size_t)n;
+
+    for (int i = 0; i < count; ++i)
+    {
+        for (int h = 0; h <= moves[i].hops; ++h)
+        {
+            int row, col;
+            game_square_coords(moves[i].squares[h], &row, &col);
+            n = snprintf(out + len, size - len, "%c%d,%d", (h == 0) ? ' ' : ',', row, col);
+            if (n < 0 || (size_t)n >= size - len)
+                return 0;
+            len += (size_t)n;
+        }
+    }
+
+    if (len + 1 >= size)
+        return 0;
+    out[len++] = '\n';
+    out[len] = '\0';
+    return len;
+}
+
+size_t proto_analysis_text(const Move *best, int score, int depth, long nodes, long ms, char *out, size_t size)
+{
+    int n = snprintf(out, size, "ANALYSIS %s", (best == NULL) ? "-" : "");
+    if (n < 0 || (size_t)n >= size)
+        return 0;
+    size_t len = (size_t)n;
+
+    for (int h = 0; best != NULL && h <= best->hops; ++h)
+    {
+        int row, col;
+        game_square_coords(best->squares[h], &row, &col);
+        n = snprintf(out + len, size - len, (h == 0) ? "%d,%d" : ",%d,%d", row, col);
+        if (n < 0 || (size_t)n >= size - len)
+            return 0;
+        len += (size_t)n;
+    }
+
+    n = snprintf(out + len, size - len, " %d %d %ld %ld\n", score, depth, nodes, ms);
+    if (n < 0 || (size_t)n >= size - len)
+        return 0;
+    return len + (size_t)n;
+}
+
+size_t proto_moves_binary(const Move *moves, int count, unsigned char *out)
+{
+    size_t len = 2;
+
+    if (count > MOVE_LIST_MAX)
+        count = MOVE_LIST_MAX;
+
+    out[0] = *proto_binary(MSG_LEGAL_MOVES);
+    out[1] = (unsigned char)count;
+    for (int i = 0; i < count; ++i)
+    {
+        out[len++] = (unsigned char)moves[i].hops;
+        for (int h = 0; h <= moves[i].hops; ++h)
+            out[len++] = moves[i].squares[h];
+    }
+    return len;
+}
+
+size_t proto_game_id_text(uint32_t id, char *out, size_t size)
+{
+    int n = snprintf(out, size, "GAME %u\n", id);
+    return (n < 0) ? 0 : (size_t)n;
+}
+
+size_t proto_game_id_binary(uint32_t id, unsigned char *out)
+{
+    out[0] = *proto_binary(MSG_GAME_ID);
+    put_u32(out + 1, id);
+    return BIN_GAME_ID_LEN;
+}
+
+size_t proto_move_binary(int from_row, int from_col, int to_row, int to_col, unsigned char *out)
+{
+    out[0] = BIN_OP_MOVE;
+    out[1] = (unsigned char)game_square(from_row, from_col);
+    out[2] = (unsigned char)game_square(to_row, to_col);
+    return BIN_MOVE_LEN;
+}
+
+size_t proto_session_text(const SessionToken *t, char *out, size_t size)
+{
+    int n = snprintf(out, size, "SESSION %08x%016llx\n", t->game_id, (unsigned long long)t->secret);
+    return (n < 0) ? 0 : (size_t)n;
+}
+
+size_t proto_session_binary(const SessionToken *t, unsigned char *out)
+{
+    out[0] = *proto_binary(MSG_SESSION);
+    put_u32(out + 1, t->game_id);
+    put_u64(out + 5, t->secret);
+    return BIN_SESSION_LEN;
+}
@@ -0,0 +1,167 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "checkers.h"
+
+// Every message the server sends. In the text protocol each one is a
+// line; in the binary protocol each one is a single byte, and MSG_BOARD
+// is followed by the white, black and kings bitboards and the move
+// sequence number (all uint32, little endian). MSG_DELTA lists only the
+// squares the last move changed, see proto_delta_text/proto_delta_binary.
+typedef enum
+{
+    MSG_WAITING_FOR_OPPONENT,
+    MSG_WELCOME_WHITE,
+    MSG_WELCOME_BLACK,
+    MSG_BOARD,
+    MSG_YOUR_TURN,
+    MSG_OPP_TURN,
+    MSG_YOUR_TURN_CONTINUE_CAPTURE,
+    MSG_OPP_TURN_CAPTURE_CHAIN,
+    MSG_MOVE_OK,
+    MSG_MOVE_INVALID,
+    MSG_OPPONENT_MOVED,
+    MSG_YOU_WIN,
+    MSG_YOU_LOSE,
+    MSG_DRAW,
+    MSG_OPPONENT_LEFT,
+    MSG_ERROR_BAD_FORMAT,
+    MSG_ERROR_NOT_IN_GAME,
+    MSG_ERROR_NOT_YOUR_TURN,
+    MSG_ERROR_UNKNOWN_COMMAND,
+    MSG_BINARY_OK,
+    MSG_DELTA,
+    MSG_GAME_ID, // "GAME <id>", the id spectators pass to WATCH
+    MSG_WHITE_WINS, // results as spectators see them
+    MSG_BLACK_WINS,
+    MSG_PLAYER_LEFT,
+    MSG_ERROR_NO_SUCH_GAME,
+    MSG_ERROR_ALREADY_IN_GAME,
+    MSG_SERVER_NO_MORE_GAMES,
+    MSG_LEGAL_MOVES, // the requester's moves, see proto_moves_text
+    MSG_SESSION, // "SESSION <token>", what RESUME takes to get the seat back
+    MSG_ERROR_NO_SUCH_SESSION,
+    MSG_OPPONENT_AWAY, // the opponent's connection dropped, its seat is kept for a while
+    MSG_OPPONENT_BACK, // and it came back with RESUME
+    MSG_IDLE_TIMEOUT, // sent nothing for too long outside a game, the connection is closed
+    MSG_COUNT
+} MsgType;
+
+typedef enum
+{
+    CMD_MOVE,
+    CMD_QUIT,
+    CMD_BINARY, // switch this connection to binary framing
+    CMD_BOARD,  // resend the full position
+    CMD_WATCH,  // follow game_id as a spectator
+    CMD_PLAY_BOT, // leave the queue and play the server at level
+    CMD_LEGAL_MOVES, // list the moves the player may make now
+    CMD_RESUME, // take back the seat session names
+    CMD_BAD_FORMAT,
+    CMD_PROTOCOL_ERROR, // a binary frame of unknown length, nothing after it can be framed
+    CMD_UNKNOWN
+} CommandType;
+
+#define MOVE_PATH_MAX (MOVE_MAX_HOPS + 1)
+
+// Names one seat of one game. The secret is only ever sent to the
+// player in that seat.
+typedef struct
+{
+    uint32_t game_id;
+    uint64_t secret;
+} SessionToken;
+
+typedef struct
+{
+    CommandType type;
+    int path_len; // CMD_MOVE: squares visited, the piece's own first
+    int path[MOVE_PATH_MAX][2]; // (row, col) of each of them
+    uint32_t game_id;
+    int level;
+    SessionToken session;
+} Command;
+
+// Binary frames sent by the client.
+#define BIN_OP_MOVE 0x01 // followed by the from and to square indices
+#define BIN_OP_QUIT 0x02
+#define BIN_OP_BOARD 0x03
+#define BIN_OP_WATCH 0x04 // followed by the game id (uint32)
+#define BIN_OP_PLAY_BOT 0x05 // followed by the level (one byte)
+#define BIN_OP_LEGAL_MOVES 0x06
+#define BIN_OP_MOVE_PATH 0x07 // followed by a square count and the squares
+#define BIN_OP_RESUME 0x08 // followed by the game id (uint32) and the secret (uint64)
+
+#define BIN_MOVE_LEN 3
+#define BIN_WATCH_LEN 5
+#define BIN_PLAY_BOT_LEN 2
+#define BIN_RESUME_LEN 13
+#define BIN_FRAME_MAX (2 + MOVE_PATH_MAX) // longest client frame
+#define BIN_GAME_ID_LEN 5
+#define BIN_SESSION_LEN 13
+#define SESSION_TEXT_MAX 36
+#define BIN_BOARD_LEN 17 // code byte + 4 * uint32
+#define BIN_DELTA_MAX_LEN (6 + BOARD_SQUARES)
+#define DELTA_TEXT_MAX 224
+
+#define MOVE_LIST_MAX 128 // moves a LEGAL_MOVES reply carries
+#define MOVES_TEXT_MAX (24 + MOVE_LIST_MAX * (4 * (MOVE_MAX_HOPS + 1) + 1))
+#define BIN_MOVES_MAX_LEN (2 + MOVE_LIST_MAX * (MOVE_MAX_HOPS + 2))
+
+// "MOVE r0 c0 r1 c1" moves one hop; more pairs play a capture chain in
+// one command.
+void proto_parse_text(const char *line, Command *cmd);
+
+// Decodes one binary frame. Returns the bytes it used, or 0 when the
+// frame is not complete yet. CMD_PROTOCOL_ERROR means the stream is out
+// of step and the connection has to be closed.
+size_t proto_parse_binary(const unsigned char *data, size_t len, Command *cmd);
+
+const char *proto_text(MsgType type);
+const unsigned char *proto_binary(MsgType type); // one byte
+
+// "BOARD <64 cells> <seq>". Clients that predate the sequence number
+// read only the first 64 characters, so the suffix is harmless to them.
+size_t proto_board_text(const Game *g, uint32_t seq, char *out, size_t size);
+size_t proto_board_binary(const Game *g, uint32_t seq, unsigned char *out);
+
+// The 64 cells of a BOARD line back into a position with turn to move.
+// Returns -1 unless cells is exactly 64 valid cells.
+int proto_parse_board(const char *cells, PlayerColor turn, Game *g);
+
+// "DELTA <seq> <row> <col> <cell> ..." with one triple per changed square,
+// where squares is a game_diff mask. In binary: code byte, seq, a count
+// byte, then one byte per square: the square index in the low five bits
+// and the Cell (0 empty, 1 w, 2 W, 3 b, 4 B) in the top three.
+size_t proto_delta_text(const Game *g, uint32_t squares, uint32_t seq, char *out, size_t size);
+size_t proto_delta_binary(const Game *g, uint32_t squares, uint32_t seq, unsigned char *out);
+
+// "LEGAL_MOVES <count> r,c,r,c[,r,c...] ..." with one path per move, from
+// the piece's square to its last landing square. In binary: code byte,
+// a count byte, then per move a hop count byte followed by hops + 1
+// square indices.
+size_t proto_moves_text(const Move *moves, int count, char *out, size_t size);
+size_t proto_moves_binary(const Move *moves, int count, unsigned char *out);
+
+// "ANALYSIS <r,c,r,c[,r,c...]> <score> <depth> <nodes> <ms>", the reply to
+// an admin ANALYZE: the best move as in LEGAL_MOVES, or "-" for none,
+// then the score for the side to move in hundredths of a man, the depth
+// searched, the nodes searched and the time taken.
+#define ANALYSIS_TEXT_MAX (96 + 4 * (MOVE_MAX_HOPS + 1))
+size_t proto_analysis_text(const Move *best, int score, int depth, long nodes, long ms, char *out, size_t size);
+
+size_t proto_game_id_text(uint32_t id, char *out, size_t size);
+size_t proto_game_id_binary(uint32_t id, unsigned char *out);
+
+// "SESSION <token>" where the token is the game id as 8 hex digits and
+// the secret as 16, which is also what "RESUME <token>" takes. In
+// binary: code byte, game id, secret (uint64, little endian).
+size_t proto_session_text(const SessionToken *t, char *out, size_t size);
+size_t proto_session_binary(const SessionToken *t, unsigned char *out);
+
+size_t proto_move_binary(int from_row, int from_col, int to_row, int to_col, unsigned char *out);
+
+#endif
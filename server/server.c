@@ -1,489 +1,3122 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <sys/random.h>
+#include <poll.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <limits.h>
 
 #include "checkers.h"
+#include "linebuf.h"
+#include "pool.h"
+#include "protocol.h"
+#include "engine.h"
+#include "workers.h"
+#include "matchmaker.h"
+#include "journal.h"
+#include "metrics.h"
+#include "log.h"
+#include "endgame.h"
+#include "timerwheel.h"
 
-#define MAX_PLAYERS 16
-#define MAX_GAMES 8
 #define PORT 1100
+#define DEFAULT_MEMORY_MB 256 // budget for the player and game tables
+#define POOL_CHUNK 1024
+#define MAX_REACTORS 64
+#define EPOLL_BATCH 64
+#define MAX_PENDING_OUTPUT 65536
+#define FEED_MAX 32 // shared messages a spectator may have queued
+#define GAME_INDEX_SIZE 4096
+#define MATCH_WIDEN_MS 2000 // wait before pairing across latency buckets
+#define RESTORE_GRACE_SEC 120 // for the players of restored games to come back
+#define PARK_GRACE_SEC 30 // default for -g: how long a dropped player's seat is kept
+#define DRAW_QUIET_MOVES 40 // default for -d: moves each without a capture or a man moving
+#define IDLE_TIMEOUT_SEC 300 // default for -i
+#define CLOCK_SEC 600 // default for -t: each side's time for the game
+#define CLOCK_INCREMENT_SEC 5 // and what every move adds to it
+#define TIMER_TICK_MS 10
+#define LOG_LINES_PER_SEC 2000 // each thread's share of the log, see log_start
+
+struct GameSlot;
+struct Player;
+
+// A message serialized once and written to any number of spectators.
+// Freed when the last spectator is done with it.
+typedef struct
+{
+    atomic_int refs;
+    size_t len;
+    char data[];
+} SharedMsg;
+
+typedef struct
+{
+    int epoll_fd;
+    int wake_fd; // eventfd, signalled when spectators are added to ready or players to inbox
+    pthread_mutex_t ready_lock;
+    struct Player *ready; // spectators with shared messages to write
+
+    // Players to hand over to another reactor. Any thread pushes, the
+    // reactor takes the whole list between two batches of events.
+    struct Player *_Atomic inbox;
+
+    // This reactor's own SO_REUSEPORT listeners with -u, otherwise -1.
+    int listen_fd;
+    int watch_listen_fd;
+} Reactor;
 
 typedef struct Player
 {
     int socket_fd;
     int id;
     PlayerColor color;
-    Game *game;
-    int in_game;
+    struct GameSlot *_Atomic slot; // game this player is seated in, or NULL
+    atomic_int refs; // one for the owning reactor, one while queued, one per pending write
+
+    MatchNode match; // matchmaking queue entry
+    int gone; // disconnected, under lobby_lock
+    int quit; // sent QUIT, so its seat is given up rather than kept
+    SessionToken session; // what this player's RESUME takes, once seated
+
+    Reactor *_Atomic reactor; // owns this socket, changed only by that reactor's thread
+    Reactor *pin_to; // where pin_player is sending it
+    struct Player *inbox_next;
+
+    // Holds a reference while pending. Fires idle_timeout_ms after the
+    // connection was opened and checks last_input_ns, so input never
+    // touches the wheel.
+    Timer idle;
+    _Atomic long long last_input_ns;
+    atomic_int closed; // close_player has run
+
+    LineBuf in; // received bytes not yet split into lines or frames
+    int binary; // binary framing negotiated, written under out_lock
+
+    char *out_buf; // bytes the kernel did not accept yet, allocated on demand
+    size_t out_len;
+    size_t out_cap;
+    int out_armed; // EPOLLOUT requested
+    pthread_mutex_t out_lock;
+
+    // Spectators get all their output through the feed instead of out_buf,
+    // so shared messages are never copied. Guarded by out_lock.
+    int spectator;
+    struct GameSlot *_Atomic watching;
+    SharedMsg *feed[FEED_MAX]; // oldest first, starting at feed_head
+    int feed_head;
+    int feed_count;
+    size_t feed_off; // bytes of the oldest message already written
+    int feed_ready; // linked into its reactor's ready list
+    struct Player *ready_next;
 } Player;
 
-typedef struct
+#define player_of(node) ((Player *)((char *)(node) - offsetof(Player, match)))
+
+// A seat whose player is away, kept until deadline_ns for RESUME. It is
+// part of the GameSlot, so a parked session costs no allocation, and its
+// Player is freed as soon as the connection is gone. Links under park_lock.
+typedef struct ParkedSeat
+{
+    struct ParkedSeat *prev;
+    struct ParkedSeat *next;
+    struct ParkList *list; // NULL unless parked
+    long long deadline_ns;
+    uint32_t game_id; // the game it was parked for, in case the slot moved on
+    struct GameSlot *slot;
+    PlayerColor color;
+} ParkedSeat;
+
+// Parked seats, oldest first. Every seat in a list waits the same time,
+// so each list is in deadline order and one thread expires them all.
+typedef struct ParkList
 {
+    ParkedSeat *head;
+    ParkedSeat *tail;
+    long long grace_ns;
+} ParkList;
+
+// Every game has its own lock, so moves in different games never contend.
+typedef struct GameSlot
+{
+    pthread_mutex_t lock;
     Game game;
-    int in_use;
+    uint32_t seq; // moves applied so far, carried by BOARD and DELTA
+    uint32_t id;
+    Player *seats[2]; // indexed by PlayerColor, cleared when the game ends
+    struct GameSlot *next_by_id; // game_index chain, under lobby_lock
+
+    // Taken before lock is released, so spectators get the moves in order
+    // while the next move can already be played.
+    pthread_mutex_t watch_lock;
+    Player **watchers;
+    int watcher_count;
+    int watcher_cap;
+
+    int bot_level; // 0 unless the black seat is played by the server
+
+    int active; // from start_game (or a restore) to end_game
+    GameHistory history; // for repetitions, not journaled
+
+    // Chess clock, when clock_ms_base is set: what each side has left as
+    // of turn_start_ns, and a timer due when the side to move runs out.
+    // Stopped, with no timer pending, while the side to move is away.
+    long long clock_ms[2];
+    long long turn_start_ns;
+    int clock_stopped;
+    Timer clock;
+    uint64_t secrets[2]; // session secrets by seat, 0 for the bot's
+    ParkedSeat parked[2]; // by seat
 } GameSlot;
 
-static GameSlot games[MAX_GAMES];
-
-static Player players[MAX_PLAYERS];
+// A bot reply to one position, searched on a bot worker.
+typedef struct
+{
+    Job job;
+    GameSlot *slot;
+    uint32_t game_id;
+    uint32_t seq; // the position the search was asked for
+    int level;
+} BotJob;
+
+// An ANALYZE from the admin port, answered on the socket it came in on.
+typedef struct
+{
+    Job job;
+    int fd;
+    Game game;
+    int depth;
+} AnalyzeJob;
 
-static Player *waiting_player = NULL;
+#define OUTBOX_MAX 16
 
-pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+// Messages produced while a lock is held. They are written only after the
+// lock is released, so a slow socket never stalls anyone else. Each one
+// is encoded for its recipient's protocol at write time.
+typedef struct
+{
+    Player *to[OUTBOX_MAX];
+    MsgType msg[OUTBOX_MAX];
+    int count;
+
+    Game board; // position carried by MSG_BOARD and MSG_DELTA
+    uint32_t seq;
+    uint32_t changed; // squares MSG_DELTA lists
+    uint32_t game_id; // carried by MSG_GAME_ID
+
+    char board_text[96]; // encodings of board, filled on first use
+    size_t board_text_len;
+    unsigned char board_bin[BIN_BOARD_LEN];
+    size_t board_bin_len;
+    char delta_text[DELTA_TEXT_MAX];
+    size_t delta_text_len;
+    unsigned char delta_bin[BIN_DELTA_MAX_LEN];
+    size_t delta_bin_len;
+    char game_text[24];
+    unsigned char game_bin[BIN_GAME_ID_LEN];
+
+    // MSG_LEGAL_MOVES, encoded by the sender into its own buffers.
+    const char *moves_text;
+    size_t moves_text_len;
+    const unsigned char *moves_bin;
+    size_t moves_bin_len;
+} Outbox;
+
+// One batch of messages for every spectator of a game, encoded at most
+// once per framing.
+typedef struct
+{
+    Outbox *ob;
+    const MsgType *msgs;
+    int count;
+    SharedMsg *encoded[2]; // indexed by Player.binary
+    SharedMsg *resync[2]; // the same batch with a full board, for laggards
+} FanOut;
+
+// Slots and players come from pools that grow on demand up to the memory
+// budget. A stale GameSlot pointer stays safe to lock: pooled memory is
+// never released, and the seats tell whether the game is still ours.
+static Pool game_pool;
+static Pool player_pool;
+static int next_player_id = 1;
+
+// Players waiting for an opponent. Joining is lock-free; the pairing
+// thread starts the games.
+static Matchmaker matchmaker;
+static int latency_buckets = 0; // pair players with similar round-trip times first
+
+// Games by id, for WATCH.
+static GameSlot *game_index[GAME_INDEX_SIZE];
+static uint32_t next_game_id = 1;
+
+// Guards the pools, the game index, the id counters and Player.gone.
+static pthread_mutex_t lobby_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static Reactor reactors[MAX_REACTORS];
+static int reactor_count = 1;
+static int next_reactor = 0;
+
+// -u: every reactor accepts on a listener of its own, which the kernel
+// balances connections across, instead of the main thread accepting for
+// all of them.
+static int reuseport = 0;
+
+// Syscall accounting, printed every stats_interval seconds when enabled.
+// The full set of metrics is served on admin_port.
+static int stats_interval = 0;
+static int admin_port = -1;
+
+// The bot always plays black against a human white.
+#define BOT_COLOR COLOR_BLACK
+#define BOT_TT_BITS 18
+
+static WorkerPool bot_pool;
+static int bot_threads = 2;
+
+// ANALYZE requests run one at a time on analyze_pool's thread, and each
+// is searched by every thread of the analyzer.
+#define ANALYZE_TT_BITS 20
+#define ANALYZE_MAX_DEPTH 40
+#define ANALYZE_TIME_MS 60000
+
+static WorkerPool analyze_pool;
+static Analyzer *analyzer = NULL;
+static int analyze_threads = 0; // 0: one per CPU
+
+// Every game's start, moves and end, so a restarted server can carry on
+// with the games that were running. NULL path: no journal.
+static Journal journal;
+static const char *journal_path = NULL;
+
+// Games down to as few pieces as the endgame table covers are decided from
+// it after the move that got them there. NULL path: played out.
+static const char *endgame_path = NULL;
+
+// Games that stop making progress are drawn: a position that comes up a
+// third time, or this many moves by each side with no capture and no man
+// moving. 0: no move limit.
+static int draw_quiet_moves = DRAW_QUIET_MOVES;
+
+// Turn clocks and idle connections run on one timer wheel. 0 turns
+// either off.
+static TimerWheel timers;
+static long long clock_ms_base = CLOCK_SEC * 1000ll;
+static long long clock_ms_increment = CLOCK_INCREMENT_SEC * 1000ll;
+static long long idle_timeout_ms = IDLE_TIMEOUT_SEC * 1000ll;
+
+// Seats kept for players who are away, see ParkedSeat.
+static pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond; // a list went from empty to not, on CLOCK_MONOTONIC
+static ParkList dropped_seats; // players whose connection went away
+static ParkList restored_seats; // players of games read back from the journal
+static int parked_count = 0;
+static int park_grace_sec = PARK_GRACE_SEC; // 0: a dropped player forfeits at once
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
 
-static int send_line(int fd, const char *line)
+static void note_send(long long start, ssize_t n)
 {
-    size_t len = strlen(line);
-    ssize_t n = send(fd, line, len, 0);
-    return (n == (ssize_t)len) ? 0 : -1;
+    metrics_record(HIST_SEND, (uint64_t)(now_ns() - start));
+    metrics_count(COUNTER_SEND_CALLS, 1);
+    if (n > 0)
+        metrics_count(COUNTER_BYTES_OUT, (uint64_t)n);
 }
 
-static int recv_line(int fd, char *buf, size_t size)
+static int set_nonblocking(int fd)
 {
-    size_t i = 0;
-    while (i + 1 < size)
-    {
-        char c;
-        ssize_t n = recv(fd, &c, 1, 0);
-        if (n <= 0)
-        {
-            return -1;
-        }
-        if (c == '\n')
-        {
-            buf[i] = '\0';
-            return (int)i;
-        }
-        buf[i++] = c;
-    }
-    buf[i] = '\0';
-    return (int)i;
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
 
-static int find_game_index(Game *g)
+static void watch_output(Player *p, int want_out)
 {
-    for (int i = 0; i < MAX_GAMES; ++i)
-    {
-        if (games[i].in_use && &games[i].game == g)
-            return i;
-    }
-    return -1;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | (want_out ? EPOLLOUT : 0);
+    ev.data.ptr = p;
+    epoll_ctl(p->reactor->epoll_fd, EPOLL_CTL_MOD, p->socket_fd, &ev);
+    p->out_armed = want_out;
 }
 
-static Player *find_other_player(Player *p)
+static int queue_output(Player *p, const char *data, size_t len)
 {
-    for (int i = 0; i < MAX_PLAYERS; ++i)
+    if (p->out_len + len > MAX_PENDING_OUTPUT)
+        return -1;
+
+    if (p->out_len + len > p->out_cap)
     {
-        Player *q = &players[i];
-        if (q->socket_fd == -1)
-            continue;
-        if (q == p)
-            continue;
-        if (q->in_game && q->game == p->game)
-            return q;
+        size_t cap = p->out_cap ? p->out_cap : 256;
+        while (cap < p->out_len + len)
+            cap *= 2;
+        char *nb = realloc(p->out_buf, cap);
+        if (nb == NULL)
+            return -1;
+        p->out_buf = nb;
+        p->out_cap = cap;
     }
-    return NULL;
+
+    memcpy(p->out_buf + p->out_len, data, len);
+    p->out_len += len;
+    return 0;
 }
 
-static void handle_player_disconnect(Player *me)
+static void encode_msg(Outbox *ob, MsgType type, int binary, struct iovec *iov)
 {
-    if (me->in_game && me->game != NULL)
+    if (type == MSG_BOARD)
     {
-        Game *g = me->game;
-        Player *op = find_other_player(me);
-        if (op != NULL)
+        if (binary)
         {
-            send_line(op->socket_fd, "OPPONENT_LEFT\n");
-            op->in_game = 0;
-            op->game = NULL;
+            if (ob->board_bin_len == 0)
+                ob->board_bin_len = proto_board_binary(&ob->board, ob->seq, ob->board_bin);
+            iov->iov_base = ob->board_bin;
+            iov->iov_len = ob->board_bin_len;
         }
-        me->in_game = 0;
-        me->game = NULL;
-
-        int gi = find_game_index(g);
-        if (gi >= 0)
+        else
+        {
+            if (ob->board_text_len == 0)
+                ob->board_text_len = proto_board_text(&ob->board, ob->seq, ob->board_text, sizeof(ob->board_text));
+            iov->iov_base = ob->board_text;
+            iov->iov_len = ob->board_text_len;
+        }
+    }
+    else if (type == MSG_DELTA)
+    {
+        if (binary)
+        {
+            if (ob->delta_bin_len == 0)
+                ob->delta_bin_len = proto_delta_binary(&ob->board, ob->changed, ob->seq, ob->delta_bin);
+            iov->iov_base = ob->delta_bin;
+            iov->iov_len = ob->delta_bin_len;
+        }
+        else
+        {
+            if (ob->delta_text_len == 0)
+                ob->delta_text_len = proto_delta_text(&ob->board, ob->changed, ob->seq,
+                                                      ob->delta_text, sizeof(ob->delta_text));
+            iov->iov_base = ob->delta_text;
+            iov->iov_len = ob->delta_text_len;
+        }
+    }
+    else if (type == MSG_GAME_ID)
+    {
+        if (binary)
+        {
+            iov->iov_base = ob->game_bin;
+            iov->iov_len = proto_game_id_binary(ob->game_id, ob->game_bin);
+        }
+        else
         {
-            games[gi].in_use = 0;
+            iov->iov_base = ob->game_text;
+            iov->iov_len = proto_game_id_text(ob->game_id, ob->game_text, sizeof(ob->game_text));
         }
     }
-    else if (waiting_player == me)
+    else if (type == MSG_LEGAL_MOVES)
     {
-        waiting_player = NULL;
+        iov->iov_base = binary ? (void *)ob->moves_bin : (void *)ob->moves_text;
+        iov->iov_len = binary ? ob->moves_bin_len : ob->moves_text_len;
+    }
+    else if (binary)
+    {
+        iov->iov_base = (void *)proto_binary(type);
+        iov->iov_len = 1;
+    }
+    else
+    {
+        iov->iov_base = (void *)proto_text(type);
+        iov->iov_len = strlen(proto_text(type));
     }
-
-    me->socket_fd = -1;
 }
 
-void *socketThread(void *arg)
+static SharedMsg *shared_msg_new(Outbox *ob, const MsgType *msgs, int count, int binary)
 {
-    int sock = *((int *)arg);
-    free(arg);
-
-    printf("New client thread: socket=%d\n", sock);
+    struct iovec iov[OUTBOX_MAX];
+    size_t total = 0;
 
-    Player *me = NULL;
+    if (count > OUTBOX_MAX)
+        count = OUTBOX_MAX;
 
-    pthread_mutex_lock(&global_lock);
-    int free_index = -1;
-    for (int i = 0; i < MAX_PLAYERS; ++i)
+    for (int i = 0; i < count; ++i)
     {
-        if (players[i].socket_fd == -1)
-        {
-            free_index = i;
-            break;
-        }
+        encode_msg(ob, msgs[i], binary, &iov[i]);
+        total += iov[i].iov_len;
     }
 
-    if (free_index == -1)
+    SharedMsg *m = malloc(sizeof(SharedMsg) + total);
+    if (m == NULL)
+        return NULL;
+
+    atomic_init(&m->refs, 1);
+    m->len = 0;
+    for (int i = 0; i < count; ++i)
     {
-        pthread_mutex_unlock(&global_lock);
-        send_line(sock, "SERVER_FULL\n");
-        close(sock);
-        pthread_exit(NULL);
+        memcpy(m->data + m->len, iov[i].iov_base, iov[i].iov_len);
+        m->len += iov[i].iov_len;
     }
+    return m;
+}
 
-    me = &players[free_index];
-    me->socket_fd = sock;
-    me->id = free_index + 1;
-    me->color = COLOR_WHITE;
-    me->game = NULL;
-    me->in_game = 0;
+static void shared_msg_put(SharedMsg *m)
+{
+    if (m != NULL && atomic_fetch_sub(&m->refs, 1) == 1)
+        free(m);
+}
 
-    if (waiting_player == NULL)
+// Must be called with out_lock held. m may be NULL when the spectator is
+// lagging and the batch was not needed; a full feed is then cut back to
+// the message being written and replaced by resync.
+static int feed_push(Player *w, SharedMsg *m, SharedMsg *resync)
+{
+    if (w->feed_count == FEED_MAX)
     {
-        waiting_player = me;
-        pthread_mutex_unlock(&global_lock);
+        if (resync == NULL)
+            return -1;
 
-        send_line(sock, "WAITING_FOR_OPPONENT\n");
+        int keep = (w->feed_off > 0) ? 1 : 0;
+        for (int i = keep; i < w->feed_count; ++i)
+            shared_msg_put(w->feed[(w->feed_head + i) % FEED_MAX]);
+        w->feed_count = keep;
+        m = resync;
     }
-    else
+    if (m == NULL)
+        return -1;
+
+    atomic_fetch_add(&m->refs, 1);
+    w->feed[(w->feed_head + w->feed_count) % FEED_MAX] = m;
+    w->feed_count++;
+    return 0;
+}
+
+// Writes as much of the feed as the socket takes, in one sendmsg per
+// round. Returns 1 when the socket is full, -1 on error and 0 when the
+// feed is empty. Must be called with out_lock held.
+static int write_feed(Player *p)
+{
+    while (p->feed_count > 0)
     {
-        int gindex = -1;
-        for (int i = 0; i < MAX_GAMES; ++i)
+        struct iovec iov[FEED_MAX];
+        for (int i = 0; i < p->feed_count; ++i)
+        {
+            SharedMsg *m = p->feed[(p->feed_head + i) % FEED_MAX];
+            size_t off = (i == 0) ? p->feed_off : 0;
+            iov[i].iov_base = m->data + off;
+            iov[i].iov_len = m->len - off;
+        }
+
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)p->feed_count;
+
+        long long start = now_ns();
+        ssize_t n = sendmsg(p->socket_fd, &msg, MSG_NOSIGNAL);
+        note_send(start, n);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : -1;
+        }
+
+        size_t left = (size_t)n;
+        while (p->feed_count > 0)
         {
-            if (!games[i].in_use)
+            SharedMsg *m = p->feed[p->feed_head];
+            size_t rest = m->len - p->feed_off;
+            if (left < rest)
             {
-                gindex = i;
+                p->feed_off += left;
                 break;
             }
+            left -= rest;
+            shared_msg_put(m);
+            p->feed_head = (p->feed_head + 1) % FEED_MAX;
+            p->feed_count--;
+            p->feed_off = 0;
         }
+    }
+    return 0;
+}
 
-        if (gindex == -1)
-        {
-            pthread_mutex_unlock(&global_lock);
-            send_line(sock, "SERVER_NO_MORE_GAMES\n");
-            close(sock);
-            pthread_exit(NULL);
-        }
+// Writes the feed now and waits for EPOLLOUT if the socket is full. Must
+// be called with out_lock held.
+static void drain_feed(Player *p)
+{
+    int rc = write_feed(p);
+    if (rc < 0)
+        shutdown(p->socket_fd, SHUT_RDWR);
+    else if ((rc == 1) != p->out_armed)
+        watch_output(p, rc == 1);
+}
 
-        games[gindex].in_use = 1;
-        Game *g = &games[gindex].game;
-        game_init(g);
+// Writes all messages with a single sendmsg (writev plus MSG_NOSIGNAL),
+// so one reply batch costs one syscall and usually one TCP segment.
+// Never blocks: whatever the kernel does not take right away is kept in
+// out_buf and written by the owning reactor once the socket is writable.
+// A client that lets too much output pile up is shut down, its reactor
+// then sees the hangup and cleans it up. ob may be NULL when no message
+// carries a board or delta.
+static int send_msgs(Player *p, Outbox *ob, const MsgType *msgs, int count)
+{
+    struct iovec iov[OUTBOX_MAX];
+    size_t total = 0;
+    size_t off = 0;
+    int rc = 0;
 
-        Player *p1 = waiting_player;
-        Player *p2 = me;
-        waiting_player = NULL;
+    if (count > OUTBOX_MAX)
+        count = OUTBOX_MAX;
 
-        p1->game = g;
-        p2->game = g;
-        p1->in_game = 1;
-        p2->in_game = 1;
+    pthread_mutex_lock(&p->out_lock);
 
-        p1->color = COLOR_WHITE;
-        p2->color = COLOR_BLACK;
+    if (p->spectator)
+    {
+        // Replies to a spectator's own commands queue behind the moves
+        // already in its feed.
+        SharedMsg *m = shared_msg_new(ob, msgs, count, p->binary);
+        for (int i = 0; i < count; ++i)
+            if (msgs[i] == MSG_BINARY_OK)
+                p->binary = 1;
+        if (feed_push(p, m, NULL) < 0)
+        {
+            shutdown(p->socket_fd, SHUT_RDWR);
+            rc = -1;
+        }
+        else if (!p->out_armed)
+        {
+            drain_feed(p);
+        }
+        shared_msg_put(m);
+        pthread_mutex_unlock(&p->out_lock);
+        return rc;
+    }
+
+    char session_text[SESSION_TEXT_MAX];
+    unsigned char session_bin[BIN_SESSION_LEN];
 
-        pthread_mutex_unlock(&global_lock);
+    for (int i = 0; i < count; ++i)
+    {
+        // The token differs per player, so it is never shared.
+        if (msgs[i] == MSG_SESSION && p->binary)
+        {
+            iov[i].iov_base = session_bin;
+            iov[i].iov_len = proto_session_binary(&p->session, session_bin);
+        }
+        else if (msgs[i] == MSG_SESSION)
+        {
+            iov[i].iov_base = session_text;
+            iov[i].iov_len = proto_session_text(&p->session, session_text, sizeof(session_text));
+        }
+        else
+            encode_msg(ob, msgs[i], p->binary, &iov[i]);
+        total += iov[i].iov_len;
 
-        send_line(p1->socket_fd, "WELCOME WHITE\n");
-        send_line(p2->socket_fd, "WELCOME BLACK\n");
+        // The acknowledgement is the last text this connection gets.
+        if (msgs[i] == MSG_BINARY_OK)
+            p->binary = 1;
+    }
 
-        char board_msg[128];
-        snprintf(board_msg, sizeof(board_msg), "BOARD ");
+    if (p->out_len == 0)
+    {
+        struct msghdr msg = {0};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)count;
+
+        long long start = now_ns();
+        ssize_t n = sendmsg(p->socket_fd, &msg, MSG_NOSIGNAL);
+        note_send(start, n);
+        if (n > 0)
+            off = (size_t)n;
+        else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            rc = -1;
+    }
 
-        char tmp[64 + 1];
-        int idx = 0;
-        for (int r = 0; r < BOARD_SIZE; ++r)
+    if (rc == 0 && off < total)
+    {
+        int was_empty = (p->out_len == 0);
+        for (int i = 0; i < count && rc == 0; ++i)
         {
-            for (int c = 0; c < BOARD_SIZE; ++c)
+            if (off >= iov[i].iov_len)
             {
-                tmp[idx++] = g->board[r][c];
+                off -= iov[i].iov_len;
+                continue;
             }
+            if (queue_output(p, (const char *)iov[i].iov_base + off, iov[i].iov_len - off) != 0)
+                rc = -1;
+            off = 0;
         }
-        tmp[idx] = '\0';
+        if (rc == 0 && was_empty)
+            watch_output(p, 1);
+    }
 
-        strncat(board_msg, tmp, sizeof(board_msg) - strlen(board_msg) - 1);
-        strncat(board_msg, "\n", sizeof(board_msg) - strlen(board_msg) - 1);
+    if (rc != 0)
+        shutdown(p->socket_fd, SHUT_RDWR);
 
-        send_line(p1->socket_fd, board_msg);
-        send_line(p2->socket_fd, board_msg);
+    pthread_mutex_unlock(&p->out_lock);
+    return rc;
+}
 
-        send_line(p1->socket_fd, "YOUR_TURN\n");
-        send_line(p2->socket_fd, "OPP_TURN\n");
-    }
+static int send_msg(Player *p, MsgType type)
+{
+    return send_msgs(p, NULL, &type, 1);
+}
 
-    char buf[256];
+static int flush_output(Player *p)
+{
+    int rc = 0;
 
-    while (1)
-    {
-        int n = recv_line(sock, buf, sizeof(buf));
-        if (n <= 0)
-        {
-            printf("Client %d disconnected\n", me->id);
-            pthread_mutex_lock(&global_lock);
+    pthread_mutex_lock(&p->out_lock);
 
-            handle_player_disconnect(me);
+    if (p->spectator)
+    {
+        rc = write_feed(p);
+        if (rc == 0)
+            watch_output(p, 0);
+        pthread_mutex_unlock(&p->out_lock);
+        return (rc < 0) ? -1 : 0;
+    }
 
-            pthread_mutex_unlock(&global_lock);
-            break;
+    size_t off = 0;
+    while (off < p->out_len)
+    {
+        long long start = now_ns();
+        ssize_t n = send(p->socket_fd, p->out_buf + off, p->out_len - off, MSG_NOSIGNAL);
+        note_send(start, n);
+        if (n > 0)
+        {
+            off += (size_t)n;
+            continue;
         }
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        rc = -1;
+        break;
+    }
 
-        printf("Client %d sent: %s\n", me->id, buf);
+    memmove(p->out_buf, p->out_buf + off, p->out_len - off);
+    p->out_len -= off;
 
-        if (strcmp(buf, "QUIT") == 0)
-        {
-            pthread_mutex_lock(&global_lock);
+    if (rc == 0 && p->out_len == 0)
+        watch_output(p, 0);
 
-            handle_player_disconnect(me);
-            
-            pthread_mutex_unlock(&global_lock);
-            break;
-        }
+    pthread_mutex_unlock(&p->out_lock);
+    return rc;
+}
 
-        if (strncmp(buf, "MOVE", 4) == 0)
-        {
-            int fr, fc, tr, tc;
-            if (sscanf(buf, "MOVE %d %d %d %d", &fr, &fc, &tr, &tc) != 4)
-            {
-                send_line(sock, "ERROR_BAD_FORMAT\n");
-                send_line(sock, "YOUR_TURN\n");
-                continue;
-            }
+static void player_get(Player *p)
+{
+    atomic_fetch_add(&p->refs, 1);
+}
 
-            pthread_mutex_lock(&global_lock);
+// The socket is closed and the table entry reused only after the last
+// reference is gone, so a write from another thread never hits a
+// descriptor that was already handed to a new client.
+static void player_put(Player *p)
+{
+    if (atomic_fetch_sub(&p->refs, 1) != 1)
+        return;
 
-            if (!me->in_game || me->game == NULL)
-            {
-                pthread_mutex_unlock(&global_lock);
-                send_line(sock, "ERROR_NOT_IN_GAME\n");
-                continue;
-            }
+    int fd = p->socket_fd;
 
-            Game *g = me->game;
-            Player *op = find_other_player(me);
+    pthread_mutex_lock(&p->out_lock);
+    free(p->out_buf);
+    p->out_buf = NULL;
+    p->out_len = 0;
+    p->out_cap = 0;
+    while (p->feed_count > 0)
+    {
+        shared_msg_put(p->feed[p->feed_head]);
+        p->feed_head = (p->feed_head + 1) % FEED_MAX;
+        p->feed_count--;
+    }
+    pthread_mutex_unlock(&p->out_lock);
 
-            if (g->turn != me->color && !g->must_continue_capture)
-            {
-                pthread_mutex_unlock(&global_lock);
-                send_line(sock, "ERROR_NOT_YOUR_TURN\n");
-                continue;
-            }
+    close(fd);
 
-            if (!game_apply_move(g, fr, fc, tr, tc))
-            {
-                int must = g->must_continue_capture;
-                pthread_mutex_unlock(&global_lock);
+    pthread_mutex_lock(&lobby_lock);
+    pool_free(&player_pool, p);
+    pthread_mutex_unlock(&lobby_lock);
+}
 
-                send_line(sock, "MOVE_INVALID\n");
-                if (must)
-                    send_line(sock, "YOUR_TURN_CONTINUE_CAPTURE\n");
-                else
-                    send_line(sock, "YOUR_TURN\n");
-                continue;
-            }
+static void outbox_init(Outbox *ob)
+{
+    ob->count = 0;
+    ob->board_text_len = 0;
+    ob->board_bin_len = 0;
+    ob->delta_text_len = 0;
+    ob->delta_bin_len = 0;
+    ob->moves_text = NULL;
+    ob->moves_text_len = 0;
+    ob->moves_bin = NULL;
+    ob->moves_bin_len = 0;
+}
 
-            send_line(sock, "MOVE_OK\n");
-            if (op != NULL)
-            {
-                send_line(op->socket_fd, "OPPONENT_MOVED\n");
-            }
+static void outbox_add(Outbox *ob, Player *to, MsgType msg)
+{
+    if (to == NULL || ob->count == OUTBOX_MAX)
+        return;
 
-            char board_msg[128];
-            snprintf(board_msg, sizeof(board_msg), "BOARD ");
+    player_get(to);
+    ob->to[ob->count] = to;
+    ob->msg[ob->count] = msg;
+    ob->count++;
+}
 
-            char tmp[64 + 1];
-            int idx = 0;
-            for (int r = 0; r < BOARD_SIZE; ++r)
-            {
-                for (int c = 0; c < BOARD_SIZE; ++c)
-                {
-                    tmp[idx++] = g->board[r][c];
-                }
-            }
-            tmp[idx] = '\0';
-            strncat(board_msg, tmp, sizeof(board_msg) - strlen(board_msg) - 1);
-            strncat(board_msg, "\n", sizeof(board_msg) - strlen(board_msg) - 1);
+// Snapshot of the position that later MSG_BOARD and MSG_DELTA entries
+// carry; changed is the set of squares the move touched.
+static void outbox_set_board(Outbox *ob, const Game *g, uint32_t seq, uint32_t changed)
+{
+    ob->board = *g;
+    ob->seq = seq;
+    ob->changed = changed;
+    ob->board_text_len = 0;
+    ob->board_bin_len = 0;
+    ob->delta_text_len = 0;
+    ob->delta_bin_len = 0;
+}
 
-            send_line(sock, board_msg);
-            if (op != NULL)
-            {
-                send_line(op->socket_fd, board_msg);
-            }
+// Each recipient gets all of its messages in one write, in the order they
+// were added.
+static void outbox_flush(Outbox *ob)
+{
+    int sent[OUTBOX_MAX] = {0};
 
-            if (game_is_finished(g))
-            {
-                if (g->result == GAME_WHITE_WIN)
-                {
-                    if (me->color == COLOR_WHITE)
-                    {
-                        send_line(sock, "YOU_WIN\n");
-                        if (op)
-                            send_line(op->socket_fd, "YOU_LOSE\n");
-                    }
-                    else
-                    {
-                        send_line(sock, "YOU_LOSE\n");
-                        if (op)
-                            send_line(op->socket_fd, "YOU_WIN\n");
-                    }
-                }
-                else if (g->result == GAME_BLACK_WIN)
-                {
-                    if (me->color == COLOR_BLACK)
-                    {
-                        send_line(sock, "YOU_WIN\n");
-                        if (op)
-                            send_line(op->socket_fd, "YOU_LOSE\n");
-                    }
-                    else
-                    {
-                        send_line(sock, "YOU_LOSE\n");
-                        if (op)
-                            send_line(op->socket_fd, "YOU_WIN\n");
-                    }
-                }
-                else
-                {
-                    send_line(sock, "DRAW\n");
-                    if (op)
-                        send_line(op->socket_fd, "DRAW\n");
-                }
-
-                if (op)
-                {
-                    op->in_game = 0;
-                    op->game = NULL;
-                }
-                me->in_game = 0;
-                me->game = NULL;
-
-                int gi = find_game_index(g);
-                if (gi >= 0)
-                {
-                    games[gi].in_use = 0;
-                }
-            }
-            else
-            {
-                if (g->must_continue_capture)
-                {
-                    send_line(sock, "YOUR_TURN_CONTINUE_CAPTURE\n");
-                    if (op)
-                        send_line(op->socket_fd, "OPP_TURN_CAPTURE_CHAIN\n");
-                }
-                else
-                {
-                    if (op)
-                    {
-                        send_line(op->socket_fd, "YOUR_TURN\n");
-                    }
-                    send_line(sock, "OPP_TURN\n");
-                }
-            }
+    for (int i = 0; i < ob->count; ++i)
+    {
+        if (sent[i])
+            continue;
 
-            pthread_mutex_unlock(&global_lock);
-        }
-        else
+        MsgType msgs[OUTBOX_MAX];
+        int n = 0;
+        for (int j = i; j < ob->count; ++j)
         {
-            send_line(sock, "ERROR_UNKNOWN_COMMAND\n");
+            if (ob->to[j] != ob->to[i])
+                continue;
+            msgs[n++] = ob->msg[j];
+            sent[j] = 1;
         }
+        send_msgs(ob->to[i], ob, msgs, n);
     }
 
-    close(sock);
-    pthread_exit(NULL);
+    for (int i = 0; i < ob->count; ++i)
+        player_put(ob->to[i]);
+    ob->count = 0;
 }
 
-int main()
+static PlayerColor other_color(PlayerColor c)
 {
-    int serverSocket;
-    struct sockaddr_in serverAddr;
-    struct sockaddr_storage serverStorage;
-    socklen_t addr_size;
+    return (c == COLOR_WHITE) ? COLOR_BLACK : COLOR_WHITE;
+}
 
-    serverSocket = socket(PF_INET, SOCK_STREAM, 0);
-    if (serverSocket < 0)
+static SharedMsg *fan_out_msg(FanOut *fo, int binary, int resync)
+{
+    SharedMsg **cache = resync ? &fo->resync[binary] : &fo->encoded[binary];
+    if (*cache != NULL)
+        return *cache;
+
+    if (!resync)
     {
-        perror("socket");
-        exit(EXIT_FAILURE);
+        *cache = shared_msg_new(fo->ob, fo->msgs, fo->count, binary);
+        return *cache;
     }
 
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(PORT);
-    serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    memset(serverAddr.sin_zero, '\0', sizeof serverAddr.sin_zero);
+    MsgType msgs[OUTBOX_MAX];
+    for (int i = 0; i < fo->count; ++i)
+        msgs[i] = (fo->msgs[i] == MSG_DELTA) ? MSG_BOARD : fo->msgs[i];
+    *cache = shared_msg_new(fo->ob, msgs, fo->count, binary);
+    return *cache;
+}
 
-    if (bind(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0)
+// Queues one batch for every spectator of the game. The batch is encoded
+// once per framing and only referenced from each feed; the writes are
+// left to the spectators' own reactors, so the cost here does not depend
+// on how fast anyone reads. A spectator that fell FEED_MAX batches behind
+// gets a full board instead of the moves it missed.
+// Must be called with slot->watch_lock held.
+static void fan_out(GameSlot *slot, Outbox *ob, const MsgType *msgs, int count)
+{
+    if (slot->watcher_count == 0 || count == 0)
+        return;
+
+    FanOut fo = {ob, msgs, count, {NULL, NULL}, {NULL, NULL}};
+    Player *ready[MAX_REACTORS] = {NULL};
+
+    for (int i = 0; i < slot->watcher_count; ++i)
     {
-        perror("bind");
-        close(serverSocket);
-        exit(EXIT_FAILURE);
+        Player *w = slot->watchers[i];
+
+        pthread_mutex_lock(&w->out_lock);
+        SharedMsg *m = fan_out_msg(&fo, w->binary, 0);
+        SharedMsg *resync = (w->feed_count == FEED_MAX) ? fan_out_msg(&fo, w->binary, 1) : NULL;
+        int link = (feed_push(w, m, resync) == 0 && !w->feed_ready && !w->out_armed);
+        if (link)
+            w->feed_ready = 1;
+        pthread_mutex_unlock(&w->out_lock);
+
+        if (link)
+        {
+            int r = (int)(w->reactor - reactors);
+            player_get(w);
+            w->ready_next = ready[r];
+            ready[r] = w;
+        }
     }
 
-    if (listen(serverSocket, 50) == 0)
-        printf("Listening on port %d\n", PORT);
-    else
+    for (int r = 0; r < reactor_count; ++r)
     {
-        perror("listen");
-        close(serverSocket);
-        exit(EXIT_FAILURE);
+        if (ready[r] == NULL)
+            continue;
+
+        Player *tail = ready[r];
+        while (tail->ready_next != NULL)
+            tail = tail->ready_next;
+
+        pthread_mutex_lock(&reactors[r].ready_lock);
+        tail->ready_next = reactors[r].ready;
+        reactors[r].ready = ready[r];
+        pthread_mutex_unlock(&reactors[r].ready_lock);
+
+        eventfd_write(reactors[r].wake_fd, 1);
     }
 
-    for (int i = 0; i < MAX_PLAYERS; ++i)
+    for (int i = 0; i < 2; ++i)
     {
-        players[i].socket_fd = -1;
-        players[i].in_game = 0;
-        players[i].game = NULL;
-        players[i].id = i + 1;
+        shared_msg_put(fo.encoded[i]);
+        shared_msg_put(fo.resync[i]);
     }
-    for (int i = 0; i < MAX_GAMES; ++i)
+}
+
+// Ends every subscription to a finished game. The references are handed
+// back to the caller, to be dropped once watch_lock is released.
+// Must be called with slot->watch_lock held.
+static int detach_watchers(GameSlot *slot, Player ***out)
+{
+    int n = slot->watcher_count;
+    for (int i = 0; i < n; ++i)
+        slot->watchers[i]->watching = NULL;
+
+    *out = slot->watchers;
+    slot->watchers = NULL;
+    slot->watcher_count = 0;
+    slot->watcher_cap = 0;
+    return n;
+}
+
+static void put_watchers(Player **watchers, int count)
+{
+    for (int i = 0; i < count; ++i)
+        player_put(watchers[i]);
+    free(watchers);
+}
+
+static int find_watcher(const GameSlot *slot, const Player *p)
+{
+    for (int i = 0; i < slot->watcher_count; ++i)
+        if (slot->watchers[i] == p)
+            return i;
+    return -1;
+}
+
+static int add_watcher(GameSlot *slot, Player *p)
+{
+    if (slot->watcher_count == slot->watcher_cap)
     {
-        games[i].in_use = 0;
+        int cap = slot->watcher_cap ? slot->watcher_cap * 2 : 16;
+        Player **nw = realloc(slot->watchers, (size_t)cap * sizeof(*nw));
+        if (nw == NULL)
+            return -1;
+        slot->watchers = nw;
+        slot->watcher_cap = cap;
     }
 
-    while (1)
-    {
-        addr_size = sizeof serverStorage;
-        int *newSocket = malloc(sizeof(int));
-        if (!newSocket)
-        {
-            perror("malloc");
-            continue;
-        }
+    player_get(p);
+    slot->watchers[slot->watcher_count++] = p;
+    p->watching = slot;
+    return 0;
+}
 
-        *newSocket = accept(serverSocket, (struct sockaddr *)&serverStorage, &addr_size);
-        if (*newSocket < 0)
-        {
-            perror("accept");
-            free(newSocket);
-            continue;
-        }
+static void unwatch(Player *me)
+{
+    GameSlot *slot = me->watching;
+    if (slot == NULL)
+        return;
 
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, socketThread, newSocket) != 0)
-        {
-            perror("pthread_create");
-            close(*newSocket);
-            free(newSocket);
-            continue;
-        }
+    pthread_mutex_lock(&slot->watch_lock);
+    int i = find_watcher(slot, me);
+    if (i >= 0)
+    {
+        slot->watchers[i] = slot->watchers[--slot->watcher_count];
+        me->watching = NULL;
+    }
+    pthread_mutex_unlock(&slot->watch_lock);
 
-        pthread_detach(thread_id);
+    if (i >= 0)
+        player_put(me);
+}
+
+// Called with lobby_lock held.
+static void index_game(GameSlot *slot)
+{
+    GameSlot **head = &game_index[slot->id % GAME_INDEX_SIZE];
+    slot->next_by_id = *head;
+    *head = slot;
+}
+
+// Called with lobby_lock held.
+static GameSlot *find_game(uint32_t id)
+{
+    for (GameSlot *s = game_index[id % GAME_INDEX_SIZE]; s != NULL; s = s->next_by_id)
+        if (s->id == id)
+            return s;
+    return NULL;
+}
+
+static void free_game_slot(GameSlot *slot)
+{
+    pthread_mutex_lock(&lobby_lock);
+
+    GameSlot **link = &game_index[slot->id % GAME_INDEX_SIZE];
+    while (*link != NULL && *link != slot)
+        link = &(*link)->next_by_id;
+    if (*link != NULL)
+        *link = slot->next_by_id;
+
+    pool_free(&game_pool, slot);
+    pthread_mutex_unlock(&lobby_lock);
+}
+
+// Time the side to move has left. Called with slot->lock held.
+static long long clock_left_ms(const GameSlot *slot)
+{
+    if (slot->clock_stopped)
+        return slot->clock_ms[slot->game.turn];
+    return slot->clock_ms[slot->game.turn] - (now_ns() - slot->turn_start_ns) / 1000000;
+}
+
+// Records the game as it is now. Called with slot->lock held, so the
+// records of one game are in move order.
+static void journal_game(GameSlot *slot, JournalType type)
+{
+    if (journal_path == NULL)
+        return;
+
+    const Game *g = &slot->game;
+    JournalRecord r;
+    memset(&r, 0, sizeof(r));
+    r.type = (uint8_t)type;
+    r.turn = (uint8_t)g->turn;
+    r.cap_square = (int8_t)(g->must_continue_capture ? game_square(g->cap_row, g->cap_col) : -1);
+    r.level = (uint8_t)slot->bot_level;
+    r.game_id = slot->id;
+    r.seq = slot->seq;
+    r.white = g->white;
+    r.black = g->black;
+    r.kings = g->kings;
+    r.quiet_plies = (uint32_t)g->quiet_plies;
+    r.secrets[COLOR_WHITE] = slot->secrets[COLOR_WHITE];
+    r.secrets[COLOR_BLACK] = slot->secrets[COLOR_BLACK];
+    r.clock_ms[COLOR_WHITE] = -1;
+    r.clock_ms[COLOR_BLACK] = -1;
+    if (clock_ms_base != 0)
+    {
+        PlayerColor turn = g->turn;
+        long long left = clock_left_ms(slot);
+        r.clock_ms[turn] = (left > 0) ? left : 0;
+        r.clock_ms[other_color(turn)] = slot->clock_ms[other_color(turn)];
+    }
+
+    // Games that go on unrecorded could not be restored. Stopping leaves
+    // the log as a crash would, with every game in it resumable.
+    if (journal_append(&journal, &r) == 0)
+    {
+        fprintf(stderr, "journal %s: cannot record games any more, stopping\n", journal_path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Random and never 0, which marks a seat nobody can resume. Read from
+// the kernel a batch at a time.
+static uint64_t new_secret(void)
+{
+    static __thread uint64_t cache[32];
+    static __thread int left = 0;
+
+    while (1)
+    {
+        if (left == 0)
+        {
+            if (getrandom(cache, sizeof(cache), 0) != (ssize_t)sizeof(cache))
+            {
+                perror("getrandom");
+                exit(EXIT_FAILURE);
+            }
+            left = 32;
+        }
+        uint64_t v = cache[--left];
+        if (v != 0)
+            return v;
+    }
+}
+
+// Keeps an empty seat for its player until the list's grace time is up.
+// Called with slot->lock held.
+static void park_seat(GameSlot *slot, PlayerColor color, ParkList *list)
+{
+    ParkedSeat *ps = &slot->parked[color];
+
+    pthread_mutex_lock(&park_lock);
+    if (ps->list == NULL)
+    {
+        ps->deadline_ns = now_ns() + list->grace_ns;
+        ps->game_id = slot->id;
+        ps->prev = list->tail;
+        ps->next = NULL;
+        if (list->tail != NULL)
+            list->tail->next = ps;
+        else
+        {
+            list->head = ps;
+            pthread_cond_signal(&park_cond);
+        }
+        list->tail = ps;
+        ps->list = list;
+        parked_count++;
+    }
+    pthread_mutex_unlock(&park_lock);
+}
+
+// Called with park_lock held.
+static void park_unlink(ParkedSeat *ps)
+{
+    ParkList *list = ps->list;
+
+    if (ps->prev != NULL)
+        ps->prev->next = ps->next;
+    else
+        list->head = ps->next;
+    if (ps->next != NULL)
+        ps->next->prev = ps->prev;
+    else
+        list->tail = ps->prev;
+    ps->list = NULL;
+    parked_count--;
+}
+
+// Called with slot->lock held. Only an empty seat that somebody can
+// resume is ever parked, so seated games skip park_lock.
+static void unpark_seat(GameSlot *slot, PlayerColor color)
+{
+    if (slot->seats[color] != NULL || slot->secrets[color] == 0)
+        return;
+
+    pthread_mutex_lock(&park_lock);
+    if (slot->parked[color].list != NULL)
+        park_unlink(&slot->parked[color]);
+    pthread_mutex_unlock(&park_lock);
+}
+
+// Runs the side to move's time only while somebody is there to use it.
+// A parked seat is bound by its grace window instead, so a dropped
+// player cannot lose on time before the window is up. Called with
+// slot->lock held whenever the side to move or its seat changes.
+static void update_clock(GameSlot *slot)
+{
+    if (clock_ms_base == 0)
+        return;
+
+    PlayerColor turn = slot->game.turn;
+    int away = (slot->seats[turn] == NULL && slot->secrets[turn] != 0);
+    if (away && !slot->clock_stopped)
+    {
+        long long left = clock_left_ms(slot);
+        slot->clock_ms[turn] = (left > 0) ? left : 0;
+        slot->clock_stopped = 1;
+        wheel_cancel(&timers, &slot->clock);
+    }
+    else if (!away && slot->clock_stopped)
+    {
+        slot->clock_stopped = 0;
+        slot->turn_start_ns = now_ns();
+        wheel_add(&timers, &slot->clock, slot->clock_ms[turn]);
+    }
+}
+
+// Both sides get the full time; white's starts running once its seat is
+// taken. Called with slot->lock held.
+static void start_clock(GameSlot *slot)
+{
+    if (clock_ms_base == 0)
+        return;
+
+    slot->clock_ms[COLOR_WHITE] = clock_ms_base;
+    slot->clock_ms[COLOR_BLACK] = clock_ms_base;
+    slot->clock_stopped = 1;
+    update_clock(slot);
+}
+
+// After mover's whole move: charges it the time taken, adds the
+// increment and starts the other side's time, once its seat is taken. A
+// move that came in within a tick of the flag falling still counts.
+// Called with slot->lock held.
+static void press_clock(GameSlot *slot, PlayerColor mover)
+{
+    if (clock_ms_base == 0)
+        return;
+
+    long long left = slot->clock_ms[mover] - (now_ns() - slot->turn_start_ns) / 1000000;
+    slot->clock_ms[mover] = ((left > 0) ? left : 0) + clock_ms_increment;
+    slot->clock_stopped = 1;
+    update_clock(slot);
+}
+
+// Ends a running game whose outcome the endgame table already knows.
+// The table knows nothing of the quiet move limit, so under one a won
+// position may take too long to force and is played out; a drawn one
+// stays drawn. Called with slot->lock held.
+static int adjudicate(Game *g)
+{
+    EndgameValue v = endgame_probe(g);
+    if (v == ENDGAME_UNKNOWN || (v != ENDGAME_DRAW && draw_quiet_moves > 0))
+        return 0;
+
+    if (v == ENDGAME_DRAW)
+        g->result = GAME_DRAW;
+    else if ((v == ENDGAME_WIN) == (g->turn == COLOR_WHITE))
+        g->result = GAME_WHITE_WIN;
+    else
+        g->result = GAME_BLACK_WIN;
+    metrics_count(COUNTER_GAMES_ADJUDICATED, 1);
+    return 1;
+}
+
+// Must be called with slot->lock held.
+static void end_game(GameSlot *slot)
+{
+    journal_game(slot, JOURNAL_FINISH);
+    slot->active = 0;
+    wheel_cancel(&timers, &slot->clock);
+    metrics_count(COUNTER_GAMES_FINISHED, 1);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        unpark_seat(slot, (PlayerColor)i);
+        if (slot->seats[i] != NULL)
+            slot->seats[i]->slot = NULL;
+        slot->seats[i] = NULL;
+    }
+}
+
+// Releases slot->lock, then hands msgs to the spectators. watch_lock is
+// taken before the game lock is dropped, so batches reach spectators in
+// move order without the fan-out holding up the game itself.
+static void unlock_and_fan_out(GameSlot *slot, Outbox *ob, const MsgType *msgs, int count, int ended)
+{
+    Player **gone = NULL;
+    int gone_count = 0;
+
+    pthread_mutex_lock(&slot->watch_lock);
+    pthread_mutex_unlock(&slot->lock);
+
+    fan_out(slot, ob, msgs, count);
+    if (ended)
+        gone_count = detach_watchers(slot, &gone);
+
+    pthread_mutex_unlock(&slot->watch_lock);
+
+    put_watchers(gone, gone_count);
+}
+
+static void handle_player_disconnect(Player *me)
+{
+    // A game the pairing thread is starting right now sees gone and
+    // leaves this player out.
+    pthread_mutex_lock(&lobby_lock);
+    mm_cancel(&matchmaker, &me->match);
+    me->gone = 1;
+    pthread_mutex_unlock(&lobby_lock);
+
+    GameSlot *slot = me->slot;
+    if (slot == NULL)
+        return;
+
+    Outbox ob;
+    outbox_init(&ob);
+    int ended = 0;
+
+    pthread_mutex_lock(&slot->lock);
+    if (slot->seats[me->color] == me)
+    {
+        Player *op = slot->seats[other_color(me->color)];
+        if (me->quit || park_grace_sec == 0)
+        {
+            outbox_add(&ob, op, MSG_OPPONENT_LEFT);
+            end_game(slot);
+            ended = 1;
+        }
+        else
+        {
+            // Only the seat is kept: this Player goes back to the pool
+            // and RESUME seats a new one.
+            slot->seats[me->color] = NULL;
+            me->slot = NULL;
+            park_seat(slot, me->color, &dropped_seats);
+            update_clock(slot);
+            outbox_add(&ob, op, MSG_OPPONENT_AWAY);
+        }
+    }
+
+    MsgType spectator_msg = MSG_PLAYER_LEFT;
+    unlock_and_fan_out(slot, &ob, &spectator_msg, ended, ended);
+
+    if (ended)
+        free_game_slot(slot);
+    outbox_flush(&ob);
+}
+
+// Games are pinned to the reactor of the player who joined first, so one
+// thread serves both seats and the game's lock is never contended.
+// Asks p's reactor to hand p over to another. The move is made by the
+// reactor that owns p, between two batches of events, so p's socket is
+// never handled by two threads at once. A player is pinned at most once.
+static void pin_player(Player *p, Reactor *to)
+{
+    Reactor *from = p->reactor;
+    if (from == to || p->pin_to != NULL)
+        return;
+
+    p->pin_to = to;
+    player_get(p); // the inbox's
+    Player *head = atomic_load(&from->inbox);
+    do
+        p->inbox_next = head;
+    while (!atomic_compare_exchange_weak(&from->inbox, &head, p));
+    eventfd_write(from->wake_fd, 1);
+}
+
+// On r's thread, after a batch: moves every player in the inbox to the
+// epoll set of its new reactor. out_lock keeps watch_output from arming
+// EPOLLOUT on the old set halfway through.
+static void hand_over_players(Reactor *r)
+{
+    Player *p = atomic_exchange(&r->inbox, NULL);
+    while (p != NULL)
+    {
+        Player *next = p->inbox_next;
+
+        if (!atomic_load(&p->closed))
+        {
+            pthread_mutex_lock(&p->out_lock);
+            struct epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP | (p->out_armed ? EPOLLOUT : 0);
+            ev.data.ptr = p;
+            epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, p->socket_fd, NULL);
+            p->reactor = p->pin_to;
+            if (epoll_ctl(p->pin_to->epoll_fd, EPOLL_CTL_ADD, p->socket_fd, &ev) < 0)
+            {
+                // Nobody would ever read it again.
+                log_error("epoll_ctl: %s", strerror(errno));
+                shutdown(p->socket_fd, SHUT_RDWR);
+                p->reactor = r;
+                epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, p->socket_fd, &ev);
+            }
+            pthread_mutex_unlock(&p->out_lock);
+            metrics_count(COUNTER_PLAYERS_MOVED, 1);
+        }
+
+        player_put(p);
+        p = next;
+    }
+}
+
+// Called with lobby_lock held on a slot nobody else can see yet. p2 is
+// NULL when p1 plays the bot.
+static void start_game(GameSlot *slot, Player *p1, Player *p2, int bot_level, Outbox *ob)
+{
+    pthread_mutex_lock(&slot->lock);
+
+    game_init(&slot->game);
+    game_history_init(&slot->history, &slot->game);
+    slot->seq = 0;
+    slot->id = next_game_id++;
+    slot->bot_level = bot_level;
+    slot->active = 1;
+    index_game(slot);
+    metrics_count(COUNTER_GAMES_STARTED, 1);
+    outbox_set_board(ob, &slot->game, slot->seq, 0);
+    ob->game_id = slot->id;
+
+    p1->color = COLOR_WHITE;
+    slot->seats[COLOR_WHITE] = p1;
+    slot->seats[COLOR_BLACK] = p2;
+    slot->secrets[COLOR_WHITE] = new_secret();
+    slot->secrets[COLOR_BLACK] = (p2 != NULL) ? new_secret() : 0;
+    p1->slot = slot;
+    p1->session.game_id = slot->id;
+    p1->session.secret = slot->secrets[COLOR_WHITE];
+    if (p2 != NULL)
+    {
+        p2->color = COLOR_BLACK;
+        p2->slot = slot;
+        p2->session.game_id = slot->id;
+        p2->session.secret = slot->secrets[COLOR_BLACK];
+    }
+    start_clock(slot);
+
+    journal_game(slot, JOURNAL_CREATE);
+
+    pthread_mutex_unlock(&slot->lock);
+
+    // Black's batch goes out first: white may move as soon as it has
+    // YOUR_TURN, and black needs the board before it hears of that move.
+    outbox_add(ob, p2, MSG_WELCOME_BLACK);
+    outbox_add(ob, p2, MSG_GAME_ID);
+    outbox_add(ob, p2, MSG_SESSION);
+    outbox_add(ob, p2, MSG_BOARD);
+    outbox_add(ob, p2, MSG_OPP_TURN);
+
+    outbox_add(ob, p1, MSG_WELCOME_WHITE);
+    outbox_add(ob, p1, MSG_GAME_ID);
+    outbox_add(ob, p1, MSG_SESSION);
+    outbox_add(ob, p1, MSG_BOARD);
+    outbox_add(ob, p1, MSG_YOUR_TURN);
+}
+
+// Runs on the pairing thread: seats every pair in a new game, taking
+// lobby_lock once per batch. The queue's references are dropped here or
+// in drop_queued.
+static void start_matched_games(MatchPair *pairs, int count, void *arg)
+{
+    (void)arg;
+
+    Outbox ob[MM_BATCH_MAX];
+    Player *done[2 * MM_BATCH_MAX];
+    Player *rejected[MM_BATCH_MAX];
+    int done_count = 0;
+    int rejected_count = 0;
+
+    pthread_mutex_lock(&lobby_lock);
+
+    for (int i = 0; i < count; ++i)
+    {
+        Player *seat[2] = {player_of(pairs[i].a), player_of(pairs[i].b)};
+        outbox_init(&ob[i]);
+
+        // Someone who left, or resumed a seat, after being picked is let
+        // go, the other one keeps its place in the queue.
+        if (seat[0]->gone || seat[1]->gone || seat[0]->slot != NULL || seat[1]->slot != NULL)
+        {
+            for (int k = 0; k < 2; ++k)
+            {
+                if (seat[k]->gone || seat[k]->slot != NULL)
+                    done[done_count++] = seat[k];
+                else
+                    mm_requeue(&matchmaker, &seat[k]->match);
+            }
+            continue;
+        }
+
+        GameSlot *slot = pool_alloc(&game_pool);
+        if (slot == NULL)
+        {
+            // The later of the two is turned away.
+            outbox_add(&ob[i], seat[1], MSG_SERVER_NO_MORE_GAMES);
+            rejected[rejected_count++] = seat[1];
+            done[done_count++] = seat[1];
+            mm_requeue(&matchmaker, &seat[0]->match);
+            continue;
+        }
+
+        start_game(slot, seat[0], seat[1], 0, &ob[i]);
+        log_info("Game %u: client %d vs client %d", slot->id, seat[0]->id, seat[1]->id);
+        pin_player(seat[1], seat[0]->reactor);
+        done[done_count++] = seat[0];
+        done[done_count++] = seat[1];
+    }
+
+    pthread_mutex_unlock(&lobby_lock);
+
+    for (int i = 0; i < count; ++i)
+        outbox_flush(&ob[i]);
+    for (int i = 0; i < rejected_count; ++i)
+        shutdown(rejected[i]->socket_fd, SHUT_RDWR);
+    for (int i = 0; i < done_count; ++i)
+        player_put(done[i]);
+}
+
+// A player that left the queue before it was paired.
+static void drop_queued(MatchNode *node, void *arg)
+{
+    (void)arg;
+    player_put(player_of(node));
+}
+
+// Bucket by the handshake's round-trip time.
+static int latency_bucket(int sock)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(sock, IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+        return 0;
+
+    if (info.tcpi_rtt < 2000)
+        return 0;
+    if (info.tcpi_rtt < 20000)
+        return 1;
+    if (info.tcpi_rtt < 100000)
+        return 2;
+    return 3;
+}
+
+// Spectators come in on their own port: they are never queued for a
+// game and only follow one after WATCH.
+// With -u, r is the reactor that accepted sock, which keeps it; NULL
+// deals connections out in turn.
+static void accept_client(int sock, int spectator, Reactor *r)
+{
+    log_info("New %s: socket=%d", spectator ? "spectator" : "client", sock);
+
+    if (set_nonblocking(sock) < 0)
+    {
+        log_error("fcntl: %s", strerror(errno));
+        close(sock);
+        return;
+    }
+
+    // Replies already go out as one write per command, so Nagle would only
+    // delay them.
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    int bucket = 0;
+    if (latency_buckets)
+        bucket = latency_bucket(sock);
+
+    pthread_mutex_lock(&lobby_lock);
+
+    Player *me = pool_alloc(&player_pool);
+    if (me == NULL)
+    {
+        pthread_mutex_unlock(&lobby_lock);
+        send(sock, "SERVER_FULL\n", 12, MSG_NOSIGNAL);
+        close(sock);
+        return;
+    }
+
+    me->socket_fd = sock;
+    me->id = next_player_id++;
+    me->color = COLOR_WHITE;
+    me->slot = NULL;
+    me->binary = 0;
+    me->spectator = spectator;
+    me->watching = NULL;
+    me->gone = 0;
+    me->quit = 0;
+    atomic_store(&me->match.state, MM_IDLE);
+    atomic_store(&me->refs, 2); // the reactor's, and ours (the queue's, for players)
+    linebuf_init(&me->in);
+    me->out_len = 0;
+    me->out_armed = 0;
+    atomic_store(&me->last_input_ns, now_ns());
+    atomic_store(&me->closed, 0);
+    me->pin_to = NULL;
+    if (r != NULL)
+        me->reactor = r;
+    else
+    {
+        me->reactor = &reactors[next_reactor];
+        next_reactor = (next_reactor + 1) % reactor_count;
+    }
+
+    pthread_mutex_unlock(&lobby_lock);
+
+    // Before the reactor sees the socket, so it comes ahead of the reply
+    // to anything the client sends straight away.
+    if (!spectator)
+        send_msg(me, MSG_WAITING_FOR_OPPONENT);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = me;
+    if (epoll_ctl(me->reactor->epoll_fd, EPOLL_CTL_ADD, sock, &ev) < 0)
+    {
+        log_error("epoll_ctl: %s", strerror(errno));
+        pthread_mutex_lock(&lobby_lock);
+        pool_free(&player_pool, me);
+        pthread_mutex_unlock(&lobby_lock);
+        close(sock);
+        return;
+    }
+
+    if (idle_timeout_ms > 0)
+    {
+        player_get(me);
+        wheel_add(&timers, &me->idle, idle_timeout_ms);
+    }
+
+    if (spectator)
+    {
+        player_put(me);
+        return;
+    }
+
+    // Our reference passes to the queue.
+    mm_join(&matchmaker, &me->match, bucket);
+}
+
+static void close_player(Player *me)
+{
+    log_info("Client %d disconnected", me->id);
+
+    epoll_ctl(me->reactor->epoll_fd, EPOLL_CTL_DEL, me->socket_fd, NULL);
+
+    if (me->spectator)
+        unwatch(me);
+    else
+        handle_player_disconnect(me);
+
+    // If the idle timer is firing right now, idle_expired drops its
+    // reference instead.
+    atomic_store(&me->closed, 1);
+    if (wheel_cancel(&timers, &me->idle))
+        player_put(me);
+
+    player_put(me);
+}
+
+// On the wheel's thread, with the reference the timer holds. A seated
+// player or a spectator watching a game is never idle; anyone else who
+// sent nothing for idle_timeout_ms is told and cut off, and the reactor
+// closes the connection when it sees the hangup.
+static void idle_expired(Timer *t)
+{
+    Player *p = (Player *)((char *)t - offsetof(Player, idle));
+
+    if (!atomic_load(&p->closed))
+    {
+        long long quiet_ms = (now_ns() - atomic_load_explicit(&p->last_input_ns, memory_order_relaxed)) / 1000000;
+        if (p->slot != NULL || p->watching != NULL)
+            quiet_ms = 0;
+
+        if (quiet_ms >= idle_timeout_ms)
+        {
+            log_info("Client %d idle for %lld s, closing", p->id, quiet_ms / 1000);
+            metrics_count(COUNTER_IDLE_TIMEOUTS, 1);
+            send_msg(p, MSG_IDLE_TIMEOUT);
+            shutdown(p->socket_fd, SHUT_RDWR);
+        }
+        else
+        {
+            wheel_add(&timers, t, idle_timeout_ms - quiet_ms);
+            // close_player may have missed the timer while it was firing.
+            if (!atomic_load(&p->closed) || !wheel_cancel(&timers, t))
+                return;
+        }
+    }
+    player_put(p);
+}
+
+// On the wheel's thread. The timer may be stale: the move that stopped
+// the clock, or the end of the game, can come in while it fires.
+static void clock_ran_out(Timer *t)
+{
+    GameSlot *slot = (GameSlot *)((char *)t - offsetof(GameSlot, clock));
+    Outbox ob;
+    outbox_init(&ob);
+    int ended = 0;
+    MsgType spectator_msg = MSG_WHITE_WINS;
+
+    pthread_mutex_lock(&slot->lock);
+    Game *g = &slot->game;
+    if (slot->active && !game_is_finished(g) && !slot->clock_stopped)
+    {
+        long long left = clock_left_ms(slot);
+        if (left > 0)
+            wheel_add(&timers, t, left);
+        else
+        {
+            PlayerColor loser = g->turn;
+            log_info("Game %u: %s ran out of time", slot->id, (loser == COLOR_WHITE) ? "white" : "black");
+            metrics_count(COUNTER_GAMES_ON_TIME, 1);
+
+            g->result = (loser == COLOR_WHITE) ? GAME_BLACK_WIN : GAME_WHITE_WIN;
+            if (loser == COLOR_WHITE)
+                spectator_msg = MSG_BLACK_WINS;
+            outbox_add(&ob, slot->seats[loser], MSG_YOU_LOSE);
+            outbox_add(&ob, slot->seats[other_color(loser)], MSG_YOU_WIN);
+            end_game(slot);
+            ended = 1;
+        }
+    }
+
+    unlock_and_fan_out(slot, &ob, &spectator_msg, ended, ended);
+
+    if (ended)
+        free_game_slot(slot);
+    outbox_flush(&ob);
+}
+
+static void request_bot_move(GameSlot *slot, uint32_t game_id, uint32_t seq, int level);
+
+// Tells both seats and the spectators about the move that turned before
+// into the current position, played by color. Called with slot->lock
+// held; releases it.
+static void finish_move(GameSlot *slot, PlayerColor color, const Game *before)
+{
+    Outbox ob;
+    outbox_init(&ob);
+
+    Game *g = &slot->game;
+    Player *me = slot->seats[color];
+    Player *op = slot->seats[other_color(color)];
+    metrics_count(COUNTER_MOVES, 1);
+
+    int ended = 0;
+    MsgType spectator_msgs[2] = {MSG_DELTA, MSG_DRAW};
+    int spectator_count = 1;
+
+    outbox_add(&ob, me, MSG_MOVE_OK);
+    outbox_add(&ob, op, MSG_OPPONENT_MOVED);
+
+    slot->seq++;
+    outbox_set_board(&ob, g, slot->seq, game_diff(before, g));
+
+    outbox_add(&ob, me, MSG_DELTA);
+    outbox_add(&ob, op, MSG_DELTA);
+
+    if (game_check_draw(g, &slot->history, draw_quiet_moves * 2))
+    {
+        metrics_count(COUNTER_GAMES_STALLED, 1);
+        log_debug("Game %u: drawn by repetition or the move limit", slot->id);
+    }
+    else if (!game_is_finished(g) && adjudicate(g))
+        log_debug("Game %u: adjudicated from the endgame table", slot->id);
+
+    if (game_is_finished(g))
+    {
+        if (g->result == GAME_WHITE_WIN)
+        {
+            if (color == COLOR_WHITE)
+            {
+                outbox_add(&ob, me, MSG_YOU_WIN);
+                outbox_add(&ob, op, MSG_YOU_LOSE);
+            }
+            else
+            {
+                outbox_add(&ob, me, MSG_YOU_LOSE);
+                outbox_add(&ob, op, MSG_YOU_WIN);
+            }
+        }
+        else if (g->result == GAME_BLACK_WIN)
+        {
+            if (color == COLOR_BLACK)
+            {
+                outbox_add(&ob, me, MSG_YOU_WIN);
+                outbox_add(&ob, op, MSG_YOU_LOSE);
+            }
+            else
+            {
+                outbox_add(&ob, me, MSG_YOU_LOSE);
+                outbox_add(&ob, op, MSG_YOU_WIN);
+            }
+        }
+        else
+        {
+            outbox_add(&ob, me, MSG_DRAW);
+            outbox_add(&ob, op, MSG_DRAW);
+        }
+
+        if (g->result == GAME_WHITE_WIN)
+            spectator_msgs[1] = MSG_WHITE_WINS;
+        else if (g->result == GAME_BLACK_WIN)
+            spectator_msgs[1] = MSG_BLACK_WINS;
+        spectator_count = 2;
+
+        end_game(slot);
+        ended = 1;
+    }
+    else
+    {
+        if (!g->must_continue_capture)
+            press_clock(slot, color);
+
+        journal_game(slot, JOURNAL_MOVE);
+
+        if (g->must_continue_capture)
+        {
+            outbox_add(&ob, me, MSG_YOUR_TURN_CONTINUE_CAPTURE);
+            outbox_add(&ob, op, MSG_OPP_TURN_CAPTURE_CHAIN);
+        }
+        else
+        {
+            outbox_add(&ob, op, MSG_YOUR_TURN);
+            outbox_add(&ob, me, MSG_OPP_TURN);
+        }
+    }
+
+    int bot_turn = !ended && slot->bot_level > 0 && g->turn == BOT_COLOR;
+    uint32_t game_id = slot->id;
+    uint32_t seq = slot->seq;
+    int level = slot->bot_level;
+
+    unlock_and_fan_out(slot, &ob, spectator_msgs, spectator_count, ended);
+
+    if (ended)
+        free_game_slot(slot);
+    outbox_flush(&ob);
+
+    if (bot_turn)
+        request_bot_move(slot, game_id, seq, level);
+}
+
+static void handle_move(Player *me, const Command *cmd)
+{
+    GameSlot *slot = me->slot;
+    if (slot == NULL)
+    {
+        send_msg(me, MSG_ERROR_NOT_IN_GAME);
+        return;
+    }
+
+    pthread_mutex_lock(&slot->lock);
+
+    if (slot->seats[me->color] != me)
+    {
+        pthread_mutex_unlock(&slot->lock);
+        send_msg(me, MSG_ERROR_NOT_IN_GAME);
+        return;
+    }
+
+    Game *g = &slot->game;
+
+    // The turn stays with the capturing side for the whole chain.
+    if (g->turn != me->color)
+    {
+        pthread_mutex_unlock(&slot->lock);
+        send_msg(me, MSG_ERROR_NOT_YOUR_TURN);
+        return;
+    }
+
+    // A path is played on a copy and only kept when every hop is legal.
+    // Hops after the first must carry on the same capture chain.
+    Game after = *g;
+    int legal = 1;
+    long long apply_start = now_ns();
+    for (int i = 0; i + 1 < cmd->path_len && legal; ++i)
+    {
+        if (i > 0 && (after.turn != me->color || !after.must_continue_capture))
+            legal = 0;
+        else
+            legal = game_apply_move(&after, cmd->path[i][0], cmd->path[i][1],
+                                    cmd->path[i + 1][0], cmd->path[i + 1][1]);
+    }
+    metrics_record(HIST_APPLY, (uint64_t)(now_ns() - apply_start));
+
+    if (!legal)
+    {
+        metrics_count(COUNTER_INVALID_MOVES, 1);
+        int must = g->must_continue_capture;
+        pthread_mutex_unlock(&slot->lock);
+
+        MsgType reply[2] = {MSG_MOVE_INVALID, must ? MSG_YOUR_TURN_CONTINUE_CAPTURE : MSG_YOUR_TURN};
+        send_msgs(me, NULL, reply, 2);
+        return;
+    }
+
+    Game before = *g;
+    *g = after;
+    finish_move(slot, me->color, &before);
+}
+
+// The bot's job is stale once its game ended or someone moved.
+static int bot_job_current(const BotJob *bj)
+{
+    const GameSlot *slot = bj->slot;
+    return slot->id == bj->game_id && slot->seq == bj->seq &&
+           slot->seats[other_color(BOT_COLOR)] != NULL && slot->game.turn == BOT_COLOR;
+}
+
+// Runs on a bot worker: searches a copy of the position without holding
+// the game lock, then plays the move if the game is still where it was.
+// A capture chain is searched hop by hop and played as one move.
+static void run_bot_move(Job *job, void *ctx)
+{
+    BotJob *bj = (BotJob *)job;
+    GameSlot *slot = bj->slot;
+    Engine *engine = ctx;
+
+    pthread_mutex_lock(&slot->lock);
+    int current = bot_job_current(bj);
+    Game after = slot->game;
+    pthread_mutex_unlock(&slot->lock);
+
+    int max_depth, time_ms;
+    engine_level_limits(bj->level, &max_depth, &time_ms);
+
+    int hops = 0;
+    while (current && engine != NULL && after.result == GAME_RUNNING &&
+           (hops == 0 || (after.turn == BOT_COLOR && after.must_continue_capture)))
+    {
+        EngineMove m;
+        if (!engine_best_move(engine, &after, max_depth, time_ms, &m, NULL) ||
+            !game_apply_move(&after, m.from_row, m.from_col, m.to_row, m.to_col))
+            break;
+        hops++;
+    }
+
+    if (hops > 0)
+    {
+        pthread_mutex_lock(&slot->lock);
+        if (bot_job_current(bj))
+        {
+            Game before = slot->game;
+            slot->game = after;
+            finish_move(slot, BOT_COLOR, &before);
+        }
+        else
+            pthread_mutex_unlock(&slot->lock);
+    }
+
+    free(bj);
+}
+
+// game_id and seq pin the position the bot answers; the slot may be gone
+// or reused by the time a worker gets to it.
+static void request_bot_move(GameSlot *slot, uint32_t game_id, uint32_t seq, int level)
+{
+    BotJob *bj = malloc(sizeof(BotJob));
+    if (bj == NULL)
+    {
+        log_error("bot move: out of memory");
+        return;
+    }
+
+    bj->slot = slot;
+    bj->game_id = game_id;
+    bj->seq = seq;
+    bj->level = level;
+    bj->job.run = run_bot_move;
+    workers_submit(&bot_pool, &bj->job);
+}
+
+static void handle_play_bot(Player *me, int level)
+{
+    if (me->spectator)
+    {
+        send_msg(me, MSG_ERROR_UNKNOWN_COMMAND);
+        return;
+    }
+
+    if (level < BOT_MIN_LEVEL)
+        level = BOT_MIN_LEVEL;
+    if (level > BOT_MAX_LEVEL)
+        level = BOT_MAX_LEVEL;
+
+    Outbox ob;
+    outbox_init(&ob);
+
+    pthread_mutex_lock(&lobby_lock);
+
+    // Leaving the queue fails once the pairing thread has picked us.
+    if (me->slot != NULL || !mm_cancel(&matchmaker, &me->match))
+    {
+        pthread_mutex_unlock(&lobby_lock);
+        send_msg(me, MSG_ERROR_ALREADY_IN_GAME);
+        return;
+    }
+
+    GameSlot *slot = pool_alloc(&game_pool);
+    if (slot == NULL)
+    {
+        pthread_mutex_unlock(&lobby_lock);
+        send_msg(me, MSG_SERVER_NO_MORE_GAMES);
+        return;
+    }
+
+    start_game(slot, me, NULL, level, &ob);
+    log_info("Game %u: client %d vs bot level %d", slot->id, me->id, level);
+
+    pthread_mutex_unlock(&lobby_lock);
+
+    outbox_flush(&ob);
+}
+
+// The turn message for color in the current position.
+static MsgType turn_msg(const Game *g, PlayerColor color)
+{
+    if (g->turn == color)
+        return g->must_continue_capture ? MSG_YOUR_TURN_CONTINUE_CAPTURE : MSG_YOUR_TURN;
+    return g->must_continue_capture ? MSG_OPP_TURN_CAPTURE_CHAIN : MSG_OPP_TURN;
+}
+
+// Takes me out of a game the pairing thread started for it before its
+// RESUME came in. Only a game nobody has moved in is given up; its
+// opponent goes back to the queue in its old place. Called with
+// lobby_lock held, and the lock of the game being resumed, which is never
+// slot. Returns 0 if the game has started. Otherwise slot is ended, for
+// the caller to free once lobby_lock is released.
+static int leave_fresh_game(Player *me, GameSlot *slot, Outbox *ob)
+{
+    pthread_mutex_lock(&slot->lock);
+    if (!slot->active || slot->seq != 0 || slot->seats[me->color] != me)
+    {
+        pthread_mutex_unlock(&slot->lock);
+        return 0;
+    }
+
+    Player *op = slot->seats[other_color(me->color)];
+    end_game(slot);
+    if (op != NULL && !op->gone)
+    {
+        player_get(op); // the queue's
+        mm_requeue(&matchmaker, &op->match);
+        outbox_add(ob, op, MSG_WAITING_FOR_OPPONENT);
+    }
+    log_info("Game %u: client %d left it to resume another", slot->id, me->id);
+
+    MsgType spectator_msg = MSG_PLAYER_LEFT;
+    unlock_and_fan_out(slot, ob, &spectator_msg, 1, 1);
+    return 1;
+}
+
+// Seats a new connection in the seat its token names, after a dropped
+// connection or a server restart, and sends it what a game start would.
+// A connection still holding the seat is one the client gave up on,
+// e.g. after a network change, and is closed.
+static void handle_resume(Player *me, const SessionToken *t)
+{
+    if (me->spectator)
+    {
+        send_msg(me, MSG_ERROR_UNKNOWN_COMMAND);
+        return;
+    }
+
+    Outbox ob;
+    outbox_init(&ob);
+
+    pthread_mutex_lock(&lobby_lock);
+
+    GameSlot *slot = find_game(t->game_id);
+    int color = -1;
+    if (slot != NULL)
+    {
+        pthread_mutex_lock(&slot->lock);
+        for (int c = COLOR_WHITE; c <= COLOR_BLACK; ++c)
+            if (slot->active && slot->secrets[c] != 0 && slot->secrets[c] == t->secret)
+                color = c;
+        if (color < 0)
+            pthread_mutex_unlock(&slot->lock);
+    }
+
+    if (color < 0)
+    {
+        pthread_mutex_unlock(&lobby_lock);
+        send_msg(me, MSG_ERROR_NO_SUCH_SESSION);
+        return;
+    }
+
+    // A pair the pairing thread picked but has not seated yet is given
+    // up once it finds us seated here, and a game it already started is
+    // left as long as nobody has moved in it.
+    mm_cancel(&matchmaker, &me->match);
+    GameSlot *fresh = me->slot;
+    if (fresh == slot || (fresh != NULL && !leave_fresh_game(me, fresh, &ob)))
+    {
+        pthread_mutex_unlock(&slot->lock);
+        pthread_mutex_unlock(&lobby_lock);
+        send_msg(me, MSG_ERROR_ALREADY_IN_GAME);
+        return;
+    }
+
+    // Its reactor finds the socket shut, and its disconnect no longer
+    // finds it seated.
+    Player *old = slot->seats[color];
+    if (old != NULL)
+    {
+        old->slot = NULL;
+        shutdown(old->socket_fd, SHUT_RDWR);
+        slot->seats[color] = NULL;
+    }
+    unpark_seat(slot, (PlayerColor)color);
+
+    me->color = color;
+    me->slot = slot;
+    me->session = *t;
+    slot->seats[color] = me;
+    update_clock(slot);
+
+    outbox_set_board(&ob, &slot->game, slot->seq, 0);
+    ob.game_id = slot->id;
+    MsgType turn = turn_msg(&slot->game, me->color);
+    PlayerColor op_color = other_color(me->color);
+    int op_away = (slot->seats[op_color] == NULL && slot->secrets[op_color] != 0);
+    if (old == NULL)
+        outbox_add(&ob, slot->seats[op_color], MSG_OPPONENT_BACK);
+    if (slot->seats[op_color] != NULL)
+        pin_player(me, slot->seats[op_color]->reactor);
+
+    int bot_turn = slot->bot_level > 0 && slot->game.turn == BOT_COLOR;
+    uint32_t seq = slot->seq;
+    int level = slot->bot_level;
+
+    pthread_mutex_unlock(&slot->lock);
+    pthread_mutex_unlock(&lobby_lock);
+
+    if (fresh != NULL)
+        free_game_slot(fresh);
+    log_info("Client %d resumed game %u", me->id, t->game_id);
+
+    outbox_add(&ob, me, (me->color == COLOR_WHITE) ? MSG_WELCOME_WHITE : MSG_WELCOME_BLACK);
+    outbox_add(&ob, me, MSG_GAME_ID);
+    outbox_add(&ob, me, MSG_SESSION);
+    outbox_add(&ob, me, MSG_BOARD);
+    outbox_add(&ob, me, turn);
+    if (op_away)
+        outbox_add(&ob, me, MSG_OPPONENT_AWAY);
+    outbox_flush(&ob);
+
+    if (bot_turn)
+        request_bot_move(slot, t->game_id, seq, level);
+}
+
+// Sends a spectator the current board, subscribing it first when
+// subscribe is set. The board is queued under watch_lock, so it lands in
+// the feed exactly between the moves before and after it.
+static void send_spectator_board(Player *me, GameSlot *slot, uint32_t id, int subscribe)
+{
+    Outbox ob;
+    outbox_init(&ob);
+
+    pthread_mutex_lock(&slot->lock);
+    if (!slot->active || (subscribe && slot->id != id))
+    {
+        pthread_mutex_unlock(&slot->lock);
+        send_msg(me, MSG_ERROR_NO_SUCH_GAME);
+        return;
+    }
+    outbox_set_board(&ob, &slot->game, slot->seq, 0);
+
+    pthread_mutex_lock(&slot->watch_lock);
+    pthread_mutex_unlock(&slot->lock);
+
+    int ok;
+    if (subscribe)
+        ok = (add_watcher(slot, me) == 0);
+    else
+        ok = (find_watcher(slot, me) >= 0);
+
+    if (ok)
+    {
+        MsgType reply = MSG_BOARD;
+        send_msgs(me, &ob, &reply, 1);
+    }
+
+    pthread_mutex_unlock(&slot->watch_lock);
+
+    if (!ok)
+        send_msg(me, MSG_ERROR_NO_SUCH_GAME);
+}
+
+static void handle_watch(Player *me, uint32_t id)
+{
+    if (!me->spectator)
+    {
+        send_msg(me, MSG_ERROR_UNKNOWN_COMMAND);
+        return;
+    }
+
+    unwatch(me);
+
+    pthread_mutex_lock(&lobby_lock);
+    GameSlot *slot = find_game(id);
+    pthread_mutex_unlock(&lobby_lock);
+
+    if (slot == NULL)
+    {
+        send_msg(me, MSG_ERROR_NO_SUCH_GAME);
+        return;
+    }
+
+    send_spectator_board(me, slot, id, 1);
+}
+
+// Full position on request, for clients that missed a delta.
+static void handle_board_request(Player *me)
+{
+    if (me->spectator)
+    {
+        GameSlot *watching = me->watching;
+        if (watching == NULL)
+            send_msg(me, MSG_ERROR_NOT_IN_GAME);
+        else
+            send_spectator_board(me, watching, 0, 0);
+        return;
+    }
+
+    GameSlot *slot = me->slot;
+    if (slot == NULL)
+    {
+        send_msg(me, MSG_ERROR_NOT_IN_GAME);
+        return;
+    }
+
+    Outbox ob;
+    outbox_init(&ob);
+
+    pthread_mutex_lock(&slot->lock);
+    int seated = (slot->seats[me->color] == me);
+    if (seated)
+        outbox_set_board(&ob, &slot->game, slot->seq, 0);
+    pthread_mutex_unlock(&slot->lock);
+
+    if (!seated)
+    {
+        send_msg(me, MSG_ERROR_NOT_IN_GAME);
+        return;
+    }
+
+    MsgType reply = MSG_BOARD;
+    send_msgs(me, &ob, &reply, 1);
+}
+
+// Lists the moves of the requester; empty while the opponent is to move.
+static void handle_legal_moves(Player *me)
+{
+    GameSlot *slot = me->slot;
+    if (slot == NULL)
+    {
+        send_msg(me, MSG_ERROR_NOT_IN_GAME);
+        return;
+    }
+
+    Move moves[MOVE_LIST_MAX];
+    int count = 0;
+
+    pthread_mutex_lock(&slot->lock);
+    int seated = (slot->seats[me->color] == me);
+    if (seated && slot->game.turn == me->color)
+        count = game_generate_moves(&slot->game, moves, MOVE_LIST_MAX);
+    pthread_mutex_unlock(&slot->lock);
+
+    if (!seated)
+    {
+        send_msg(me, MSG_ERROR_NOT_IN_GAME);
+        return;
+    }
+
+    char text[MOVES_TEXT_MAX];
+    unsigned char bin[BIN_MOVES_MAX_LEN];
+    Outbox ob;
+    outbox_init(&ob);
+    ob.moves_text = text;
+    ob.moves_text_len = proto_moves_text(moves, count, text, sizeof(text));
+    ob.moves_bin = bin;
+    ob.moves_bin_len = proto_moves_binary(moves, count, bin);
+
+    MsgType reply = MSG_LEGAL_MOVES;
+    send_msgs(me, &ob, &reply, 1);
+}
+
+// Returns -1 when the connection should be closed.
+static int handle_command(Player *me, const Command *cmd)
+{
+    metrics_count(COUNTER_COMMANDS, 1);
+
+    switch (cmd->type)
+    {
+    case CMD_QUIT:
+        me->quit = 1;
+        return -1;
+    case CMD_PROTOCOL_ERROR:
+        log_info("Client %d sent a frame that cannot be parsed", me->id);
+        return -1;
+    case CMD_MOVE:
+        handle_move(me, cmd);
+        break;
+    case CMD_BAD_FORMAT:
+    {
+        MsgType reply[2] = {MSG_ERROR_BAD_FORMAT, MSG_YOUR_TURN};
+        send_msgs(me, NULL, reply, 2);
+        break;
+    }
+    case CMD_BINARY:
+        send_msg(me, MSG_BINARY_OK);
+        break;
+    case CMD_BOARD:
+        handle_board_request(me);
+        break;
+    case CMD_WATCH:
+        handle_watch(me, cmd->game_id);
+        break;
+    case CMD_PLAY_BOT:
+        handle_play_bot(me, cmd->level);
+        break;
+    case CMD_LEGAL_MOVES:
+        handle_legal_moves(me);
+        break;
+    case CMD_RESUME:
+        handle_resume(me, &cmd->session);
+        break;
+    default:
+        send_msg(me, MSG_ERROR_UNKNOWN_COMMAND);
+        break;
+    }
+
+    return 0;
+}
+
+// Reads whatever is available with a single recv and handles every
+// complete line or frame buffered so far, so pipelined commands cost one
+// syscall. Returns -1 when the connection should be closed.
+static int handle_readable(Player *me)
+{
+    long long start = now_ns();
+    ssize_t n = linebuf_fill(&me->in, me->socket_fd);
+    metrics_record(HIST_RECV, (uint64_t)(now_ns() - start));
+    metrics_count(COUNTER_RECV_CALLS, 1);
+    if (n > 0)
+    {
+        metrics_count(COUNTER_BYTES_IN, (uint64_t)n);
+        atomic_store_explicit(&me->last_input_ns, start, memory_order_relaxed);
+    }
+    if (n == 0)
+        return -1;
+    if (n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+    Command cmd;
+    while (1)
+    {
+        // Checked for every command: the bytes after a BINARY line are
+        // already frames.
+        long long parse_start = now_ns();
+        if (me->binary)
+        {
+            unsigned char frame[BIN_FRAME_MAX];
+            size_t avail = linebuf_peek(&me->in, frame, sizeof(frame));
+            size_t used = proto_parse_binary(frame, avail, &cmd);
+            if (used == 0)
+                break;
+            linebuf_consume(&me->in, used);
+        }
+        else
+        {
+            char line[LINE_MAX_LEN + 1];
+            if (linebuf_next_line(&me->in, line, sizeof(line)) < 0)
+                break;
+            log_debug("Client %d sent: %s", me->id, line);
+            parse_start = now_ns();
+            proto_parse_text(line, &cmd);
+        }
+        metrics_record(HIST_PARSE, (uint64_t)(now_ns() - parse_start));
+
+        if (handle_command(me, &cmd) < 0)
+            return -1;
+        if (cmd.type == CMD_MOVE)
+            metrics_record(HIST_MOVE, (uint64_t)(now_ns() - parse_start));
+    }
+
+    return 0;
+}
+
+static void print_stats(void)
+{
+    unsigned long recvs = metrics_total(COUNTER_RECV_CALLS);
+    unsigned long sends = metrics_total(COUNTER_SEND_CALLS);
+    unsigned long cmds = metrics_total(COUNTER_COMMANDS);
+    double per_cmd = cmds ? (double)(recvs + sends) / (double)cmds : 0.0;
+
+    printf("stats: commands=%lu recv_calls=%lu send_calls=%lu syscalls_per_command=%.2f\n",
+           cmds, recvs, sends, per_cmd);
+    mm_report(&matchmaker, stdout);
+    pthread_mutex_lock(&park_lock);
+    printf("parked seats: %d\n", parked_count);
+    pthread_mutex_unlock(&park_lock);
+    if (journal_path != NULL)
+        journal_report(&journal, stdout);
+    fflush(stdout);
+}
+
+// What the admin port serves besides the counters and latencies.
+static void write_gauges(FILE *out)
+{
+    pthread_mutex_lock(&lobby_lock);
+    size_t players = player_pool.live;
+    size_t games = game_pool.live;
+    pthread_mutex_unlock(&lobby_lock);
+
+    pthread_mutex_lock(&park_lock);
+    int parked = parked_count;
+    pthread_mutex_unlock(&park_lock);
+
+    fprintf(out, "# HELP checkers_players Connected players and spectators.\n");
+    fprintf(out, "# TYPE checkers_players gauge\n");
+    fprintf(out, "checkers_players %zu\n", players);
+    fprintf(out, "# HELP checkers_games Games running, parked ones included.\n");
+    fprintf(out, "# TYPE checkers_games gauge\n");
+    fprintf(out, "checkers_games %zu\n", games);
+    fprintf(out, "# HELP checkers_parked_seats Seats kept for players who are away.\n");
+    fprintf(out, "# TYPE checkers_parked_seats gauge\n");
+    fprintf(out, "checkers_parked_seats %d\n", parked);
+    fprintf(out, "# HELP checkers_log_dropped_total Log lines dropped by the rate limit or a full ring.\n");
+    fprintf(out, "# TYPE checkers_log_dropped_total counter\n");
+    fprintf(out, "checkers_log_dropped_total %lu\n", log_dropped());
+}
+
+// Writes the feeds of the spectators that fan_out handed to this reactor.
+static void write_ready_feeds(Reactor *r)
+{
+    eventfd_t count;
+    eventfd_read(r->wake_fd, &count);
+
+    pthread_mutex_lock(&r->ready_lock);
+    Player *p = r->ready;
+    r->ready = NULL;
+    pthread_mutex_unlock(&r->ready_lock);
+
+    while (p != NULL)
+    {
+        Player *next = p->ready_next;
+
+        pthread_mutex_lock(&p->out_lock);
+        p->feed_ready = 0;
+        if (!p->out_armed)
+            drain_feed(p);
+        pthread_mutex_unlock(&p->out_lock);
+
+        player_put(p);
+        p = next;
+    }
+}
+
+// A reactor's own listener is readable: takes what is queued on it, at
+// most a batch so the players already connected are not held up.
+static void accept_burst(Reactor *r, int listen_fd, int spectator)
+{
+    for (int i = 0; i < EPOLL_BATCH; ++i)
+    {
+        long long start = now_ns();
+        int sock = accept(listen_fd, NULL, NULL);
+        if (sock < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                log_error("accept: %s", strerror(errno));
+            return;
+        }
+
+        accept_client(sock, spectator, r);
+        metrics_record(HIST_ACCEPT, (uint64_t)(now_ns() - start));
+        metrics_count(COUNTER_ACCEPTS, 1);
+    }
+}
+
+void *reactorThread(void *arg)
+{
+    Reactor *reactor = arg;
+    int epfd = reactor->epoll_fd;
+    int reports_stats = (stats_interval > 0 && reactor == &reactors[0]);
+    time_t next_report = time(NULL) + stats_interval;
+    struct epoll_event events[EPOLL_BATCH];
+
+    while (1)
+    {
+        int n = epoll_wait(epfd, events, EPOLL_BATCH, reports_stats ? 1000 : -1);
+
+        if (reports_stats && time(NULL) >= next_report)
+        {
+            print_stats();
+            next_report = time(NULL) + stats_interval;
+        }
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            log_error("epoll_wait: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            Player *p = events[i].data.ptr;
+            uint32_t ev = events[i].events;
+
+            if (p == NULL)
+            {
+                write_ready_feeds(reactor);
+                continue;
+            }
+            if (events[i].data.ptr == &reactor->listen_fd || events[i].data.ptr == &reactor->watch_listen_fd)
+            {
+                accept_burst(reactor, *(int *)events[i].data.ptr, events[i].data.ptr == &reactor->watch_listen_fd);
+                continue;
+            }
+
+            if ((ev & EPOLLOUT) && flush_output(p) < 0)
+            {
+                close_player(p);
+                continue;
+            }
+
+            if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            {
+                if (handle_readable(p) < 0)
+                    close_player(p);
+            }
+        }
+
+        if (atomic_load_explicit(&reactor->inbox, memory_order_relaxed) != NULL)
+            hand_over_players(reactor);
+    }
+
+    pthread_exit(NULL);
+}
+
+static void init_player(void *item)
+{
+    Player *p = item;
+    p->slot = NULL;
+    p->out_buf = NULL;
+    p->out_len = 0;
+    p->out_cap = 0;
+    p->watching = NULL;
+    p->feed_head = 0;
+    p->feed_count = 0;
+    p->feed_off = 0;
+    p->feed_ready = 0;
+    timer_init(&p->idle, idle_expired);
+    pthread_mutex_init(&p->out_lock, NULL);
+}
+
+static void init_game_slot(void *item)
+{
+    GameSlot *slot = item;
+    slot->seats[COLOR_WHITE] = NULL;
+    slot->seats[COLOR_BLACK] = NULL;
+    slot->watchers = NULL;
+    slot->watcher_count = 0;
+    slot->watcher_cap = 0;
+    slot->bot_level = 0;
+    slot->active = 0;
+    slot->secrets[COLOR_WHITE] = 0;
+    slot->secrets[COLOR_BLACK] = 0;
+    for (int c = COLOR_WHITE; c <= COLOR_BLACK; ++c)
+    {
+        slot->parked[c].list = NULL;
+        slot->parked[c].slot = slot;
+        slot->parked[c].color = (PlayerColor)c;
+    }
+    timer_init(&slot->clock, clock_ran_out);
+    pthread_mutex_init(&slot->lock, NULL);
+    pthread_mutex_init(&slot->watch_lock, NULL);
+}
+
+// Rebuilds the running games from the journal, one record at a time.
+// Runs before any client is accepted.
+static void restore_record(const JournalRecord *r, void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&lobby_lock);
+    if (r->game_id >= next_game_id)
+        next_game_id = r->game_id + 1;
+    GameSlot *slot = find_game(r->game_id);
+    pthread_mutex_unlock(&lobby_lock);
+
+    if (r->type == JOURNAL_FINISH)
+    {
+        if (slot != NULL)
+            free_game_slot(slot);
+        return;
+    }
+
+    if (slot == NULL)
+    {
+        if (r->type != JOURNAL_CREATE)
+            return;
+
+        pthread_mutex_lock(&lobby_lock);
+        slot = pool_alloc(&game_pool);
+        if (slot != NULL)
+        {
+            slot->id = r->game_id;
+            index_game(slot);
+        }
+        pthread_mutex_unlock(&lobby_lock);
+        if (slot == NULL)
+        {
+            fprintf(stderr, "journal: no room to restore game %u\n", r->game_id);
+            return;
+        }
+    }
+
+    if (r->type == JOURNAL_CREATE)
+    {
+        slot->bot_level = r->level;
+        slot->secrets[COLOR_WHITE] = r->secrets[COLOR_WHITE];
+        slot->secrets[COLOR_BLACK] = r->secrets[COLOR_BLACK];
+        slot->active = 1;
+    }
+    game_set_position(&slot->game, r->white, r->black, r->kings,
+                      r->turn == COLOR_BLACK ? COLOR_BLACK : COLOR_WHITE, r->cap_square);
+    slot->game.quiet_plies = (int)r->quiet_plies;
+    game_history_init(&slot->history, &slot->game);
+    slot->seq = r->seq;
+    // A game journaled without clocks gets the full time, as a new one would.
+    for (int c = COLOR_WHITE; c <= COLOR_BLACK; ++c)
+        slot->clock_ms[c] = (r->clock_ms[c] >= 0) ? r->clock_ms[c] : clock_ms_base;
+    slot->clock_stopped = 1;
+}
+
+// Replays the journal, then starts a fresh one holding only the games
+// that are still running. Returns how many of them there are.
+static int restore_games(void)
+{
+    JournalDamage damage;
+    long records = journal_replay(journal_path, restore_record, NULL, &damage);
+    if (records < 0)
+    {
+        fprintf(stderr, "journal %s: cannot read it\n", journal_path);
+        exit(EXIT_FAILURE);
+    }
+
+    // The new log replaces the old one, so a corrupt log is kept for
+    // whoever has to look at it rather than cut short for good.
+    if (damage.skipped > 0)
+    {
+        fprintf(stderr, "journal %s: record %ld is damaged and %ld intact ones follow it; "
+                        "move the log aside to start without them\n",
+                journal_path, records + 1, damage.skipped);
+        exit(EXIT_FAILURE);
+    }
+    if (damage.damaged > 0 || damage.torn_bytes > 0)
+        fprintf(stderr, "journal %s: dropped the last %zu bytes, damaged by an unclean stop\n", journal_path,
+                (size_t)damage.damaged * sizeof(JournalRecord) + damage.torn_bytes);
+
+    if (journal_open(&journal, journal_path) < 0)
+    {
+        perror("journal");
+        exit(EXIT_FAILURE);
+    }
+
+    // Nobody is seated yet, so every seat a player can resume waits for
+    // its player, with its clock stopped at the journaled time.
+    int games = 0;
+    for (int i = 0; i < GAME_INDEX_SIZE; ++i)
+        for (GameSlot *slot = game_index[i]; slot != NULL; slot = slot->next_by_id)
+        {
+            pthread_mutex_lock(&slot->lock);
+            journal_game(slot, JOURNAL_CREATE);
+            update_clock(slot);
+            pthread_mutex_unlock(&slot->lock);
+            for (int c = COLOR_WHITE; c <= COLOR_BLACK; ++c)
+                if (slot->secrets[c] != 0)
+                    park_seat(slot, (PlayerColor)c, &restored_seats);
+            games++;
+        }
+
+    if (journal_start(&journal) < 0)
+    {
+        perror("journal");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Journal %s: %ld records, %d games restored\n", journal_path, records, games);
+    return games;
+}
+
+// A parked seat nobody took back in time: the game ends as if its player
+// had left.
+static void expire_seat(GameSlot *slot, uint32_t game_id, PlayerColor color)
+{
+    Outbox ob;
+    outbox_init(&ob);
+    int ended = 0;
+
+    pthread_mutex_lock(&slot->lock);
+    // Since it was unlinked, the seat may have been resumed, or resumed
+    // and parked again.
+    if (slot->active && slot->id == game_id && slot->seats[color] == NULL && slot->parked[color].list == NULL)
+    {
+        log_info("Game %u: %s did not come back", game_id, (color == COLOR_WHITE) ? "white" : "black");
+        outbox_add(&ob, slot->seats[other_color(color)], MSG_OPPONENT_LEFT);
+        end_game(slot);
+        ended = 1;
+    }
+
+    MsgType spectator_msg = MSG_PLAYER_LEFT;
+    unlock_and_fan_out(slot, &ob, &spectator_msg, ended, ended);
+
+    if (ended)
+        free_game_slot(slot);
+    outbox_flush(&ob);
+}
+
+// Sleeps until the oldest parked seat is due. Parked seats cost this one
+// thread between them, however many there are.
+static void *expire_parked(void *arg)
+{
+    (void)arg;
+    ParkList *lists[2] = {&dropped_seats, &restored_seats};
+
+    pthread_mutex_lock(&park_lock);
+    while (1)
+    {
+        long long now = now_ns();
+        long long next = LLONG_MAX;
+        ParkedSeat *due = NULL;
+        for (int i = 0; i < 2 && due == NULL; ++i)
+        {
+            ParkedSeat *ps = lists[i]->head;
+            if (ps == NULL)
+                continue;
+            if (ps->deadline_ns <= now)
+                due = ps;
+            else if (ps->deadline_ns < next)
+                next = ps->deadline_ns;
+        }
+
+        if (due == NULL)
+        {
+            if (next == LLONG_MAX)
+                pthread_cond_wait(&park_cond, &park_lock);
+            else
+            {
+                struct timespec ts = {.tv_sec = next / 1000000000ll, .tv_nsec = next % 1000000000ll};
+                pthread_cond_timedwait(&park_cond, &park_lock, &ts);
+            }
+            continue;
+        }
+
+        GameSlot *slot = due->slot;
+        uint32_t game_id = due->game_id;
+        PlayerColor color = due->color;
+        park_unlink(due);
+
+        pthread_mutex_unlock(&park_lock);
+        expire_seat(slot, game_id, color);
+        pthread_mutex_lock(&park_lock);
+    }
+
+    return NULL;
+}
+
+static void reply_and_close(int fd, const char *text, size_t len)
+{
+    send(fd, text, len, MSG_NOSIGNAL);
+    close(fd);
+}
+
+static void run_analysis(Job *job, void *ctx)
+{
+    (void)ctx;
+    AnalyzeJob *aj = (AnalyzeJob *)job;
+
+    long long start = now_ns();
+    Move best;
+    EngineStats stats;
+    int found = analyzer_run(analyzer, &aj->game, aj->depth, ANALYZE_TIME_MS, &best, &stats);
+    long ms = (long)((now_ns() - start) / 1000000);
+
+    char reply[ANALYSIS_TEXT_MAX];
+    size_t len = proto_analysis_text(found ? &best : NULL, stats.score, stats.depth, stats.nodes, ms,
+                                     reply, sizeof(reply));
+    log_info("Analysis to depth %d: %ld nodes in %ld ms", stats.depth, stats.nodes, ms);
+    reply_and_close(aj->fd, reply, len);
+    free(aj);
+}
+
+// "ANALYZE <64 cells> <depth> [white|black]" on the admin port, white to
+// move unless told otherwise. Only the admin port takes it, as it would
+// play a game for whoever asked.
+static void admin_command(int client, const char *line)
+{
+    char cells[BOARD_SIZE * BOARD_SIZE + 2];
+    char side[8] = "white";
+    int depth = 0;
+
+    if (strncmp(line, "ANALYZE ", 8) != 0)
+    {
+        const char *text = proto_text(MSG_ERROR_UNKNOWN_COMMAND);
+        reply_and_close(client, text, strlen(text));
+        return;
+    }
+
+    AnalyzeJob *aj = malloc(sizeof(AnalyzeJob));
+    int fields = sscanf(line + 8, "%65s %d %7s", cells, &depth, side);
+    int black = (strcmp(side, "black") == 0);
+    if (aj == NULL || fields < 2 || depth < 1 || depth > ANALYZE_MAX_DEPTH ||
+        (!black && strcmp(side, "white") != 0) ||
+        proto_parse_board(cells, black ? COLOR_BLACK : COLOR_WHITE, &aj->game) < 0)
+    {
+        free(aj);
+        const char *text = proto_text(MSG_ERROR_BAD_FORMAT);
+        reply_and_close(client, text, strlen(text));
+        return;
+    }
+
+    aj->fd = client;
+    aj->depth = depth;
+    aj->job.run = run_analysis;
+    workers_submit(&analyze_pool, &aj->job);
+}
+
+// Each bot worker searches with its own engine.
+static void *make_bot_engine(void)
+{
+    Engine *e = engine_new(BOT_TT_BITS);
+    if (e == NULL)
+        fprintf(stderr, "bot engine: out of memory\n");
+    return e;
+}
+
+// With shared set, SO_REUSEPORT lets every reactor bind a listener of
+// its own to the port.
+static int open_listener(int port, int shared)
+{
+    struct sockaddr_in serverAddr;
+
+    int serverSocket = socket(PF_INET, SOCK_STREAM, 0);
+    if (serverSocket < 0)
+    {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+
+    // A restarted server gets its port back while the old connections
+    // are still in TIME_WAIT.
+    int one = 1;
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (shared && (setsockopt(serverSocket, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0 ||
+                   set_nonblocking(serverSocket) < 0))
+    {
+        perror("SO_REUSEPORT");
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    serverAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+    memset(serverAddr.sin_zero, '\0', sizeof serverAddr.sin_zero);
+
+    if (bind(serverSocket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0)
+    {
+        perror("bind");
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    if (listen(serverSocket, SOMAXCONN) != 0)
+    {
+        perror("listen");
+        close(serverSocket);
+        exit(EXIT_FAILURE);
+    }
+
+    return serverSocket;
+}
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_storage serverStorage;
+    socklen_t addr_size;
+    int port = PORT;
+    int watch_port = -1;
+    int memory_mb = DEFAULT_MEMORY_MB;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:w:r:s:m:b:luj:g:a:n:e:d:t:i:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'w':
+            watch_port = atoi(optarg);
+            break;
+        case 'r':
+            reactor_count = atoi(optarg);
+            break;
+        case 's':
+            stats_interval = atoi(optarg);
+            break;
+        case 'm':
+            memory_mb = atoi(optarg);
+            break;
+        case 'b':
+            bot_threads = atoi(optarg);
+            break;
+        case 'l':
+            latency_buckets = 1;
+            break;
+        case 'u':
+            reuseport = 1;
+            break;
+        case 'j':
+            journal_path = optarg;
+            break;
+        case 'g':
+            park_grace_sec = atoi(optarg);
+            break;
+        case 'a':
+            admin_port = atoi(optarg);
+            break;
+        case 'n':
+            analyze_threads = atoi(optarg);
+            break;
+        case 'e':
+            endgame_path = optarg;
+            break;
+        case 'd':
+            draw_quiet_moves = atoi(optarg);
+            break;
+        case 't':
+        {
+            // seconds, or seconds+increment
+            const char *plus = strchr(optarg, '+');
+            clock_ms_base = atoll(optarg) * 1000;
+            clock_ms_increment = (plus != NULL) ? atoll(plus + 1) * 1000 : 0;
+            break;
+        }
+        case 'i':
+            idle_timeout_ms = atoll(optarg) * 1000;
+            break;
+        case 'v':
+            if (log_threshold < LOG_DEBUG)
+                log_threshold++;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-p port] [-w spectator_port] [-r reactor_threads] [-s stats_seconds] [-m memory_mb] [-b bot_threads] [-l] [-u] [-j journal] [-g grace_seconds] [-a admin_port] [-n analyze_threads] [-e endgame_table] [-d draw_moves] [-t clock_seconds[+increment]] [-i idle_seconds] [-v[v]]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (reactor_count < 1 || reactor_count > MAX_REACTORS)
+    {
+        fprintf(stderr, "reactor threads must be between 1 and %d\n", MAX_REACTORS);
+        exit(EXIT_FAILURE);
+    }
+    if (memory_mb < 1)
+    {
+        fprintf(stderr, "memory budget must be at least 1 MB\n");
+        exit(EXIT_FAILURE);
+    }
+    if (bot_threads < 1)
+    {
+        fprintf(stderr, "bot threads must be at least 1\n");
+        exit(EXIT_FAILURE);
+    }
+    if (analyze_threads < 0)
+    {
+        fprintf(stderr, "analyze threads must not be negative\n");
+        exit(EXIT_FAILURE);
+    }
+    if (clock_ms_base < 0 || clock_ms_increment < 0 || idle_timeout_ms < 0)
+    {
+        fprintf(stderr, "clock and idle seconds must not be negative\n");
+        exit(EXIT_FAILURE);
+    }
+    if (draw_quiet_moves < 0)
+    {
+        fprintf(stderr, "draw moves must not be negative\n");
+        exit(EXIT_FAILURE);
+    }
+    if (park_grace_sec < 0)
+    {
+        fprintf(stderr, "grace seconds must not be negative\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (log_start(stdout, LOG_LINES_PER_SEC) < 0)
+    {
+        fprintf(stderr, "could not start the log writer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (endgame_path != NULL)
+    {
+        if (endgame_open(endgame_path) < 0)
+        {
+            perror(endgame_path);
+            exit(EXIT_FAILURE);
+        }
+        printf("Adjudicating %s of up to %d pieces from %s\n", draw_quiet_moves > 0 ? "draws" : "games",
+               endgame_max_pieces(), endgame_path);
+    }
+
+    pool_init(&player_pool, sizeof(Player), POOL_CHUNK, 0, init_player);
+    pool_init(&game_pool, sizeof(GameSlot), POOL_CHUNK, 0, init_game_slot);
+
+    if (watch_port < 0)
+        watch_port = port + 1;
+
+    if (workers_start(&bot_pool, bot_threads, make_bot_engine) < 0)
+    {
+        fprintf(stderr, "could not start bot threads\n");
+        exit(EXIT_FAILURE);
+    }
+    if (mm_start(&matchmaker, MATCH_WIDEN_MS, start_matched_games, drop_queued, NULL) < 0)
+    {
+        fprintf(stderr, "could not start the pairing thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct pollfd listeners[2];
+    if (!reuseport)
+    {
+        listeners[0].fd = open_listener(port, 0);
+        listeners[0].events = POLLIN;
+        listeners[1].fd = open_listener(watch_port, 0);
+        listeners[1].events = POLLIN;
+        printf("Listening on port %d, spectators on port %d\n", port, watch_port);
+    }
+    else
+        printf("Listening on port %d, spectators on port %d, on every reactor\n", port, watch_port);
+    if (admin_port >= 0)
+    {
+        if (analyze_threads == 0)
+            analyze_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        analyzer = analyzer_new(analyze_threads, ANALYZE_TT_BITS);
+        if (analyzer == NULL || workers_start(&analyze_pool, 1, NULL) < 0)
+        {
+            fprintf(stderr, "could not start the analysis threads\n");
+            exit(EXIT_FAILURE);
+        }
+        if (metrics_serve(admin_port, write_gauges, admin_command) < 0)
+        {
+            perror("admin port");
+            exit(EXIT_FAILURE);
+        }
+        printf("Metrics on http://127.0.0.1:%d/metrics, ANALYZE with %d threads\n", admin_port,
+               analyzer_threads(analyzer));
+    }
+
+    // Every player costs its own entry plus half a game slot.
+    size_t per_player = player_pool.stride + game_pool.stride / 2;
+    size_t max_players = (size_t)memory_mb * 1024 * 1024 / per_player;
+    player_pool.max_items = max_players;
+    game_pool.max_items = max_players / 2 + 1;
+    printf("Memory budget %d MB: up to %zu players\n", memory_mb, max_players);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&park_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    dropped_seats.grace_ns = park_grace_sec * 1000000000ll;
+    restored_seats.grace_ns = RESTORE_GRACE_SEC * 1000000000ll;
+
+    if (wheel_start(&timers, TIMER_TICK_MS) < 0)
+    {
+        fprintf(stderr, "could not start the timer thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (journal_path != NULL)
+        restore_games();
+
+    pthread_t expire_thread;
+    if (pthread_create(&expire_thread, NULL, expire_parked, NULL) != 0)
+    {
+        fprintf(stderr, "could not start the parked seat thread\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_detach(expire_thread);
+
+    for (int i = 0; i < reactor_count; ++i)
+    {
+        Reactor *r = &reactors[i];
+        r->epoll_fd = epoll_create1(0);
+        r->wake_fd = eventfd(0, EFD_NONBLOCK);
+        if (r->epoll_fd < 0 || r->wake_fd < 0)
+        {
+            perror("epoll_create1");
+            exit(EXIT_FAILURE);
+        }
+        pthread_mutex_init(&r->ready_lock, NULL);
+        r->ready = NULL;
+        atomic_init(&r->inbox, NULL);
+        r->listen_fd = -1;
+        r->watch_listen_fd = -1;
+
+        // data.ptr NULL marks the wakeup, pointers to the listener fields
+        // the listeners, and every other event is a Player.
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->wake_fd, &ev);
+
+        if (reuseport)
+        {
+            r->listen_fd = open_listener(port, 1);
+            ev.data.ptr = &r->listen_fd;
+            epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->listen_fd, &ev);
+            r->watch_listen_fd = open_listener(watch_port, 1);
+            ev.data.ptr = &r->watch_listen_fd;
+            epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, r->watch_listen_fd, &ev);
+        }
+
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, reactorThread, r) != 0)
+        {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+        pthread_detach(thread_id);
+    }
+
+    // The reactors do all the accepting.
+    if (reuseport)
+        while (1)
+            pause();
+
+    while (1)
+    {
+        if (poll(listeners, 2, -1) < 0)
+        {
+            if (errno != EINTR)
+                log_error("poll: %s", strerror(errno));
+            continue;
+        }
+
+        for (int i = 0; i < 2; ++i)
+        {
+            if (!(listeners[i].revents & POLLIN))
+                continue;
+
+            long long start = now_ns();
+            addr_size = sizeof serverStorage;
+            int newSocket = accept(listeners[i].fd, (struct sockaddr *)&serverStorage, &addr_size);
+            if (newSocket < 0)
+            {
+                log_error("accept: %s", strerror(errno));
+                continue;
+            }
+
+            accept_client(newSocket, i == 1, NULL);
+            metrics_record(HIST_ACCEPT, (uint64_t)(now_ns() - start));
+            metrics_count(COUNTER_ACCEPTS, 1);
+        }
     }
 
-    close(serverSocket);
+    close(listeners[0].fd);
+    close(listeners[1].fd);
     return 0;
 }
@@ -0,0 +1,231 @@
+#include "taskpool.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+#define DEQUE_SIZE 1024 // tasks per thread, a power of two
+
+// Chase-Lev: the owner pushes and takes at bottom, thieves take at top.
+typedef struct
+{
+    _Atomic long top;
+    char pad0[64 - sizeof(long)];
+    _Atomic long bottom;
+    char pad1[64 - sizeof(long)];
+    _Atomic(Task *) tasks[DEQUE_SIZE];
+} Deque;
+
+typedef struct
+{
+    TaskPool *pool;
+    int index;
+} WorkerArg;
+
+struct TaskPool
+{
+    int threads;
+    Deque *deques;
+    WorkerArg *args;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // a run has started
+    pthread_cond_t done; // and its root has returned
+    unsigned long run_id; // under lock, counts runs started
+    int root_done;
+
+    // Set for the length of a run, during which idle threads keep looking
+    // for work instead of sleeping.
+    _Atomic int running;
+    _Atomic(Task *) root; // taken by whichever thread gets to it first
+};
+
+static int deque_push(Deque *d, Task *t)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - top >= DEQUE_SIZE)
+        return -1;
+
+    atomic_store_explicit(&d->tasks[b & (DEQUE_SIZE - 1)], t, memory_order_relaxed);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+    return 0;
+}
+
+static Task *deque_take(Deque *d)
+{
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long top = atomic_load_explicit(&d->top, memory_order_relaxed);
+
+    if (top > b)
+    {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+
+    Task *t = atomic_load_explicit(&d->tasks[b & (DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (top == b)
+    {
+        // The last task: a thief may be after it too.
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst,
+                                                     memory_order_relaxed))
+            t = NULL;
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return t;
+}
+
+static Task *deque_steal(Deque *d)
+{
+    long top = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (top >= b)
+        return NULL;
+
+    Task *t = atomic_load_explicit(&d->tasks[top & (DEQUE_SIZE - 1)], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed))
+        return NULL;
+    return t;
+}
+
+// Tries every other thread's deque once, starting after this one's.
+static Task *steal_any(TaskPool *p, int worker)
+{
+    for (int i = 1; i < p->threads; ++i)
+    {
+        Task *t = deque_steal(&p->deques[(worker + i) % p->threads]);
+        if (t != NULL)
+            return t;
+    }
+    return NULL;
+}
+
+static Task *find_task(TaskPool *p, int worker)
+{
+    Task *t = deque_take(&p->deques[worker]);
+    if (t == NULL)
+        t = steal_any(p, worker);
+    return t;
+}
+
+static void *worker_thread(void *arg)
+{
+    WorkerArg *wa = arg;
+    TaskPool *p = wa->pool;
+    int me = wa->index;
+    unsigned long seen = 0;
+
+    while (1)
+    {
+        pthread_mutex_lock(&p->lock);
+        while (p->run_id == seen)
+            pthread_cond_wait(&p->wake, &p->lock);
+        seen = p->run_id;
+        pthread_mutex_unlock(&p->lock);
+
+        while (atomic_load_explicit(&p->running, memory_order_acquire))
+        {
+            Task *root = atomic_exchange_explicit(&p->root, NULL, memory_order_acquire);
+            if (root != NULL)
+            {
+                root->run(root, me);
+
+                pthread_mutex_lock(&p->lock);
+                atomic_store_explicit(&p->running, 0, memory_order_release);
+                p->root_done = 1;
+                pthread_cond_signal(&p->done);
+                pthread_mutex_unlock(&p->lock);
+                break;
+            }
+
+            Task *t = find_task(p, me);
+            if (t != NULL)
+                t->run(t, me);
+            else
+                sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+TaskPool *taskpool_new(int threads)
+{
+    TaskPool *p = calloc(1, sizeof(TaskPool));
+    if (p == NULL)
+        return NULL;
+
+    p->deques = aligned_alloc(64, sizeof(Deque) * (size_t)threads);
+    p->args = calloc((size_t)threads, sizeof(WorkerArg));
+    if (p->deques == NULL || p->args == NULL)
+    {
+        free(p->deques);
+        free(p->args);
+        free(p);
+        return NULL;
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    pthread_cond_init(&p->done, NULL);
+
+    for (int i = 0; i < threads; ++i)
+    {
+        atomic_init(&p->deques[i].top, 0);
+        atomic_init(&p->deques[i].bottom, 0);
+
+        // Indices stay dense even if a thread fails to start.
+        p->args[p->threads].pool = p;
+        p->args[p->threads].index = p->threads;
+
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, worker_thread, &p->args[p->threads]) != 0)
+            continue;
+        pthread_detach(thread_id);
+        p->threads++;
+    }
+
+    // Threads that did start are parked for good; the pool is not freed.
+    return (p->threads > 0) ? p : NULL;
+}
+
+int taskpool_threads(const TaskPool *p)
+{
+    return p->threads;
+}
+
+void taskpool_run(TaskPool *p, Task *root)
+{
+    pthread_mutex_lock(&p->lock);
+    atomic_store_explicit(&p->root, root, memory_order_release);
+    atomic_store_explicit(&p->running, 1, memory_order_release);
+    p->root_done = 0;
+    p->run_id++;
+    pthread_cond_broadcast(&p->wake);
+
+    while (!p->root_done)
+        pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void taskpool_spawn(TaskPool *p, int worker, Task *t)
+{
+    if (deque_push(&p->deques[worker], t) < 0)
+        t->run(t, worker);
+}
+
+void taskpool_wait(TaskPool *p, int worker, _Atomic int *pending)
+{
+    while (atomic_load_explicit(pending, memory_order_acquire) > 0)
+    {
+        Task *t = find_task(p, worker);
+        if (t != NULL)
+            t->run(t, worker);
+        else
+            sched_yield();
+    }
+}
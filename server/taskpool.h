@@ -0,0 +1,41 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <stdatomic.h>
+
+struct Task;
+
+// worker is the index of the pool thread running the task, which is also
+// the deque it spawns into.
+typedef void (*TaskFn)(struct Task *task, int worker);
+
+// Intrusive like Job: embed a Task at the start of the request.
+typedef struct Task
+{
+    TaskFn run;
+} Task;
+
+// Fork-join threads for work that splits itself up as it goes, such as a
+// game-tree search. Every thread keeps a deque of tasks: it pushes and
+// pops at one end, and threads with nothing to do steal from the other
+// end of someone else's. Between runs the threads sleep.
+typedef struct TaskPool TaskPool;
+
+// Returns NULL if no thread could be started.
+TaskPool *taskpool_new(int threads);
+int taskpool_threads(const TaskPool *p);
+
+// Runs root on one of the pool's threads and returns once root has
+// returned. root must wait for whatever it spawns. Runs must not
+// overlap.
+void taskpool_run(TaskPool *p, Task *root);
+
+// From a task running on worker: queues t to run on this thread or on
+// a thief. Runs t at once when the deque is full.
+void taskpool_spawn(TaskPool *p, int worker, Task *t);
+
+// Runs queued tasks, this thread's newest first and then stolen ones,
+// until *pending drops to zero.
+void taskpool_wait(TaskPool *p, int worker, _Atomic int *pending);
+
+#endif
@@ -0,0 +1,190 @@
+#include "timerwheel.h"
+
+#include <time.h>
+
+#define SLOT_BITS 6
+#define SLOT_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_SPAN (1ull << (SLOT_BITS * WHEEL_LEVELS)) // ticks the top level tells apart
+
+_Static_assert(WHEEL_SLOTS == 1 << SLOT_BITS, "SLOT_BITS must match WHEEL_SLOTS");
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+void timer_init(Timer *t, TimerFn fire)
+{
+    t->prev = NULL;
+    t->next = NULL;
+    t->expires = 0;
+    t->fire = fire;
+}
+
+// Called with w->lock held. A timer that is already due goes into the
+// next tick's slot.
+static void link_timer(TimerWheel *w, Timer *t)
+{
+    uint64_t at = (t->expires > w->now) ? t->expires : w->now + 1;
+    uint64_t delta = at - w->now;
+
+    // Too far off for the top level: parked in its furthest slot, and
+    // placed again from expires when that slot cascades.
+    if (delta >= WHEEL_SPAN)
+        at = w->now + WHEEL_SPAN - 1;
+
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && (at - w->now) >> (SLOT_BITS * (level + 1)))
+        level++;
+
+    Timer *head = &w->slots[level][(at >> (SLOT_BITS * level)) & SLOT_MASK];
+    t->prev = head->prev;
+    t->next = head;
+    head->prev->next = t;
+    head->prev = t;
+}
+
+static void unlink_timer(Timer *t)
+{
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->prev = NULL;
+    t->next = NULL;
+}
+
+// Called with w->lock held: moves everything in a slot down a level.
+static void cascade(TimerWheel *w, int level)
+{
+    Timer *head = &w->slots[level][(w->now >> (SLOT_BITS * level)) & SLOT_MASK];
+    while (head->next != head)
+    {
+        Timer *t = head->next;
+        unlink_timer(t);
+        link_timer(w, t);
+    }
+}
+
+// Called with w->lock held, which is dropped around each callback.
+static void advance(TimerWheel *w)
+{
+    w->now++;
+    for (int level = 1; level < WHEEL_LEVELS; ++level)
+    {
+        if ((w->now >> (SLOT_BITS * (level - 1))) & SLOT_MASK)
+            break;
+        cascade(w, level);
+    }
+
+    Timer *head = &w->slots[0][w->now & SLOT_MASK];
+    while (head->next != head)
+    {
+        Timer *t = head->next;
+        unlink_timer(t);
+        w->pending--;
+
+        w->firing = 1;
+        pthread_mutex_unlock(&w->lock);
+        t->fire(t);
+        pthread_mutex_lock(&w->lock);
+        w->firing = 0;
+    }
+}
+
+static void *wheel_thread(void *arg)
+{
+    TimerWheel *w = arg;
+
+    pthread_mutex_lock(&w->lock);
+    while (1)
+    {
+        if (w->pending == 0)
+        {
+            pthread_cond_wait(&w->wake, &w->lock);
+            continue;
+        }
+
+        long long due = w->start_ns + (long long)(w->now + 1) * w->tick_ns;
+        if (now_ns() < due)
+        {
+            struct timespec ts = {.tv_sec = due / 1000000000ll, .tv_nsec = due % 1000000000ll};
+            pthread_mutex_unlock(&w->lock);
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            pthread_mutex_lock(&w->lock);
+            continue;
+        }
+
+        // Behind after a slow callback: ticks are caught up one by one.
+        advance(w);
+    }
+
+    return NULL;
+}
+
+int wheel_start(TimerWheel *w, int tick_ms)
+{
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->wake, &attr);
+    pthread_condattr_destroy(&attr);
+
+    for (int level = 0; level < WHEEL_LEVELS; ++level)
+        for (int i = 0; i < WHEEL_SLOTS; ++i)
+        {
+            w->slots[level][i].prev = &w->slots[level][i];
+            w->slots[level][i].next = &w->slots[level][i];
+        }
+    w->now = 0;
+    w->start_ns = now_ns();
+    w->tick_ns = (long long)tick_ms * 1000000ll;
+    w->pending = 0;
+    w->firing = 0;
+
+    pthread_t thread_id;
+    if (pthread_create(&thread_id, NULL, wheel_thread, w) != 0)
+        return -1;
+    pthread_detach(thread_id);
+    return 0;
+}
+
+void wheel_add(TimerWheel *w, Timer *t, long long delay_ms)
+{
+    if (delay_ms < 0)
+        delay_ms = 0;
+
+    // Counted from the clock rather than from w->now, which trails it
+    // while the thread is catching up.
+    long long at_ns = now_ns() - w->start_ns + delay_ms * 1000000ll;
+
+    pthread_mutex_lock(&w->lock);
+    if (t->next != NULL)
+        unlink_timer(t);
+    else if (w->pending++ == 0)
+    {
+        // Nothing to cascade, so the wheel can skip the ticks it slept
+        // through, unless it is in the middle of one.
+        if (!w->firing)
+            w->now = (uint64_t)((now_ns() - w->start_ns) / w->tick_ns);
+        pthread_cond_signal(&w->wake);
+    }
+
+    t->expires = (uint64_t)((at_ns + w->tick_ns - 1) / w->tick_ns);
+    link_timer(w, t);
+    pthread_mutex_unlock(&w->lock);
+}
+
+int wheel_cancel(TimerWheel *w, Timer *t)
+{
+    pthread_mutex_lock(&w->lock);
+    int was_pending = (t->next != NULL);
+    if (was_pending)
+    {
+        unlink_timer(t);
+        w->pending--;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return was_pending;
+}
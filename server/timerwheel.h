@@ -0,0 +1,56 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define WHEEL_LEVELS 4
+#define WHEEL_SLOTS 64 // per level, a power of two
+
+struct Timer;
+
+// Runs on the wheel's thread with no lock held. The timer is no longer
+// pending and may be added again from here.
+typedef void (*TimerFn)(struct Timer *t);
+
+// Embedded in whatever times out, like MatchNode. Pending while linked
+// into one of the wheel's slots.
+typedef struct Timer
+{
+    struct Timer *prev;
+    struct Timer *next; // NULL unless pending
+    uint64_t expires; // tick
+    TimerFn fire;
+} Timer;
+
+// Hierarchical timing wheel: level 0 has a slot per tick, each level above
+// a slot per whole turn of the one below. A timer goes into the coarsest
+// slot that still tells it apart and drops a level each time the level
+// below comes round to that slot, so adding, cancelling and expiring a
+// timer all cost O(1) however many are pending. One thread advances the
+// wheel tick by tick and sleeps while nothing is pending.
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // something was added to an empty wheel
+    Timer slots[WHEEL_LEVELS][WHEEL_SLOTS]; // list heads
+    uint64_t now; // ticks since start
+    long long start_ns;
+    long long tick_ns;
+    long pending;
+    int firing; // the thread is running a callback
+} TimerWheel;
+
+void timer_init(Timer *t, TimerFn fire);
+
+// Returns -1 if the wheel's thread could not be started.
+int wheel_start(TimerWheel *w, int tick_ms);
+
+// Fires t once delay_ms have gone by, rounded up to a whole tick. A
+// pending timer is moved to the new time.
+void wheel_add(TimerWheel *w, Timer *t, long long delay_ms);
+
+// Returns whether t was pending; if not, it may be firing right now.
+int wheel_cancel(TimerWheel *w, Timer *t);
+
+#endif
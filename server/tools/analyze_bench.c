@@ -0,0 +1,105 @@
+// Measures how the parallel analysis scales: the same positions are
+// searched to a fixed depth with 1, 2, 4, ... threads, each count with a
+// fresh transposition table, and the nodes per second and the speedup in
+// time to depth are printed against one thread.
+//
+//   gcc -O2 -pthread -o analyze_bench server/tools/analyze_bench.c server/engine.c server/taskpool.c server/checkers.c
+//   ./analyze_bench [depth] [max_threads]
+//
+// max_threads defaults to the CPUs online. Positions are the opening and
+// a few reached by random play from a fixed seed, so runs compare.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../engine.h"
+
+#define POSITIONS 4
+#define TT_BITS 20
+#define TIME_LIMIT_MS 600000 // depth decides, not the clock
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Plays plies random whole moves from the opening.
+static void random_position(Game *g, int plies, unsigned *seed)
+{
+    game_init(g);
+    for (int i = 0; i < plies && g->result == GAME_RUNNING; ++i)
+    {
+        Move moves[64];
+        int n = game_generate_moves(g, moves, 64);
+        if (n > 64)
+            n = 64;
+        if (n == 0)
+            break;
+
+        const Move *m = &moves[rand_r(seed) % (unsigned)n];
+        for (int h = 0; h < m->hops; ++h)
+        {
+            int fr, fc, tr, tc;
+            game_square_coords(m->squares[h], &fr, &fc);
+            game_square_coords(m->squares[h + 1], &tr, &tc);
+            game_apply_move(g, fr, fc, tr, tc);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int depth = (argc > 1) ? atoi(argv[1]) : 12;
+    int max_threads = (argc > 2) ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (depth < 1 || max_threads < 1)
+    {
+        fprintf(stderr, "depth and max_threads must be positive\n");
+        return 1;
+    }
+
+    Game positions[POSITIONS];
+    unsigned seed = 1;
+    for (int i = 0; i < POSITIONS; ++i)
+        random_position(&positions[i], 8 * i, &seed);
+
+    printf("depth %d, %d positions\n", depth, POSITIONS);
+    printf("threads       nodes    seconds     nodes/s  speedup\n");
+
+    double base = 0;
+    for (int threads = 1;; threads *= 2)
+    {
+        if (threads > max_threads)
+            threads = max_threads;
+
+        Analyzer *a = analyzer_new(threads, TT_BITS);
+        if (a == NULL)
+        {
+            fprintf(stderr, "could not start %d threads\n", threads);
+            return 1;
+        }
+
+        long nodes = 0;
+        double t0 = now_sec();
+        for (int i = 0; i < POSITIONS; ++i)
+        {
+            Move best;
+            EngineStats stats;
+            analyzer_run(a, &positions[i], depth, TIME_LIMIT_MS, &best, &stats);
+            nodes += stats.nodes;
+        }
+        double secs = now_sec() - t0;
+        if (threads == 1)
+            base = secs;
+
+        printf("%7d %11ld %10.3f %11.0f %8.2f\n", threads, nodes, secs, (double)nodes / secs, base / secs);
+        fflush(stdout);
+
+        // The pool's threads stay parked; a short-lived tool can leave them.
+        if (threads == max_threads)
+            break;
+    }
+    return 0;
+}
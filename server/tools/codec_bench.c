@@ -0,0 +1,173 @@
+// Compares the text and binary protocols: bytes on the wire for one move
+// and the server-side cost of parsing a MOVE and encoding a BOARD/DELTA.
+// Checks the binary framing first and exits with 1 if it is wrong.
+//
+//   gcc -O2 -o codec_bench server/tools/codec_bench.c server/protocol.c server/checkers.c
+//   ./codec_bench [iterations]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../checkers.h"
+#include "../protocol.h"
+
+#define SAMPLE_MOVES 256
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static size_t text_len(MsgType t)
+{
+    return strlen(proto_text(t));
+}
+
+// A MOVE_PATH frame with a square count it cannot have must end the
+// stream: read as frames, its squares could be anything, e.g. a QUIT.
+// A good one must use exactly its own bytes.
+static int check_framing(void)
+{
+    int bad_counts[] = {0, 1, MOVE_PATH_MAX + 1, 0x0E, 0xFF};
+    Command cmd;
+
+    for (size_t i = 0; i < sizeof(bad_counts) / sizeof(bad_counts[0]); ++i)
+    {
+        unsigned char stream[] = {BIN_OP_MOVE_PATH, (unsigned char)bad_counts[i], BIN_OP_QUIT, 9, 14};
+        proto_parse_binary(stream, sizeof(stream), &cmd);
+        if (cmd.type != CMD_PROTOCOL_ERROR)
+        {
+            fprintf(stderr, "MOVE_PATH with %d squares was not a protocol error\n", bad_counts[i]);
+            return -1;
+        }
+    }
+
+    unsigned char stream[] = {BIN_OP_MOVE_PATH, 3, 9, 18, 27, BIN_OP_QUIT};
+    size_t used = proto_parse_binary(stream, sizeof(stream), &cmd);
+    if (used != 5 || cmd.type != CMD_MOVE || cmd.path_len != 3)
+    {
+        fprintf(stderr, "MOVE_PATH with 3 squares was misread\n");
+        return -1;
+    }
+    if (proto_parse_binary(stream + used, sizeof(stream) - used, &cmd) != 1 || cmd.type != CMD_QUIT)
+    {
+        fprintf(stderr, "the frame after a MOVE_PATH was misread\n");
+        return -1;
+    }
+    if (proto_parse_binary(stream, 4, &cmd) != 0)
+    {
+        fprintf(stderr, "a MOVE_PATH missing a square was taken as complete\n");
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = (argc > 1) ? atol(argv[1]) : 10000000;
+
+    if (check_framing() < 0)
+        return 1;
+    printf("binary framing     ok\n");
+
+    // A spread of legal squares so the parser sees realistic input.
+    char text_moves[SAMPLE_MOVES][32];
+    unsigned char bin_moves[SAMPLE_MOVES][BIN_MOVE_LEN];
+    srand(1);
+    for (int i = 0; i < SAMPLE_MOVES; ++i)
+    {
+        int fr, fc, tr, tc;
+        game_square_coords(rand() % BOARD_SQUARES, &fr, &fc);
+        game_square_coords(rand() % BOARD_SQUARES, &tr, &tc);
+        snprintf(text_moves[i], sizeof(text_moves[i]), "MOVE %d %d %d %d", fr, fc, tr, tc);
+        proto_move_binary(fr, fc, tr, tc, bin_moves[i]);
+    }
+
+    Game before, g;
+    game_init(&before);
+    g = before;
+    game_apply_move(&g, 5, 0, 4, 1);
+    uint32_t changed = game_diff(&before, &g);
+
+    char board_text[96];
+    unsigned char board_bin[BIN_BOARD_LEN];
+    char delta_text[DELTA_TEXT_MAX];
+    unsigned char delta_bin[BIN_DELTA_MAX_LEN];
+    size_t text_board = proto_board_text(&g, 1, board_text, sizeof(board_text));
+    size_t bin_board = proto_board_binary(&g, 1, board_bin);
+    size_t text_delta = proto_delta_text(&g, changed, 1, delta_text, sizeof(delta_text));
+    size_t bin_delta = proto_delta_binary(&g, changed, 1, delta_bin);
+
+    // One quiet move: the mover's command, then the reply batch each
+    // player gets (MOVE_OK/OPPONENT_MOVED, the position, the next turn).
+    size_t text_up = strlen(text_moves[0]) + 1;
+    size_t text_status = text_len(MSG_MOVE_OK) + text_len(MSG_OPP_TURN) +
+                         text_len(MSG_OPPONENT_MOVED) + text_len(MSG_YOUR_TURN);
+    size_t bin_up = BIN_MOVE_LEN;
+    size_t bin_status = 4;
+
+    size_t text_full = text_up + text_status + 2 * text_board;
+    size_t text_diff = text_up + text_status + 2 * text_delta;
+    size_t bin_full = bin_up + bin_status + 2 * bin_board;
+    size_t bin_diff = bin_up + bin_status + 2 * bin_delta;
+
+    printf("position message   text: BOARD=%zu DELTA=%zu   binary: BOARD=%zu DELTA=%zu\n",
+           text_board, text_delta, bin_board, bin_delta);
+    printf("bytes per move     text: with BOARD=%zu with DELTA=%zu\n", text_full, text_diff);
+    printf("bytes per move   binary: with BOARD=%zu with DELTA=%zu (%.1f%% of text with BOARD)\n",
+           bin_full, bin_diff, 100.0 * (double)bin_diff / (double)text_full);
+
+    Command cmd;
+    volatile int sink = 0;
+
+    double t0 = now_ns();
+    for (long i = 0; i < iterations; ++i)
+    {
+        proto_parse_text(text_moves[i & (SAMPLE_MOVES - 1)], &cmd);
+        sink += cmd.path[1][1];
+    }
+    double t1 = now_ns();
+    for (long i = 0; i < iterations; ++i)
+    {
+        proto_parse_binary(bin_moves[i & (SAMPLE_MOVES - 1)], BIN_MOVE_LEN, &cmd);
+        sink += cmd.path[1][1];
+    }
+    double t2 = now_ns();
+
+    printf("parse MOVE         text: %.1f ns   binary: %.1f ns\n",
+           (t1 - t0) / (double)iterations, (t2 - t1) / (double)iterations);
+
+    long board_iterations = iterations / 10;
+    t0 = now_ns();
+    for (long i = 0; i < board_iterations; ++i)
+    {
+        g.white ^= (uint32_t)(i & 1) << 20;
+        sink += (int)proto_board_text(&g, 1, board_text, sizeof(board_text));
+    }
+    t1 = now_ns();
+    for (long i = 0; i < board_iterations; ++i)
+    {
+        g.white ^= (uint32_t)(i & 1) << 20;
+        sink += (int)proto_board_binary(&g, 1, board_bin);
+    }
+    t2 = now_ns();
+
+    printf("encode BOARD       text: %.1f ns   binary: %.1f ns\n",
+           (t1 - t0) / (double)board_iterations, (t2 - t1) / (double)board_iterations);
+
+    t0 = now_ns();
+    for (long i = 0; i < board_iterations; ++i)
+        sink += (int)proto_delta_text(&g, changed, (uint32_t)i, delta_text, sizeof(delta_text));
+    t1 = now_ns();
+    for (long i = 0; i < board_iterations; ++i)
+        sink += (int)proto_delta_binary(&g, changed, (uint32_t)i, delta_bin);
+    t2 = now_ns();
+
+    printf("encode DELTA       text: %.1f ns   binary: %.1f ns\n",
+           (t1 - t0) / (double)board_iterations, (t2 - t1) / (double)board_iterations);
+
+    return sink == 42 ? 1 : 0;
+}
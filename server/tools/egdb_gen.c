@@ -0,0 +1,170 @@
+// Builds the endgame table the server adjudicates with (-e): the value of
+// every position with up to max_pieces pieces under the server's rules.
+//
+//   gcc -O2 -pthread -o egdb_gen server/tools/egdb_gen.c server/endgame.c server/checkers.c
+//   ./egdb_gen [max_pieces] [file]
+//
+// Slices are solved in file order, so every move out of a slice lands in
+// one already solved or in the slice itself. Within a slice the unsolved
+// positions are swept forwards until nothing changes, rather than worked
+// back from the finished positions by retrograde analysis: that needs
+// unmoves and predecessor counts, and at four pieces a sweep over a
+// slice is cheap enough. A position is won if some move leaves the
+// opponent lost, lost if every move leaves the opponent won. Whatever is
+// left when a sweep changes nothing can be held by both sides forever and
+// is a draw.
+//
+// Values are for play without a move limit. The server's quiet move
+// limit (-d) can turn a long win into a draw, so with the limit on it
+// only adjudicates the table's draws.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../endgame.h"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// The value of a finished game to the side that was to move in it.
+static EndgameValue finished_value(const Game *g, PlayerColor side)
+{
+    if (g->result == GAME_DRAW)
+        return ENDGAME_DRAW;
+    int white_won = (g->result == GAME_WHITE_WIN);
+    return (white_won == (side == COLOR_WHITE)) ? ENDGAME_WIN : ENDGAME_LOSS;
+}
+
+// One sweep's verdict on g, which is still running: ENDGAME_UNKNOWN while
+// it depends on positions not solved yet.
+static EndgameValue evaluate(const Game *g, const uint8_t *values, int max_pieces)
+{
+    Move moves[64];
+    int n = game_generate_moves(g, moves, 64);
+    if (n > 64)
+        n = 64; // a handful of pieces never has this many
+
+    int all_lost = 1;
+    for (int i = 0; i < n; ++i)
+    {
+        Game next = *g;
+        for (int h = 0; h < moves[i].hops; ++h)
+        {
+            int fr, fc, tr, tc;
+            game_square_coords(moves[i].squares[h], &fr, &fc);
+            game_square_coords(moves[i].squares[h + 1], &tr, &tc);
+            game_apply_move(&next, fr, fc, tr, tc);
+        }
+
+        EndgameValue v;
+        if (next.result != GAME_RUNNING)
+            v = finished_value(&next, g->turn);
+        else
+        {
+            // The opponent's value, turned round.
+            v = (EndgameValue)values[endgame_index(&next, max_pieces)];
+            if (v == ENDGAME_WIN)
+                v = ENDGAME_LOSS;
+            else if (v == ENDGAME_LOSS)
+                v = ENDGAME_WIN;
+        }
+
+        if (v == ENDGAME_WIN)
+            return ENDGAME_WIN;
+        if (v != ENDGAME_LOSS)
+            all_lost = 0;
+    }
+    return all_lost ? ENDGAME_LOSS : ENDGAME_UNKNOWN;
+}
+
+int main(int argc, char *argv[])
+{
+    int max_pieces = (argc > 1) ? atoi(argv[1]) : 4;
+    const char *path = (argc > 2) ? argv[2] : "endgame.db";
+    if (max_pieces < 2 || max_pieces > ENDGAME_MAX_PIECES)
+    {
+        fprintf(stderr, "max_pieces must be 2 to %d\n", ENDGAME_MAX_PIECES);
+        return 1;
+    }
+
+    uint64_t total = endgame_positions(max_pieces);
+    uint64_t *starts = malloc(sizeof(uint64_t) * 257);
+    int slices = endgame_slices(max_pieces, starts, 257);
+    uint8_t *values = calloc((size_t)total, 1);
+    uint64_t *pending = malloc(sizeof(uint64_t) * (size_t)total);
+    if (starts == NULL || values == NULL || pending == NULL)
+    {
+        fprintf(stderr, "out of memory for %llu positions\n", (unsigned long long)total);
+        return 1;
+    }
+
+    printf("%llu indices in %d slices\n", (unsigned long long)total, slices);
+    double t0 = now_sec();
+    uint64_t counts[4] = { 0 };
+    int longest = 0;
+
+    for (int s = 0; s < slices; ++s)
+    {
+        size_t npending = 0;
+        for (uint64_t i = starts[s]; i < starts[s + 1]; ++i)
+        {
+            Game g;
+            if (endgame_position(i, max_pieces, &g) < 0)
+                continue;
+            if (g.result != GAME_RUNNING)
+                values[i] = (uint8_t)finished_value(&g, g.turn);
+            else
+                pending[npending++] = i;
+        }
+
+        int sweeps = 0;
+        for (int changed = 1; changed; ++sweeps)
+        {
+            changed = 0;
+            size_t kept = 0;
+            for (size_t p = 0; p < npending; ++p)
+            {
+                Game g;
+                endgame_position(pending[p], max_pieces, &g);
+                EndgameValue v = evaluate(&g, values, max_pieces);
+                if (v == ENDGAME_UNKNOWN)
+                    pending[kept++] = pending[p];
+                else
+                {
+                    values[pending[p]] = (uint8_t)v;
+                    changed = 1;
+                }
+            }
+            npending = kept;
+        }
+        if (sweeps > longest)
+            longest = sweeps;
+
+        for (size_t p = 0; p < npending; ++p)
+            values[pending[p]] = ENDGAME_DRAW;
+    }
+
+    for (uint64_t i = 0; i < total; ++i)
+        counts[values[i]]++;
+
+    if (endgame_write(path, max_pieces, values) < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    printf("%d pieces: %llu won, %llu lost, %llu drawn, %llu unused indices\n", max_pieces,
+           (unsigned long long)counts[ENDGAME_WIN], (unsigned long long)counts[ENDGAME_LOSS],
+           (unsigned long long)counts[ENDGAME_DRAW], (unsigned long long)counts[ENDGAME_UNKNOWN]);
+    printf("longest slice took %d sweeps, %.1f s in all, %llu bytes written to %s\n", longest, now_sec() - t0,
+           (unsigned long long)(24 + (total + 3) / 4), path);
+
+    free(starts);
+    free(values);
+    free(pending);
+    return 0;
+}
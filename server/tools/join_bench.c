@@ -0,0 +1,174 @@
+// Opens a burst of player connections as fast as it can and measures how
+// quickly the server pairs them: games started per second and the time
+// from connect to WELCOME for every player.
+//
+//   gcc -O2 -o join_bench server/tools/join_bench.c
+//   ./join_bench [host] [port] [players]
+//
+// players should be even and stay below the open file limit; the server
+// needs room for players / 2 games. Players are paired in connect order,
+// so a pair's wait is counted from its second player's connect.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DRAIN_EVERY 32 // connects between two looks at the replies
+
+typedef struct
+{
+    int fd;
+    double connected;
+    double welcomed; // 0 until WELCOME arrives
+    char buf[256];
+    size_t len;
+} Conn;
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Reads what is there; returns -1 once the connection is gone.
+static int poll_conn(Conn *c)
+{
+    ssize_t n = recv(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0);
+    if (n <= 0)
+        return -1;
+
+    c->len += (size_t)n;
+    c->buf[c->len] = '\0';
+    if (strstr(c->buf, "WELCOME") != NULL)
+        c->welcomed = now_ms();
+
+    // Keep only a tail long enough to hold a split "WELCOME".
+    if (c->len > 16)
+    {
+        memmove(c->buf, c->buf + c->len - 16, 16);
+        c->len = 16;
+    }
+    return 0;
+}
+
+// One poll over the connections still waiting for their WELCOME.
+// Returns how many of them got it or went away.
+static int drain(Conn *conns, struct pollfd *pfds, int count, int timeout_ms)
+{
+    int n = 0;
+    for (int i = 0; i < count; ++i)
+        if (conns[i].fd >= 0 && conns[i].welcomed == 0)
+        {
+            pfds[n].fd = conns[i].fd;
+            pfds[n].events = POLLIN;
+            n++;
+        }
+
+    if (n == 0 || poll(pfds, (nfds_t)n, timeout_ms) <= 0)
+        return 0;
+
+    // pfds is in the same order as the connections still waiting.
+    int done = 0;
+    int k = 0;
+    for (int i = 0; i < count && k < n; ++i)
+    {
+        if (conns[i].fd < 0 || conns[i].welcomed != 0)
+            continue;
+        if (pfds[k++].revents == 0)
+            continue;
+        if (poll_conn(&conns[i]) < 0)
+        {
+            close(conns[i].fd);
+            conns[i].fd = -1;
+            done++;
+        }
+        else if (conns[i].welcomed != 0)
+            done++;
+    }
+    return done;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = (argc > 1) ? argv[1] : "127.0.0.1";
+    int port = (argc > 2) ? atoi(argv[2]) : 2222;
+    int players = (argc > 3) ? atoi(argv[3]) : 1000;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad host %s\n", host);
+        return 1;
+    }
+
+    Conn *conns = calloc((size_t)players, sizeof(Conn));
+    struct pollfd *pfds = calloc((size_t)players, sizeof(struct pollfd));
+    if (conns == NULL || pfds == NULL)
+        return 1;
+
+    // Replies are picked up between connects, so a pair's WELCOME is
+    // timed when it arrives rather than after the whole burst.
+    int waiting = 0;
+    double start = now_ms();
+    for (int i = 0; i < players; ++i)
+    {
+        conns[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (conns[i].fd < 0 || connect(conns[i].fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("connect");
+            players = i;
+            break;
+        }
+        conns[i].connected = now_ms();
+        waiting++;
+        if (i % DRAIN_EVERY == DRAIN_EVERY - 1)
+            waiting -= drain(conns, pfds, i + 1, 0);
+    }
+    double connected = now_ms();
+
+    double deadline = connected + 10000;
+    while (waiting > 0 && now_ms() < deadline)
+        waiting -= drain(conns, pfds, players, 100);
+    double finished = now_ms();
+
+    double *lat = calloc((size_t)players + 1, sizeof(double));
+    int matched = 0;
+    for (int i = 0; i < players; ++i)
+        if (conns[i].welcomed != 0)
+        {
+            double second = conns[(i | 1) < players ? (i | 1) : i].connected;
+            lat[matched++] = conns[i].welcomed - second;
+        }
+    qsort(lat, (size_t)matched, sizeof(double), cmp_double);
+
+    printf("players %d, connected in %.1fms, %d matched (%d games) in %.1fms, %.0f games/s\n",
+           players, connected - start, matched, matched / 2, finished - start,
+           (double)(matched / 2) / ((finished - start) / 1e3));
+    if (matched > 0)
+        printf("second connect to WELCOME: p50 %.2fms  p99 %.2fms  max %.2fms\n",
+               lat[matched / 2], lat[(int)(matched * 0.99)], lat[matched - 1]);
+
+    for (int i = 0; i < players; ++i)
+        if (conns[i].fd >= 0)
+            close(conns[i].fd);
+    free(lat);
+    free(pfds);
+    free(conns);
+    return matched == players ? 0 : 1;
+}
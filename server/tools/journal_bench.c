@@ -0,0 +1,124 @@
+// Measures how many moves per second the journal takes with three kinds
+// of durability:
+//
+//   per-move  one thread waits for every move to be on disk before the
+//             next, i.e. one fdatasync per move
+//   group     many threads each wait for their own move; moves that
+//             arrive during a sync share the next one
+//   batched   moves are only appended, as the server does, and the
+//             writer syncs whatever piled up since the last sync
+//
+//   gcc -O2 -pthread -o journal_bench server/tools/journal_bench.c server/journal.c
+//   ./journal_bench [dir] [moves] [threads]
+//
+// dir should be on the disk the server journals to; the logs made there
+// are removed again.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../journal.h"
+
+#define MAX_THREADS 256
+
+typedef struct
+{
+    Journal *j;
+    long moves;
+    int wait; // for each move to be on disk
+    uint32_t game_id;
+} Writer;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *write_moves(void *arg)
+{
+    Writer *w = arg;
+    JournalRecord r;
+    memset(&r, 0, sizeof(r));
+    r.type = JOURNAL_MOVE;
+    r.game_id = w->game_id;
+    r.cap_square = -1;
+
+    uint64_t lsn = 0;
+    for (long i = 0; i < w->moves; ++i)
+    {
+        r.seq = (uint32_t)i;
+        r.white = 0xFFF00000u ^ (uint32_t)i;
+        r.black = 0x00000FFFu;
+        lsn = journal_append(w->j, &r);
+        if (lsn == 0 || (w->wait && journal_wait(w->j, lsn) < 0))
+            break;
+    }
+    if (lsn == 0 || journal_wait(w->j, lsn) < 0)
+    {
+        perror("journal");
+        exit(1);
+    }
+    return NULL;
+}
+
+static void run(const char *name, const char *dir, long moves, int threads, int wait)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/journal_bench_%d_%s.log", dir, (int)getpid(), name);
+
+    // The writer thread stays parked on the journal after the run, so the
+    // journal is never freed.
+    Journal *j = malloc(sizeof(Journal));
+    if (j == NULL || journal_open(j, path) < 0 || journal_start(j) < 0)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    Writer w[MAX_THREADS];
+    pthread_t tid[MAX_THREADS];
+    double t0 = now_s();
+    for (int i = 0; i < threads; ++i)
+    {
+        w[i].j = j;
+        w[i].moves = moves / threads;
+        w[i].wait = wait;
+        w[i].game_id = (uint32_t)i + 1;
+        pthread_create(&tid[i], NULL, write_moves, &w[i]);
+    }
+    for (int i = 0; i < threads; ++i)
+        pthread_join(tid[i], NULL);
+    double secs = now_s() - t0;
+
+    long done = moves / threads * threads;
+    printf("%-9s %3d thread%s %8ld moves %8.3fs %10.0f moves/s\n          ", name, threads,
+           threads == 1 ? " " : "s", done, secs, (double)done / secs);
+    journal_report(j, stdout);
+
+    unlink(path);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = (argc > 1) ? argv[1] : ".";
+    long moves = (argc > 2) ? atol(argv[2]) : 200000;
+    int threads = (argc > 3) ? atoi(argv[3]) : 16;
+    if (threads < 1 || threads > MAX_THREADS)
+    {
+        fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+        return 1;
+    }
+
+    // A sync per move is slow enough that it only gets a slice of the moves.
+    long slice = (moves / 100 > 200) ? moves / 100 : 200;
+
+    run("per-move", dir, slice, 1, 1);
+    run("group", dir, slice * threads, threads, 1);
+    run("batched", dir, moves, 1, 0);
+    return 0;
+}
@@ -0,0 +1,661 @@
+// Keeps many random games going against a server and reports what it
+// sustains: moves and games per second, the latency of every move and
+// whatever went wrong.
+//
+//   gcc -O2 -pthread -o loadgen server/tools/loadgen.c server/checkers.c
+//   ./loadgen [host] [port] [connections] [moves_per_sec] [seconds] [threads]
+//
+// Each connection waits to be paired by the server, follows its board
+// through BOARD and DELTA, and on its turn plays a random legal move,
+// capture chains whole. A finished game is replaced by reconnecting.
+// moves_per_sec is the total aimed for, 0 for as fast as the server
+// answers: each side thinks connections / 2 / moves_per_sec seconds
+// before every move, so the aim is met while replies come back faster
+// than that. A move's latency runs from sending MOVE to reading its
+// MOVE_OK. The first second is a warm-up and is not counted. The open
+// file limit is raised as far as the hard limit allows, which has to
+// cover the connections.
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../checkers.h"
+
+#define MAX_THREADS 64
+#define WARMUP_SEC 1
+#define MAX_PLIES 200 // random kings can shuffle forever; the game is given up then
+#define RETRY_MS 100 // after a failed connect
+#define EVENTS_MAX 256
+#define MOVES_MAX 128
+#define IN_MAX 4096
+#define SUB_BITS 4 // histogram buckets as in metrics.c
+#define SUB_COUNT (1 << SUB_BITS)
+#define BUCKETS ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+typedef enum
+{
+    CONN_CONNECTING,
+    CONN_WAITING, // for the opponent or the next turn
+    CONN_THINKING, // its turn, waiting out the think time
+    CONN_MOVED, // MOVE sent, waiting for MOVE_OK
+    CONN_RETRY // connect failed, waiting to try again
+} ConnState;
+
+typedef struct Conn
+{
+    int fd;
+    ConnState state;
+    PlayerColor color;
+    int plies; // moves this side made in this game
+    uint32_t white, black, kings; // the board as the server last described it
+    long long sent_ns;
+    long long due_ns; // CONN_THINKING and CONN_RETRY: when to act
+    struct DueList *due_list; // the list it waits on, NULL if none
+    struct Conn *prev_due;
+    struct Conn *next_due;
+    char in[IN_MAX];
+    size_t in_len;
+} Conn;
+
+// Connections waiting out the same delay, so in the order they are due.
+typedef struct DueList
+{
+    Conn *head;
+    Conn *tail;
+    long long delay_ns;
+} DueList;
+
+typedef struct
+{
+    _Atomic unsigned long moves;
+    _Atomic unsigned long games; // finished, counted by the white side
+    _Atomic unsigned long given_up; // MAX_PLIES reached
+    _Atomic unsigned long invalid; // MOVE_INVALID
+    _Atomic unsigned long server_errors; // ERROR_* and SERVER_NO_MORE_GAMES
+    _Atomic unsigned long dropped; // connections closed or left in a game by surprise
+    _Atomic unsigned long connect_failed;
+} Counts;
+
+typedef struct
+{
+    Conn *conns;
+    int count;
+    int epoll_fd;
+    uint64_t rng;
+    DueList thinking;
+    DueList retrying;
+    Counts counts;
+    uint64_t hist[BUCKETS]; // move latencies in ns, counted after the warm-up
+    uint64_t max_ns;
+} Worker;
+
+static struct sockaddr_in server_addr;
+static long long think_ns = 0;
+static _Atomic int measuring = 0;
+static _Atomic int stopping = 0;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+static void bump(_Atomic unsigned long *v)
+{
+    atomic_fetch_add_explicit(v, 1, memory_order_relaxed);
+}
+
+static uint64_t next_random(Worker *w)
+{
+    // xorshift64
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    return w->rng;
+}
+
+static int bucket_of(uint64_t v)
+{
+    if (v < SUB_COUNT)
+        return (int)v;
+
+    int shift = 63 - __builtin_clzll(v) - SUB_BITS;
+    return ((shift + 1) << SUB_BITS) + (int)((v >> shift) & (SUB_COUNT - 1));
+}
+
+static double bucket_value(int i)
+{
+    if (i < SUB_COUNT)
+        return (double)i;
+
+    int shift = (i >> SUB_BITS) - 1;
+    uint64_t low = (uint64_t)(SUB_COUNT + (i & (SUB_COUNT - 1))) << shift;
+    return (double)low + (double)((uint64_t)1 << shift) / 2;
+}
+
+static void due_unlink(Conn *c)
+{
+    DueList *l = c->due_list;
+    if (l == NULL)
+        return;
+
+    if (c->prev_due != NULL)
+        c->prev_due->next_due = c->next_due;
+    else
+        l->head = c->next_due;
+    if (c->next_due != NULL)
+        c->next_due->prev_due = c->prev_due;
+    else
+        l->tail = c->prev_due;
+    c->due_list = NULL;
+}
+
+static void due_push(DueList *l, Conn *c)
+{
+    due_unlink(c);
+    c->due_ns = now_ns() + l->delay_ns;
+    c->due_list = l;
+    c->prev_due = l->tail;
+    c->next_due = NULL;
+    if (l->tail != NULL)
+        l->tail->next_due = c;
+    else
+        l->head = c;
+    l->tail = c;
+}
+
+static void conn_open(Worker *w, Conn *c)
+{
+    c->in_len = 0;
+    c->plies = 0;
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd >= 0)
+    {
+        int one = 1;
+        setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (connect(c->fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == 0 || errno == EINPROGRESS)
+        {
+            struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT, .data.ptr = c};
+            if (epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, c->fd, &ev) == 0)
+            {
+                c->state = CONN_CONNECTING;
+                return;
+            }
+        }
+        close(c->fd);
+        c->fd = -1;
+    }
+
+    bump(&w->counts.connect_failed);
+    c->state = CONN_RETRY;
+    due_push(&w->retrying, c);
+}
+
+// Ends this connection's part in its game, politely if quit, and queues
+// it up for the next one.
+static void conn_restart(Worker *w, Conn *c, int quit)
+{
+    if (quit)
+        send(c->fd, "QUIT\n", 5, MSG_NOSIGNAL);
+    close(c->fd);
+    c->fd = -1;
+    due_unlink(c);
+
+    if (!atomic_load_explicit(&stopping, memory_order_relaxed))
+        conn_open(w, c);
+}
+
+static void read_board(Conn *c, const char *cells)
+{
+    c->white = c->black = c->kings = 0;
+    for (int i = 0; i < BOARD_SIZE * BOARD_SIZE && cells[i] != '\0'; ++i)
+    {
+        int sq = game_square(i / BOARD_SIZE, i % BOARD_SIZE);
+        if (sq < 0)
+            continue;
+        uint32_t bit = 1u << sq;
+        if (cells[i] == CELL_WHITE || cells[i] == CELL_WHITE_KING)
+            c->white |= bit;
+        if (cells[i] == CELL_BLACK || cells[i] == CELL_BLACK_KING)
+            c->black |= bit;
+        if (cells[i] == CELL_WHITE_KING || cells[i] == CELL_BLACK_KING)
+            c->kings |= bit;
+    }
+}
+
+// "DELTA <seq> <row> <col> <cell> ..."
+static void read_delta(Conn *c, const char *p)
+{
+    int used;
+    unsigned seq;
+    if (sscanf(p, "%u%n", &seq, &used) != 1)
+        return;
+    p += used;
+
+    int row, col;
+    char cell;
+    while (sscanf(p, " %d %d %c%n", &row, &col, &cell, &used) == 3)
+    {
+        p += used;
+        int sq = game_square(row, col);
+        if (sq < 0)
+            continue;
+        uint32_t bit = 1u << sq;
+        c->white &= ~bit;
+        c->black &= ~bit;
+        c->kings &= ~bit;
+        if (cell == CELL_WHITE || cell == CELL_WHITE_KING)
+            c->white |= bit;
+        if (cell == CELL_BLACK || cell == CELL_BLACK_KING)
+            c->black |= bit;
+        if (cell == CELL_WHITE_KING || cell == CELL_BLACK_KING)
+            c->kings |= bit;
+    }
+}
+
+static void play_move(Worker *w, Conn *c)
+{
+    if (c->plies >= MAX_PLIES)
+    {
+        bump(&w->counts.given_up);
+        conn_restart(w, c, 1);
+        return;
+    }
+
+    Game g;
+    game_set_position(&g, c->white, c->black, c->kings, c->color, -1);
+
+    Move moves[MOVES_MAX];
+    int n = game_generate_moves(&g, moves, MOVES_MAX);
+    if (n > MOVES_MAX)
+        n = MOVES_MAX;
+    if (n <= 0)
+    {
+        // The server should have ended the game already.
+        bump(&w->counts.invalid);
+        conn_restart(w, c, 1);
+        return;
+    }
+
+    const Move *m = &moves[next_random(w) % (uint64_t)n];
+    char line[16 + 4 * (MOVE_MAX_HOPS + 1)];
+    int len = snprintf(line, sizeof(line), "MOVE");
+    for (int i = 0; i <= m->hops; ++i)
+    {
+        int row, col;
+        game_square_coords(m->squares[i], &row, &col);
+        len += snprintf(line + len, sizeof(line) - (size_t)len, " %d %d", row, col);
+    }
+    line[len++] = '\n';
+
+    c->sent_ns = now_ns();
+    if (send(c->fd, line, (size_t)len, MSG_NOSIGNAL) != len)
+    {
+        bump(&w->counts.dropped);
+        conn_restart(w, c, 0);
+        return;
+    }
+    c->plies++;
+    c->state = CONN_MOVED;
+}
+
+static void my_turn(Worker *w, Conn *c)
+{
+    if (think_ns == 0)
+        play_move(w, c);
+    else
+    {
+        c->state = CONN_THINKING;
+        due_push(&w->thinking, c);
+    }
+}
+
+// Returns 0 when c was restarted and the rest of its input is stale.
+static int handle_line(Worker *w, Conn *c, const char *line)
+{
+    if (strcmp(line, "MOVE_OK") == 0)
+    {
+        if (c->state == CONN_MOVED && atomic_load_explicit(&measuring, memory_order_relaxed))
+        {
+            uint64_t ns = (uint64_t)(now_ns() - c->sent_ns);
+            w->hist[bucket_of(ns)]++;
+            if (ns > w->max_ns)
+                w->max_ns = ns;
+            bump(&w->counts.moves);
+        }
+        c->state = CONN_WAITING;
+    }
+    else if (strcmp(line, "YOUR_TURN") == 0)
+        my_turn(w, c);
+    else if (strncmp(line, "DELTA ", 6) == 0)
+        read_delta(c, line + 6);
+    else if (strncmp(line, "BOARD ", 6) == 0)
+        read_board(c, line + 6);
+    else if (strcmp(line, "WELCOME WHITE") == 0)
+    {
+        c->color = COLOR_WHITE;
+        c->plies = 0;
+    }
+    else if (strcmp(line, "WELCOME BLACK") == 0)
+    {
+        c->color = COLOR_BLACK;
+        c->plies = 0;
+    }
+    else if (strcmp(line, "YOU_WIN") == 0 || strcmp(line, "YOU_LOSE") == 0 || strcmp(line, "DRAW") == 0)
+    {
+        if (c->color == COLOR_WHITE && atomic_load_explicit(&measuring, memory_order_relaxed))
+            bump(&w->counts.games);
+        conn_restart(w, c, 0);
+        return 0;
+    }
+    else if (strcmp(line, "OPPONENT_LEFT") == 0)
+    {
+        // The other side gave up on a long game.
+        conn_restart(w, c, 0);
+        return 0;
+    }
+    else if (strcmp(line, "MOVE_INVALID") == 0 || strcmp(line, "YOUR_TURN_CONTINUE_CAPTURE") == 0)
+    {
+        // Whole chains are sent, so the board here went wrong somewhere.
+        bump(&w->counts.invalid);
+        conn_restart(w, c, 1);
+        return 0;
+    }
+    else if (strcmp(line, "OPPONENT_AWAY") == 0)
+    {
+        bump(&w->counts.dropped);
+        conn_restart(w, c, 1);
+        return 0;
+    }
+    else if (strncmp(line, "ERROR", 5) == 0 || strcmp(line, "SERVER_NO_MORE_GAMES") == 0)
+    {
+        bump(&w->counts.server_errors);
+        conn_restart(w, c, 1);
+        return 0;
+    }
+    // WAITING_FOR_OPPONENT, GAME, SESSION, OPP_TURN, OPPONENT_MOVED and
+    // the like need nothing.
+    return 1;
+}
+
+static void handle_readable(Worker *w, Conn *c)
+{
+    ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+    if (n <= 0)
+    {
+        bump(&w->counts.dropped);
+        conn_restart(w, c, 0);
+        return;
+    }
+    c->in_len += (size_t)n;
+
+    size_t start = 0;
+    char *nl;
+    while ((nl = memchr(c->in + start, '\n', c->in_len - start)) != NULL)
+    {
+        *nl = '\0';
+        if (!handle_line(w, c, c->in + start))
+            return;
+        start = (size_t)(nl - c->in) + 1;
+    }
+
+    if (start == 0 && c->in_len == sizeof(c->in))
+    {
+        // A line longer than anything the server sends.
+        bump(&w->counts.server_errors);
+        conn_restart(w, c, 1);
+        return;
+    }
+    memmove(c->in, c->in + start, c->in_len - start);
+    c->in_len -= start;
+}
+
+static void handle_event(Worker *w, Conn *c, uint32_t events)
+{
+    if (c->state == CONN_CONNECTING)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (events & (EPOLLERR | EPOLLHUP)))
+        {
+            close(c->fd);
+            c->fd = -1;
+            bump(&w->counts.connect_failed);
+            c->state = CONN_RETRY;
+            due_push(&w->retrying, c);
+            return;
+        }
+        if (!(events & (EPOLLOUT | EPOLLIN)))
+            return;
+
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+        epoll_ctl(w->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->state = CONN_WAITING;
+    }
+
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+        handle_readable(w, c);
+}
+
+// Acts on every connection on l whose time has come. Returns the ms
+// until the next one is due, -1 when none is.
+static int run_due(Worker *w, DueList *l)
+{
+    long long now = now_ns();
+    while (l->head != NULL)
+    {
+        Conn *c = l->head;
+        if (c->due_ns > now)
+            return (int)((c->due_ns - now + 999999) / 1000000);
+
+        due_unlink(c);
+        if (c->state == CONN_THINKING)
+            play_move(w, c);
+        else if (c->state == CONN_RETRY)
+            conn_open(w, c);
+    }
+    return -1;
+}
+
+static void *worker_thread(void *arg)
+{
+    Worker *w = arg;
+    struct epoll_event events[EVENTS_MAX];
+
+    for (int i = 0; i < w->count; ++i)
+        conn_open(w, &w->conns[i]);
+
+    while (!atomic_load_explicit(&stopping, memory_order_relaxed))
+    {
+        int timeout = 100; // to notice stopping
+        int thinking = run_due(w, &w->thinking);
+        int retrying = run_due(w, &w->retrying);
+        if (thinking >= 0 && thinking < timeout)
+            timeout = thinking;
+        if (retrying >= 0 && retrying < timeout)
+            timeout = retrying;
+
+        int n = epoll_wait(w->epoll_fd, events, EVENTS_MAX, timeout);
+        for (int i = 0; i < n; ++i)
+        {
+            Conn *c = events[i].data.ptr;
+            if (c->fd >= 0)
+                handle_event(w, c, events[i].events);
+        }
+    }
+
+    for (int i = 0; i < w->count; ++i)
+        if (w->conns[i].fd >= 0)
+        {
+            send(w->conns[i].fd, "QUIT\n", 5, MSG_NOSIGNAL);
+            close(w->conns[i].fd);
+        }
+    return NULL;
+}
+
+static unsigned long total(Worker *workers, int threads, size_t offset)
+{
+    unsigned long sum = 0;
+    for (int i = 0; i < threads; ++i)
+        sum += atomic_load_explicit((_Atomic unsigned long *)((char *)&workers[i].counts + offset),
+                                    memory_order_relaxed);
+    return sum;
+}
+
+#define TOTAL(field) total(workers, threads, offsetof(Counts, field))
+
+static void print_latency(const char *name, double ns)
+{
+    if (ns < 1e6)
+        printf(" %s %.0fus", name, ns / 1e3);
+    else
+        printf(" %s %.2fms", name, ns / 1e6);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = (argc > 1) ? argv[1] : "127.0.0.1";
+    int port = (argc > 2) ? atoi(argv[2]) : 1100;
+    int connections = (argc > 3) ? atoi(argv[3]) : 1000;
+    double rate = (argc > 4) ? atof(argv[4]) : 0;
+    int seconds = (argc > 5) ? atoi(argv[5]) : 10;
+    int threads = (argc > 6) ? atoi(argv[6]) : 2;
+
+    if (connections < 2 || threads < 1 || threads > MAX_THREADS || seconds < 1)
+    {
+        fprintf(stderr, "need at least 2 connections, 1 to %d threads and 1 second\n", MAX_THREADS);
+        return 1;
+    }
+    if (threads > connections)
+        threads = connections;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &server_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "bad address %s\n", host);
+        return 1;
+    }
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (rate > 0)
+        think_ns = (long long)((double)connections / 2 / rate * 1e9);
+
+    Worker *workers = calloc((size_t)threads, sizeof(Worker));
+    Conn *conns = calloc((size_t)connections, sizeof(Conn));
+    pthread_t tid[MAX_THREADS];
+    if (workers == NULL || conns == NULL)
+    {
+        perror("calloc");
+        return 1;
+    }
+
+    for (int i = 0, first = 0; i < threads; ++i)
+    {
+        Worker *w = &workers[i];
+        w->conns = conns + first;
+        w->count = connections / threads + (i < connections % threads);
+        first += w->count;
+        w->rng = 0x9E3779B97F4A7C15ull * (uint64_t)(i + 1);
+        w->thinking.delay_ns = think_ns;
+        w->retrying.delay_ns = RETRY_MS * 1000000ll;
+        w->epoll_fd = epoll_create1(0);
+        if (w->epoll_fd < 0)
+        {
+            perror("epoll_create1");
+            return 1;
+        }
+        for (int k = 0; k < w->count; ++k)
+            w->conns[k].fd = -1;
+        pthread_create(&tid[i], NULL, worker_thread, w);
+    }
+
+    struct timespec warmup = {.tv_sec = WARMUP_SEC, .tv_nsec = 0};
+    nanosleep(&warmup, NULL);
+    atomic_store(&measuring, 1);
+    long long start = now_ns();
+    struct timespec second = {.tv_sec = 1, .tv_nsec = 0};
+
+    unsigned long last_moves = 0;
+    unsigned long last_games = 0;
+    for (int s = 1; s <= seconds; ++s)
+    {
+        nanosleep(&second, NULL);
+        unsigned long moves = TOTAL(moves);
+        unsigned long games = TOTAL(games);
+        unsigned long errors = TOTAL(invalid) + TOTAL(server_errors) + TOTAL(dropped) + TOTAL(connect_failed);
+        printf("%3ds  moves/s %8lu  games/s %6lu  errors %lu\n", s, moves - last_moves, games - last_games, errors);
+        fflush(stdout);
+        last_moves = moves;
+        last_games = games;
+    }
+
+    atomic_store(&measuring, 0);
+    double secs = (double)(now_ns() - start) / 1e9;
+    atomic_store(&stopping, 1);
+    for (int i = 0; i < threads; ++i)
+        pthread_join(tid[i], NULL);
+
+    uint64_t hist[BUCKETS] = {0};
+    uint64_t count = 0;
+    uint64_t max_ns = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        for (int b = 0; b < BUCKETS; ++b)
+            hist[b] += workers[i].hist[b];
+        if (workers[i].max_ns > max_ns)
+            max_ns = workers[i].max_ns;
+    }
+    for (int b = 0; b < BUCKETS; ++b)
+        count += hist[b];
+
+    printf("\n%d connections, %d threads, %.1fs measured after %ds of warm-up\n", connections, threads, secs,
+           WARMUP_SEC);
+    printf("moves %llu (%.0f/s), games finished %lu (%.1f/s), given up after %d moves %lu\n",
+           (unsigned long long)count, (double)count / secs, TOTAL(games), (double)TOTAL(games) / secs, MAX_PLIES,
+           TOTAL(given_up));
+
+    printf("move latency:");
+    const double quantiles[] = {0.5, 0.99, 0.999};
+    const char *names[] = {"p50", "p99", "p999"};
+    size_t q = 0;
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKETS && q < 3 && count > 0; ++b)
+    {
+        seen += hist[b];
+        while (q < 3 && (double)seen >= quantiles[q] * (double)count)
+            print_latency(names[q++], bucket_value(b));
+    }
+    print_latency("max", (double)max_ns);
+    printf("\n");
+
+    printf("errors: %lu invalid moves, %lu server errors, %lu dropped connections, %lu failed connects\n",
+           TOTAL(invalid), TOTAL(server_errors), TOTAL(dropped), TOTAL(connect_failed));
+    return 0;
+}
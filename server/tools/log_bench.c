@@ -0,0 +1,121 @@
+// Measures what a log line costs the thread that logs it: the server's
+// per-thread rings against fprintf to one shared FILE, the way the
+// server logged before, both fully buffered and line buffered as stdout
+// is on a terminal. Everything goes to /dev/null, so only the caller's
+// side is timed.
+//
+//   gcc -O2 -pthread -o log_bench server/tools/log_bench.c server/log.c
+//   ./log_bench [lines_per_thread] [threads]
+//
+// Threads log in bursts small enough for a ring and pause between them
+// for the writer to catch up, as a server thread would; only the bursts
+// are timed. Lines that find their ring full anyway are dropped rather
+// than waited for, and the drops are printed.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "../log.h"
+
+#define MAX_THREADS 64
+#define BURST 512 // lines between two pauses
+#define PAUSE_MS 12 // a little over the writer's drain interval
+
+typedef struct
+{
+    long lines;
+    int use_ring;
+    FILE *out;
+    double ns_per_line;
+} Logger;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void *log_lines(void *arg)
+{
+    Logger *l = arg;
+    const char *line = "MOVE 5 0 4 1";
+
+    struct timespec pause = {.tv_sec = 0, .tv_nsec = PAUSE_MS * 1000000l};
+    double spent = 0;
+    for (long i = 0; i < l->lines;)
+    {
+        double t0 = now_ns();
+        for (long end = i + BURST; i < end && i < l->lines; ++i)
+        {
+            if (l->use_ring)
+                log_debug("Client %ld sent: %s", i, line);
+            else
+                fprintf(l->out, "Client %ld sent: %s\n", i, line);
+        }
+        spent += now_ns() - t0;
+        nanosleep(&pause, NULL);
+    }
+    l->ns_per_line = spent / (double)l->lines;
+    return NULL;
+}
+
+static double run(int use_ring, FILE *out, long lines, int threads)
+{
+    Logger l[MAX_THREADS];
+    pthread_t tid[MAX_THREADS];
+
+    for (int i = 0; i < threads; ++i)
+    {
+        l[i].lines = lines;
+        l[i].use_ring = use_ring;
+        l[i].out = out;
+        pthread_create(&tid[i], NULL, log_lines, &l[i]);
+    }
+
+    double total = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_join(tid[i], NULL);
+        total += l[i].ns_per_line;
+    }
+    return total / threads;
+}
+
+int main(int argc, char *argv[])
+{
+    long lines = (argc > 1) ? atol(argv[1]) : 100000;
+    int threads = (argc > 2) ? atoi(argv[2]) : 4;
+    if (threads < 1 || threads > MAX_THREADS)
+    {
+        fprintf(stderr, "threads must be between 1 and %d\n", MAX_THREADS);
+        return 1;
+    }
+
+    FILE *devnull = fopen("/dev/null", "w");
+    if (devnull == NULL)
+    {
+        perror("/dev/null");
+        return 1;
+    }
+
+    printf("fprintf, shared FILE:   %6.1f ns/line\n", run(0, devnull, lines, threads));
+
+    FILE *line_buffered = fopen("/dev/null", "w");
+    if (line_buffered == NULL || setvbuf(line_buffered, NULL, _IOLBF, BUFSIZ) != 0)
+        return 1;
+    printf("fprintf, line buffered: %6.1f ns/line\n", run(0, line_buffered, lines, threads));
+
+    log_threshold = LOG_DEBUG;
+    FILE *sink = fopen("/dev/null", "w");
+    if (sink == NULL || log_start(sink, 0) < 0)
+        return 1;
+    printf("ring:                   %6.1f ns/line\n", run(1, NULL, lines, threads));
+
+    printf("                        %lu of %ld lines dropped, ring full\n", log_dropped(), lines * threads);
+
+    log_threshold = LOG_INFO;
+    printf("ring, level filtered:   %6.1f ns/line\n", run(1, NULL, lines, threads));
+    return 0;
+}
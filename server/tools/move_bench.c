@@ -0,0 +1,240 @@
+// Plays random games over two local connections and reports how many
+// syscalls and TCP segments each move costs on the wire.
+//
+//   gcc -O2 -o move_bench server/tools/move_bench.c server/checkers.c
+//   ./move_bench [host] [port] [moves]
+//
+// Segment counts come from TCP_INFO on the client sockets, so they cover
+// exactly the traffic of these two connections. Start the server with
+// -s 1 to see its own syscalls per command next to these numbers.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/tcp.h>
+
+#include "../checkers.h"
+
+typedef struct
+{
+    int fd;
+    char buf[4096];
+    size_t len;
+    unsigned long recv_calls;
+} Conn;
+
+static int conn_open(Conn *c, const char *host, int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+        return -1;
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0)
+        return -1;
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(c->fd);
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    c->len = 0;
+    c->recv_calls = 0;
+    return 0;
+}
+
+static int read_line(Conn *c, char *out, size_t size)
+{
+    while (1)
+    {
+        char *nl = memchr(c->buf, '\n', c->len);
+        if (nl != NULL)
+        {
+            size_t n = (size_t)(nl - c->buf);
+            if (n >= size)
+                n = size - 1;
+            memcpy(out, c->buf, n);
+            out[n] = '\0';
+            size_t used = (size_t)(nl - c->buf) + 1;
+            memmove(c->buf, c->buf + used, c->len - used);
+            c->len -= used;
+            return (int)n;
+        }
+
+        ssize_t r = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+        c->recv_calls++;
+        if (r <= 0)
+            return -1;
+        c->len += (size_t)r;
+    }
+}
+
+static int is_turn_line(const char *line)
+{
+    return strcmp(line, "YOUR_TURN") == 0 ||
+           strcmp(line, "OPP_TURN") == 0 ||
+           strcmp(line, "YOUR_TURN_CONTINUE_CAPTURE") == 0 ||
+           strcmp(line, "OPP_TURN_CAPTURE_CHAIN") == 0 ||
+           strcmp(line, "YOU_WIN") == 0 ||
+           strcmp(line, "YOU_LOSE") == 0 ||
+           strcmp(line, "DRAW") == 0;
+}
+
+// Reads until the line that tells this side what happens next.
+static int read_until_turn(Conn *c)
+{
+    char line[512];
+    do
+    {
+        if (read_line(c, line, sizeof(line)) < 0)
+            return -1;
+        if (strcmp(line, "MOVE_INVALID") == 0 || strncmp(line, "ERROR", 5) == 0 ||
+            strcmp(line, "OPPONENT_LEFT") == 0)
+        {
+            fprintf(stderr, "unexpected reply: %s\n", line);
+            return -1;
+        }
+    } while (!is_turn_line(line));
+    return 0;
+}
+
+static int pick_move(const Game *g, int *fr, int *fc, int *tr, int *tc)
+{
+    int moves[BOARD_SQUARES * 4][4];
+    int n = 0;
+
+    for (int r = 0; r < BOARD_SIZE; ++r)
+        for (int c = 0; c < BOARD_SIZE; ++c)
+            for (int dr = -2; dr <= 2; ++dr)
+                for (int dc = -2; dc <= 2; ++dc)
+                    if (dr != 0 && (dr == dc || dr == -dc) &&
+                        game_is_move_legal(g, r, c, r + dr, c + dc))
+                    {
+                        moves[n][0] = r;
+                        moves[n][1] = c;
+                        moves[n][2] = r + dr;
+                        moves[n][3] = c + dc;
+                        n++;
+                    }
+
+    if (n == 0)
+        return -1;
+
+    int k = rand() % n;
+    *fr = moves[k][0];
+    *fc = moves[k][1];
+    *tr = moves[k][2];
+    *tc = moves[k][3];
+    return 0;
+}
+
+static void add_segments(int fd, unsigned long *in, unsigned long *out, int sign)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == 0)
+    {
+        *in += sign * (long)info.tcpi_data_segs_in;
+        *out += sign * (long)info.tcpi_data_segs_out;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = (argc > 1) ? argv[1] : "127.0.0.1";
+    int port = (argc > 2) ? atoi(argv[2]) : 1100;
+    long target = (argc > 3) ? atol(argv[3]) : 10000;
+
+    srand(1);
+
+    long moves = 0;
+    long games = 0;
+    unsigned long recv_calls = 0;
+    unsigned long send_calls = 0;
+    unsigned long segs_in = 0;
+    unsigned long segs_out = 0;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (moves < target)
+    {
+        Conn side[2];
+        if (conn_open(&side[0], host, port) < 0 || conn_open(&side[1], host, port) < 0)
+        {
+            perror("connect");
+            return 1;
+        }
+
+        // WAITING_FOR_OPPONENT, then the welcome batch on both sides.
+        char line[512];
+        if (read_line(&side[0], line, sizeof(line)) < 0 ||
+            read_until_turn(&side[0]) < 0 || read_until_turn(&side[1]) < 0)
+        {
+            fprintf(stderr, "game setup failed\n");
+            return 1;
+        }
+
+        for (int i = 0; i < 2; ++i)
+        {
+            add_segments(side[i].fd, &segs_in, &segs_out, -1);
+            side[i].recv_calls = 0;
+        }
+
+        Game g;
+        game_init(&g);
+
+        while (!game_is_finished(&g) && moves < target)
+        {
+            int fr, fc, tr, tc;
+            if (pick_move(&g, &fr, &fc, &tr, &tc) < 0)
+                break;
+
+            Conn *mover = &side[g.turn == COLOR_WHITE ? 0 : 1];
+            Conn *other = &side[g.turn == COLOR_WHITE ? 1 : 0];
+
+            char msg[64];
+            int len = snprintf(msg, sizeof(msg), "MOVE %d %d %d %d\n", fr, fc, tr, tc);
+            if (send(mover->fd, msg, (size_t)len, 0) != len)
+            {
+                perror("send");
+                return 1;
+            }
+            send_calls++;
+            game_apply_move(&g, fr, fc, tr, tc);
+
+            if (read_until_turn(mover) < 0 || read_until_turn(other) < 0)
+                return 1;
+            moves++;
+        }
+
+        for (int i = 0; i < 2; ++i)
+        {
+            add_segments(side[i].fd, &segs_in, &segs_out, 1);
+            recv_calls += side[i].recv_calls;
+            close(side[i].fd);
+        }
+        games++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    printf("games=%ld moves=%ld time=%.3fs moves/sec=%.0f avg_move_rtt=%.1fus\n",
+           games, moves, secs, (double)moves / secs, secs * 1e6 / (double)moves);
+    printf("per move: server->client segments=%.2f client->server segments=%.2f\n",
+           (double)segs_in / (double)moves, (double)segs_out / (double)moves);
+    printf("per move: client send calls=%.2f client recv calls=%.2f\n",
+           (double)send_calls / (double)moves, (double)recv_calls / (double)moves);
+    return 0;
+}
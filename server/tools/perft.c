@@ -0,0 +1,307 @@
+// Counts the move tree from a set of positions with game_is_move_legal
+// and game_apply_move, checks the counts and reports how fast the rules
+// engine walks it. Every depth is counted a second time from the lists
+// game_generate_moves returns, which must give the same numbers.
+//
+//   gcc -O2 -o perft server/tools/perft.c server/checkers.c
+//   ./perft                       run the whole suite
+//   ./perft <depth> [board side]  count one position, e.g.
+//   ./perft 6 .b.b.b.bb.b.b.b..b.b.b.b................w.w.w.w..w.w.w.ww.w.w.w. w
+//
+// A board is 64 cells in the BOARD message alphabet (. w W b B), row 0
+// first; side is w or b. One move is a whole turn: the hops of a capture
+// chain are followed down to the end of the chain before the depth goes
+// down. Counts are of move paths, so two chains that only differ in the
+// order pieces are taken both count.
+//
+// The initial position counts match the published English draughts perft
+// values as long as no man promotes in the middle of a chain, which is
+// the only place where this engine's rules differ. The other positions'
+// counts were recorded from checkers.c and guard against regressions.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../checkers.h"
+
+#define MAX_HOPS 64
+#define MAX_MOVES 256
+
+typedef struct
+{
+    const char *name;
+    const char *board; // NULL for game_init
+    char side;
+    int depth;
+    unsigned long long nodes[16]; // expected count at depth 1, 2, ...
+} PerftCase;
+
+static const PerftCase cases[] = {
+    {"initial", NULL, 'w', 8, {7, 49, 302, 1469, 7361, 36768, 179740, 845931}},
+    {"kings", "........" "..B....." "........" "....w..." "...W...." "........" ".....b.." "........", 'w', 9,
+     {5, 25, 111, 474, 2282, 9842, 47311, 218694, 1041851}},
+    {"double jump", ".b.b.b.b" "........" ".b.b...." "........" ".b...b.." "w......." ".w.w.w.w" "w.w.w.w.", 'w', 8,
+     {2, 12, 75, 506, 2496, 15742, 92580, 559172}},
+    {"promotion chain", "........" "..b.b..." ".w......" "........" ".....b.." "......w." "........" "........", 'w', 10,
+     {2, 2, 6, 6, 16, 32, 98, 273, 1056, 2924}},
+};
+
+#define CASE_COUNT (sizeof(cases) / sizeof(cases[0]))
+
+static unsigned long long total_hops;
+static double total_secs;
+
+typedef struct
+{
+    unsigned long long hops; // every game_apply_move, for the speed figure
+} Counters;
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Pieces of one colour with a step or a jump, ignoring forced captures:
+// what checkers.c keeps in Game.movable.
+static uint32_t movable_pieces(const Game *g, PlayerColor color)
+{
+    uint32_t own = (color == COLOR_WHITE) ? g->white : g->black;
+    uint32_t opp = (color == COLOR_WHITE) ? g->black : g->white;
+    int forward = (color == COLOR_WHITE) ? -1 : 1;
+    uint32_t res = 0;
+
+    for (uint32_t rest = own; rest; rest &= rest - 1)
+    {
+        int sq = __builtin_ctz(rest);
+        int r, c;
+        game_square_coords(sq, &r, &c);
+
+        for (int dr = -1; dr <= 1; dr += 2)
+            for (int dc = -1; dc <= 1; dc += 2)
+            {
+                if (!(g->kings & (1u << sq)) && dr != forward)
+                    continue;
+
+                int step = game_square(r + dr, c + dc);
+                int jump = game_square(r + 2 * dr, c + 2 * dc);
+                if (r + dr < 0 || r + dr >= BOARD_SIZE || step < 0)
+                    continue;
+                if (!((g->white | g->black) & (1u << step)) ||
+                    ((opp & (1u << step)) && r + 2 * dr >= 0 && r + 2 * dr < BOARD_SIZE && jump >= 0 &&
+                     !((g->white | g->black) & (1u << jump))))
+                    res |= 1u << sq;
+            }
+    }
+    return res;
+}
+
+static int load_position(Game *g, const char *board, char side)
+{
+    game_init(g);
+    if (board == NULL)
+    {
+        g->turn = (side == 'b') ? COLOR_BLACK : COLOR_WHITE;
+        return 0;
+    }
+
+    if (strlen(board) != BOARD_SIZE * BOARD_SIZE)
+        return -1;
+
+    g->white = 0;
+    g->black = 0;
+    g->kings = 0;
+    g->piece_count[COLOR_WHITE] = 0;
+    g->piece_count[COLOR_BLACK] = 0;
+
+    for (int r = 0; r < BOARD_SIZE; ++r)
+        for (int c = 0; c < BOARD_SIZE; ++c)
+        {
+            char cell = board[r * BOARD_SIZE + c];
+            int sq = game_square(r, c);
+            if (cell == CELL_EMPTY)
+                continue;
+            if (sq < 0)
+                return -1;
+
+            uint32_t bit = 1u << sq;
+            if (cell == CELL_WHITE || cell == CELL_WHITE_KING)
+            {
+                g->white |= bit;
+                g->piece_count[COLOR_WHITE]++;
+            }
+            else if (cell == CELL_BLACK || cell == CELL_BLACK_KING)
+            {
+                g->black |= bit;
+                g->piece_count[COLOR_BLACK]++;
+            }
+            else
+                return -1;
+
+            if (cell == CELL_WHITE_KING || cell == CELL_BLACK_KING)
+                g->kings |= bit;
+        }
+
+    g->turn = (side == 'b') ? COLOR_BLACK : COLOR_WHITE;
+    g->movable[COLOR_WHITE] = movable_pieces(g, COLOR_WHITE);
+    g->movable[COLOR_BLACK] = movable_pieces(g, COLOR_BLACK);
+    return 0;
+}
+
+// Legal hops of the side to move, as (from, to) square pairs.
+static int generate_hops(const Game *g, int hops[][2])
+{
+    uint32_t own = (g->turn == COLOR_WHITE) ? g->white : g->black;
+    int n = 0;
+
+    while (own)
+    {
+        int sq = __builtin_ctz(own);
+        own &= own - 1;
+
+        int r, c;
+        game_square_coords(sq, &r, &c);
+        for (int dist = 1; dist <= 2; ++dist)
+            for (int dr = -dist; dr <= dist; dr += 2 * dist)
+                for (int dc = -dist; dc <= dist; dc += 2 * dist)
+                    if (game_is_move_legal(g, r, c, r + dr, c + dc))
+                    {
+                        hops[n][0] = sq;
+                        hops[n][1] = game_square(r + dr, c + dc);
+                        n++;
+                    }
+    }
+    return n;
+}
+
+static unsigned long long perft(const Game *g, int depth, Counters *cnt)
+{
+    if (depth == 0)
+        return 1;
+
+    int hops[MAX_HOPS][2];
+    int n = generate_hops(g, hops);
+    unsigned long long nodes = 0;
+
+    for (int i = 0; i < n; ++i)
+    {
+        Game child = *g;
+        int fr, fc, tr, tc;
+        game_square_coords(hops[i][0], &fr, &fc);
+        game_square_coords(hops[i][1], &tr, &tc);
+        game_apply_move(&child, fr, fc, tr, tc);
+        cnt->hops++;
+
+        // The turn only passes once the chain is over.
+        if (child.turn == g->turn && child.must_continue_capture)
+            nodes += perft(&child, depth, cnt);
+        else
+            nodes += perft(&child, depth - 1, cnt);
+    }
+    return nodes;
+}
+
+static unsigned long long bad_moves; // generated moves game_apply_move disagrees with
+
+static unsigned long long perft_generated(const Game *g, int depth)
+{
+    if (depth == 0)
+        return 1;
+
+    Move moves[MAX_MOVES];
+    int n = game_generate_moves(g, moves, MAX_MOVES);
+    if (n > MAX_MOVES)
+    {
+        bad_moves++;
+        n = MAX_MOVES;
+    }
+
+    unsigned long long nodes = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        Game child = *g;
+        for (int h = 0; h < moves[i].hops; ++h)
+        {
+            int fr, fc, tr, tc;
+            game_square_coords(moves[i].squares[h], &fr, &fc);
+            game_square_coords(moves[i].squares[h + 1], &tr, &tc);
+            if (!game_apply_move(&child, fr, fc, tr, tc))
+                bad_moves++;
+        }
+
+        // A listed chain must end the turn.
+        if (child.turn == g->turn)
+            bad_moves++;
+        nodes += perft_generated(&child, depth - 1);
+    }
+    return nodes;
+}
+
+// Returns the number of mismatches.
+static int run_case(const PerftCase *pc, int depth, int check)
+{
+    Game g;
+    if (load_position(&g, pc->board, pc->side) < 0)
+    {
+        fprintf(stderr, "%s: bad board\n", pc->name);
+        return 1;
+    }
+
+    int failures = 0;
+    printf("%s\n", pc->name);
+    for (int d = 1; d <= depth; ++d)
+    {
+        Counters cnt = {0};
+        double t0 = now_s();
+        unsigned long long nodes = perft(&g, d, &cnt);
+        double secs = now_s() - t0;
+        total_hops += cnt.hops;
+        total_secs += secs;
+
+        bad_moves = 0;
+        t0 = now_s();
+        unsigned long long generated = perft_generated(&g, d);
+        double gen_secs = now_s() - t0;
+
+        unsigned long long expected = (check && d <= 16) ? pc->nodes[d - 1] : 0;
+        printf("  depth %2d  nodes %12llu  hops %12llu  %8.3fs  %7.2f Mhops/s  generated %8.3fs",
+               d, nodes, cnt.hops, secs, secs > 0 ? (double)cnt.hops / secs / 1e6 : 0.0, gen_secs);
+        if (generated != nodes || bad_moves != 0)
+        {
+            printf("  GENERATOR MISMATCH: %llu nodes, %llu bad moves", generated, bad_moves);
+            failures++;
+        }
+        if (expected != 0 && nodes == expected)
+            printf("  ok");
+        else if (expected != 0)
+        {
+            printf("  MISMATCH, expected %llu", expected);
+            failures++;
+        }
+        printf("\n");
+    }
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        PerftCase pc = {"position", NULL, 'w', atoi(argv[1]), {0}};
+        if (argc > 2)
+            pc.board = argv[2];
+        if (argc > 3)
+            pc.side = argv[3][0];
+        return run_case(&pc, pc.depth, 0) ? 1 : 0;
+    }
+
+    int failures = 0;
+    for (size_t i = 0; i < CASE_COUNT; ++i)
+        failures += run_case(&cases[i], cases[i].depth, 1);
+
+    printf("%s, %llu hops in %.3fs, %.2f Mhops/s\n", failures ? "FAILED" : "all counts match",
+           total_hops, total_secs, (double)total_hops / total_secs / 1e6);
+    return failures ? 1 : 0;
+}
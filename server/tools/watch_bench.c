@@ -0,0 +1,305 @@
+// Plays one random game while many spectators WATCH it, then checks that
+// every spectator ended up with the final position and result, and
+// reports how much the spectators cost the two players per move.
+//
+//   gcc -O2 -o watch_bench server/tools/watch_bench.c server/checkers.c
+//   ./watch_bench [host] [port] [spectator_port] [spectators] [slow]
+//
+// Spectators are only read once the game is over. The first `slow` of
+// them also use a tiny receive buffer, so on long games the server runs
+// out of room for them and has to resync them with a full board.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../checkers.h"
+
+#define MAX_MOVES 1000 // random kings can shuffle forever; the game is abandoned then
+
+typedef struct
+{
+    int fd;
+    char buf[8192];
+    size_t len;
+} Conn;
+
+static int conn_open(Conn *c, const char *host, int port, int rcvbuf)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+        return -1;
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0)
+        return -1;
+    if (rcvbuf > 0)
+        setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(c->fd);
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    c->len = 0;
+    return 0;
+}
+
+static int read_line(Conn *c, char *out, size_t size)
+{
+    while (1)
+    {
+        char *nl = memchr(c->buf, '\n', c->len);
+        if (nl != NULL)
+        {
+            size_t n = (size_t)(nl - c->buf);
+            if (n >= size)
+                n = size - 1;
+            memcpy(out, c->buf, n);
+            out[n] = '\0';
+            size_t used = (size_t)(nl - c->buf) + 1;
+            memmove(c->buf, c->buf + used, c->len - used);
+            c->len -= used;
+            return (int)n;
+        }
+
+        ssize_t r = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len, 0);
+        if (r <= 0)
+            return -1;
+        c->len += (size_t)r;
+    }
+}
+
+static int is_turn_line(const char *line)
+{
+    return strcmp(line, "YOUR_TURN") == 0 ||
+           strcmp(line, "OPP_TURN") == 0 ||
+           strcmp(line, "YOUR_TURN_CONTINUE_CAPTURE") == 0 ||
+           strcmp(line, "OPP_TURN_CAPTURE_CHAIN") == 0 ||
+           strcmp(line, "YOU_WIN") == 0 ||
+           strcmp(line, "YOU_LOSE") == 0 ||
+           strcmp(line, "DRAW") == 0;
+}
+
+static int read_until_turn(Conn *c, unsigned *game_id)
+{
+    char line[512];
+    do
+    {
+        if (read_line(c, line, sizeof(line)) < 0)
+            return -1;
+        if (game_id != NULL)
+            sscanf(line, "GAME %u", game_id);
+        if (strcmp(line, "MOVE_INVALID") == 0 || strncmp(line, "ERROR", 5) == 0 ||
+            strcmp(line, "OPPONENT_LEFT") == 0)
+        {
+            fprintf(stderr, "unexpected reply: %s\n", line);
+            return -1;
+        }
+    } while (!is_turn_line(line));
+    return 0;
+}
+
+static int pick_move(const Game *g, int *fr, int *fc, int *tr, int *tc)
+{
+    int moves[BOARD_SQUARES * 4][4];
+    int n = 0;
+
+    for (int r = 0; r < BOARD_SIZE; ++r)
+        for (int c = 0; c < BOARD_SIZE; ++c)
+            for (int dr = -2; dr <= 2; ++dr)
+                for (int dc = -2; dc <= 2; ++dc)
+                    if (dr != 0 && (dr == dc || dr == -dc) &&
+                        game_is_move_legal(g, r, c, r + dr, c + dc))
+                    {
+                        moves[n][0] = r;
+                        moves[n][1] = c;
+                        moves[n][2] = r + dr;
+                        moves[n][3] = c + dc;
+                        n++;
+                    }
+
+    if (n == 0)
+        return -1;
+
+    int k = rand() % n;
+    *fr = moves[k][0];
+    *fc = moves[k][1];
+    *tr = moves[k][2];
+    *tc = moves[k][3];
+    return 0;
+}
+
+// Replays one spectator's stream: BOARD lines replace the position, DELTA
+// lines must continue the sequence. Returns 0 when it ends in the final
+// position with the expected result line.
+static int check_spectator(Conn *c, const Game *final, const char *result, int *resyncs)
+{
+    char cells[BOARD_SIZE * BOARD_SIZE + 1];
+    long seq = -1;
+    char line[512];
+
+    while (read_line(c, line, sizeof(line)) >= 0)
+    {
+        if (strncmp(line, "BOARD ", 6) == 0)
+        {
+            if (seq >= 0)
+                (*resyncs)++;
+            memcpy(cells, line + 6, BOARD_SIZE * BOARD_SIZE);
+            seq = atol(line + 6 + BOARD_SIZE * BOARD_SIZE);
+        }
+        else if (strncmp(line, "DELTA ", 6) == 0)
+        {
+            char *p = line + 6;
+            long s = strtol(p, &p, 10);
+            if (seq < 0 || s != seq + 1)
+            {
+                fprintf(stderr, "spectator saw seq %ld after %ld\n", s, seq);
+                return -1;
+            }
+            seq = s;
+
+            int r, col, used;
+            char cell;
+            while (sscanf(p, " %d %d %c%n", &r, &col, &cell, &used) == 3)
+            {
+                cells[r * BOARD_SIZE + col] = cell;
+                p += used;
+            }
+        }
+        else if (strcmp(line, result) == 0)
+        {
+            for (int r = 0; r < BOARD_SIZE; ++r)
+                for (int col = 0; col < BOARD_SIZE; ++col)
+                    if (cells[r * BOARD_SIZE + col] != game_cell(final, r, col))
+                    {
+                        fprintf(stderr, "spectator board differs at %d %d\n", r, col);
+                        return -1;
+                    }
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "spectator got: %s\n", line);
+            return -1;
+        }
+    }
+    return -1;
+}
+
+static double elapsed_us(const struct timespec *a, const struct timespec *b)
+{
+    return (double)(b->tv_sec - a->tv_sec) * 1e6 + (double)(b->tv_nsec - a->tv_nsec) / 1e3;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *host = (argc > 1) ? argv[1] : "127.0.0.1";
+    int port = (argc > 2) ? atoi(argv[2]) : 1100;
+    int watch_port = (argc > 3) ? atoi(argv[3]) : port + 1;
+    int spectators = (argc > 4) ? atoi(argv[4]) : 1000;
+    int slow = (argc > 5) ? atoi(argv[5]) : 0;
+
+    srand(1);
+
+    Conn side[2];
+    unsigned game_id = 0;
+    char line[512];
+    if (conn_open(&side[0], host, port, 0) < 0 || conn_open(&side[1], host, port, 0) < 0 ||
+        read_line(&side[0], line, sizeof(line)) < 0 ||
+        read_until_turn(&side[0], &game_id) < 0 || read_until_turn(&side[1], NULL) < 0)
+    {
+        fprintf(stderr, "game setup failed\n");
+        return 1;
+    }
+
+    Conn *watchers = calloc((size_t)spectators, sizeof(Conn));
+    if (watchers == NULL)
+        return 1;
+
+    for (int i = 0; i < spectators; ++i)
+    {
+        if (conn_open(&watchers[i], host, watch_port, (i < slow) ? 1024 : 0) < 0)
+        {
+            perror("connect spectator");
+            return 1;
+        }
+        int len = snprintf(line, sizeof(line), "WATCH %u\n", game_id);
+        if (send(watchers[i].fd, line, (size_t)len, 0) != len)
+            return 1;
+    }
+
+    Game g;
+    game_init(&g);
+    long moves = 0;
+    double worst_us = 0;
+
+    struct timespec t0, t1, m0, m1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while (!game_is_finished(&g) && moves < MAX_MOVES)
+    {
+        int fr, fc, tr, tc;
+        if (pick_move(&g, &fr, &fc, &tr, &tc) < 0)
+            break;
+
+        Conn *mover = &side[g.turn == COLOR_WHITE ? 0 : 1];
+        Conn *other = &side[g.turn == COLOR_WHITE ? 1 : 0];
+
+        clock_gettime(CLOCK_MONOTONIC, &m0);
+        int len = snprintf(line, sizeof(line), "MOVE %d %d %d %d\n", fr, fc, tr, tc);
+        if (send(mover->fd, line, (size_t)len, 0) != len)
+            return 1;
+        game_apply_move(&g, fr, fc, tr, tc);
+
+        if (read_until_turn(mover, NULL) < 0 || read_until_turn(other, NULL) < 0)
+            return 1;
+        clock_gettime(CLOCK_MONOTONIC, &m1);
+
+        double us = elapsed_us(&m0, &m1);
+        if (us > worst_us)
+            worst_us = us;
+        moves++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    const char *result = "DRAW";
+    if (g.result == GAME_WHITE_WIN)
+        result = "WHITE_WINS";
+    else if (g.result == GAME_BLACK_WIN)
+        result = "BLACK_WINS";
+    else if (!game_is_finished(&g))
+    {
+        result = "PLAYER_LEFT";
+        send(side[0].fd, "QUIT\n", 5, 0);
+    }
+
+    int ok = 0;
+    int resyncs = 0;
+    for (int i = 0; i < spectators; ++i)
+    {
+        if (check_spectator(&watchers[i], &g, result, &resyncs) == 0)
+            ok++;
+        close(watchers[i].fd);
+    }
+    close(side[0].fd);
+    close(side[1].fd);
+
+    printf("game=%u moves=%ld spectators=%d (slow %d) avg_move_rtt=%.1fus worst=%.1fus\n",
+           game_id, moves, spectators, slow, elapsed_us(&t0, &t1) / (double)moves, worst_us);
+    printf("spectators in sync at the end: %d/%d, full-board resyncs: %d\n", ok, spectators, resyncs);
+    free(watchers);
+    return (ok == spectators) ? 0 : 1;
+}
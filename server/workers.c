@@ -0,0 +1,64 @@
+#include "workers.h"
+
+#include <stddef.h>
+
+static void *worker_thread(void *arg)
+{
+    WorkerPool *wp = arg;
+    void *ctx = wp->make_ctx ? wp->make_ctx() : NULL;
+
+    while (1)
+    {
+        pthread_mutex_lock(&wp->lock);
+        while (wp->head == NULL)
+            pthread_cond_wait(&wp->ready, &wp->lock);
+
+        Job *job = wp->head;
+        wp->head = job->next;
+        if (wp->head == NULL)
+            wp->tail = NULL;
+        wp->queued--;
+        pthread_mutex_unlock(&wp->lock);
+
+        job->run(job, ctx);
+    }
+
+    return NULL;
+}
+
+int workers_start(WorkerPool *wp, int threads, ContextFn make_ctx)
+{
+    pthread_mutex_init(&wp->lock, NULL);
+    pthread_cond_init(&wp->ready, NULL);
+    wp->head = NULL;
+    wp->tail = NULL;
+    wp->queued = 0;
+    wp->make_ctx = make_ctx;
+
+    int started = 0;
+    for (int i = 0; i < threads; ++i)
+    {
+        pthread_t thread_id;
+        if (pthread_create(&thread_id, NULL, worker_thread, wp) != 0)
+            continue;
+        pthread_detach(thread_id);
+        started++;
+    }
+
+    return (started > 0) ? 0 : -1;
+}
+
+void workers_submit(WorkerPool *wp, Job *job)
+{
+    job->next = NULL;
+
+    pthread_mutex_lock(&wp->lock);
+    if (wp->tail != NULL)
+        wp->tail->next = job;
+    else
+        wp->head = job;
+    wp->tail = job;
+    wp->queued++;
+    pthread_cond_signal(&wp->ready);
+    pthread_mutex_unlock(&wp->lock);
+}
@@ -0,0 +1,36 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <pthread.h>
+
+struct Job;
+
+// ctx is the per-thread state made by the pool's ContextFn.
+typedef void (*JobFn)(struct Job *job, void *ctx);
+typedef void *(*ContextFn)(void);
+
+// Intrusive: embed a Job at the start of the request and recover the
+// request from it in run.
+typedef struct Job
+{
+    JobFn run;
+    struct Job *next;
+} Job;
+
+// A fixed number of threads taking jobs from one FIFO queue, for work
+// too slow to do on a reactor. Jobs never run on the submitting thread.
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    Job *head;
+    Job *tail;
+    int queued;
+    ContextFn make_ctx;
+} WorkerPool;
+
+// Returns -1 if no thread could be started.
+int workers_start(WorkerPool *wp, int threads, ContextFn make_ctx);
+void workers_submit(WorkerPool *wp, Job *job);
+
+#endif